@@ -4,8 +4,18 @@
 #define MM_TYPE_PAGE_TABLE 0x3
 #define MM_TYPE_PAGE 0x3
 #define MM_TYPE_BLOCK 0x1
+#define MM_TYPE_MASK 0x3
 #define MM_ACCESS (0x1 << 10)
 #define MM_ACCESS_PERMISSION (0x01 << 6)
+#define MM_SH_INNER (0x3 << 8) // Inner Shareable
+#define MM_AP_RDONLY (0x1 << 7)  // AP[2]: read-only at EL0 and EL1
+#define MM_NG (0x1 << 11)        // not global: tagged with the ASID
+#define PTE_VALID 0x1
+#define PTE_CONT (0x1UL << 52)   // one of CONT_PTES entries sharing a TLB entry
+#define PTE_PXN (0x1UL << 53)    // not executable at EL1
+#define PTE_UXN (0x1UL << 54)    // not executable at EL0
+#define PTE_COW (0x1UL << 55)    // software bit: shared after fork
+#define PTE_SWAP (0x1UL << 2)    // software bit of an invalid entry, see swap.h
 
 /*
  * Memory region attributes:
@@ -14,25 +24,57 @@
  *			n	MAIR
  *   DEVICE_nGnRnE	000	00000000
  *   NORMAL_NC		001	01000100
+ *   NORMAL		010	11111111 (inner/outer write-back, RW-allocate)
  */
 #define MT_DEVICE_nGnRnE 0x0
 #define MT_NORMAL_NC 0x1
+#define MT_NORMAL 0x2
 #define MT_DEVICE_nGnRnE_FLAGS 0x00
 #define MT_NORMAL_NC_FLAGS 0x44
+#define MT_NORMAL_FLAGS 0xff
 #define MAIR_VALUE                                                             \
   (MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) |                         \
-      (MT_NORMAL_NC_FLAGS << (8 * MT_NORMAL_NC))
+      (MT_NORMAL_NC_FLAGS << (8 * MT_NORMAL_NC)) |                             \
+      (MT_NORMAL_FLAGS << (8 * MT_NORMAL))
 
-#define MMU_FLAGS (MM_TYPE_BLOCK | (MT_NORMAL_NC << 2) | MM_ACCESS)
+#define MMU_FLAGS                                                              \
+  (MM_TYPE_BLOCK | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS)
 #define MMU_DEVICE_FLAGS (MM_TYPE_BLOCK | (MT_DEVICE_nGnRnE << 2) | MM_ACCESS)
+// Page flags are only used for TTBR0 (user) mappings, which are all nG
 #define MMU_PTE_FLAGS                                                          \
-  (MM_TYPE_PAGE | (MT_NORMAL_NC << 2) | MM_ACCESS | MM_ACCESS_PERMISSION)
-#define MMU_PTE_FLAGS_GUARD (MM_TYPE_PAGE | (MT_NORMAL_NC << 2) | MM_ACCESS)
+  (MM_TYPE_PAGE | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS |                 \
+   MM_ACCESS_PERMISSION | MM_NG)
+#define MMU_PTE_FLAGS_NC                                                       \
+  (MM_TYPE_PAGE | (MT_NORMAL_NC << 2) | MM_ACCESS | MM_ACCESS_PERMISSION |     \
+   MM_NG)
+#define MMU_PTE_FLAGS_GUARD                                                    \
+  (MM_TYPE_PAGE | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS | MM_NG)
+// Kernel page mappings (vmalloc): global, EL1 only, never executable
+#define MMU_KERNEL_PTE_FLAGS                                                   \
+  (MM_TYPE_PAGE | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS | PTE_PXN |       \
+   PTE_UXN)
+
+#define PTE_ATTRINDX_MASK (0x7 << 2)
+#define PTE_ADDR_MASK 0x0000fffffffff000 // output address, bits 47:12
 
 #define TCR_T0SZ (64 - 48)
 #define TCR_T1SZ ((64 - 48) << 16)
 #define TCR_TG0_4K (0 << 14)
 #define TCR_TG1_4K (2 << 30)
-#define TCR_VALUE (TCR_T0SZ | TCR_T1SZ | TCR_TG0_4K | TCR_TG1_4K)
+// Table walks go through the inner/outer write-back caches, inner shareable,
+// so the walker sees page table writes without cache maintenance.
+#define TCR_IRGN0_WBWA (1 << 8)
+#define TCR_ORGN0_WBWA (1 << 10)
+#define TCR_SH0_INNER (3 << 12)
+#define TCR_IRGN1_WBWA (1 << 24)
+#define TCR_ORGN1_WBWA (1 << 26)
+#define TCR_SH1_INNER (3 << 28)
+#define TCR_CACHE_FLAGS                                                        \
+  (TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | TCR_SH0_INNER | TCR_IRGN1_WBWA |          \
+   TCR_ORGN1_WBWA | TCR_SH1_INNER)
+#define TCR_A1_TTBR0 (0 << 22) // the ASID comes from TTBR0
+#define TCR_VALUE                                                              \
+  (TCR_T0SZ | TCR_T1SZ | TCR_TG0_4K | TCR_TG1_4K | TCR_CACHE_FLAGS |            \
+   TCR_A1_TTBR0)
 
 #endif
@@ -10,7 +10,9 @@
 #define SCTLR_EE_LITTLE_ENDIAN (0 << 25)
 #define SCTLR_EOE_LITTLE_ENDIAN (0 << 24)
 #define SCTLR_I_CACHE_DISABLED (0 << 12)
+#define SCTLR_I_CACHE_ENABLED (1 << 12)
 #define SCTLR_D_CACHE_DISABLED (0 << 2)
+#define SCTLR_D_CACHE_ENABLED (1 << 2)
 #define SCTLR_MMU_DISABLED (0 << 0)
 #define SCTLR_MMU_ENABLED (1 << 0)
 
@@ -18,6 +20,8 @@
   (SCTLR_RESERVED | SCTLR_EE_LITTLE_ENDIAN | SCTLR_I_CACHE_DISABLED |          \
    SCTLR_D_CACHE_DISABLED | SCTLR_MMU_DISABLED)
 
+#define SCTLR_CACHES_ENABLED (SCTLR_I_CACHE_ENABLED | SCTLR_D_CACHE_ENABLED)
+
 // ***************************************
 // HCR_EL2, Hypervisor Configuration Register (EL2), Page 2487 of
 // AArch64-Reference-Manual.
@@ -61,5 +65,6 @@
 #define ESR_ELx_EC_SHIFT 26
 #define ESR_ELx_EC_SVC64 0x15
 #define ESR_ELx_EC_DABT_LOW 0x24
+#define ESR_ELx_WNR (1 << 6) // data abort caused by a write
 
 #endif
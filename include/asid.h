@@ -0,0 +1,32 @@
+#ifndef _ASID_H
+#define _ASID_H
+
+#ifndef __ASSEMBLER__
+
+#include "sched.h"
+
+/*
+ * Address space identifiers.
+ *
+ * User mappings are non-global and tagged with the ASID held in TTBR0, so a
+ * context switch only rewrites TTBR0 instead of flushing the TLB. ASIDs are
+ * handed out in generations: mm->context_id holds the generation in the
+ * bits above the ASID, and a context from an old generation gets a fresh
+ * ASID on its next switch. When a generation runs out the whole TLB is
+ * flushed once and a new one starts. ASID 0 is reserved for TTBR0 holding
+ * no user address space, which points it at an empty table.
+ */
+
+void asid_init(void);
+unsigned long asid_bits(void);
+unsigned long asid_get(struct mm_struct *mm);
+// mm's ASID if it has one in this generation, else 0: nothing of it is in
+// the TLB
+unsigned long asid_of(struct mm_struct *mm);
+unsigned long asid_rollovers(void);
+void switch_mm(struct mm_struct *mm);
+void flush_tlb_mm(struct mm_struct *mm);
+
+#endif
+
+#endif /* _ASID_H */
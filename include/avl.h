@@ -0,0 +1,30 @@
+#ifndef _AVL_H
+#define _AVL_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Intrusive AVL tree.
+ *
+ * Nodes are embedded in the objects they order. The caller supplies the
+ * ordering through cmp, which must never report two distinct nodes as equal,
+ * and does its own lookups by walking left/right from the root.
+ */
+
+struct avl_node {
+  struct avl_node *left;
+  struct avl_node *right;
+  int height;
+};
+
+typedef int (*avl_cmp_fn)(const struct avl_node *a, const struct avl_node *b);
+
+void avl_insert(struct avl_node **root, struct avl_node *node, avl_cmp_fn cmp);
+void avl_erase(struct avl_node **root, struct avl_node *node, avl_cmp_fn cmp);
+struct avl_node *avl_first(struct avl_node *root);
+struct avl_node *avl_next(struct avl_node *root, struct avl_node *node,
+                          avl_cmp_fn cmp);
+
+#endif
+
+#endif /* _AVL_H */
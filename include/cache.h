@@ -0,0 +1,16 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#ifndef __ASSEMBLER__
+
+void dcache_clean_range(unsigned long start, unsigned long size);
+void dcache_invalidate_range(unsigned long start, unsigned long size);
+void dcache_clean_invalidate_range(unsigned long start, unsigned long size);
+void flush_icache_range(unsigned long start, unsigned long size);
+void icache_invalidate_all(void);
+void dsb_ishst(void);
+void dsb_ishst_isb(void);
+
+#endif
+
+#endif /* _CACHE_H */
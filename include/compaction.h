@@ -0,0 +1,56 @@
+#ifndef _COMPACTION_H
+#define _COMPACTION_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Memory compaction.
+ *
+ * Fork and exit churn leaves free pages scattered, until high-order
+ * allocations fail with plenty of memory free. Compaction picks aligned
+ * blocks of the wanted order holding nothing but free pages and private
+ * user pages, and moves those pages out (see migrate_page) into free pages
+ * taken from the top of memory, out of free blocks too small for the order.
+ * As the last page of a block goes, the buddy allocator coalesces it, so
+ * user memory drifts towards the top and free blocks form below it.
+ *
+ * There are no reverse mappings: finding the PTEs of a block's pages takes
+ * a walk of every address space, so blocks are done COMPACT_BATCH at a
+ * time, cheapest first.
+ *
+ * compact_memory runs on demand. alloc_pages calls try_to_compact_pages
+ * when a high-order allocation fails; each failed attempt doubles the
+ * number of later ones for that order skipped, up to
+ * 1 << COMPACT_MAX_DEFER_SHIFT, and a success resets it.
+ *
+ * The fragmentation index of an order tells why an allocation of it fails,
+ * in thousandths: near 0 for lack of memory, near 1000 for fragmentation.
+ * It is -1000 while a free block of the order exists.
+ */
+
+#define COMPACT_BATCH 16
+#define COMPACT_MAX_DEFER_SHIFT 6
+
+struct compact_stats {
+  unsigned long stalls;         // failed allocations that compacted
+  unsigned long deferred;       // failed allocations that skipped it
+  unsigned long success;        // compactions that freed a block
+  unsigned long fail;           // compactions that freed none
+  unsigned long migrated;       // pages moved
+  unsigned long migrate_failed; // pages that turned out not to move
+  unsigned long blocks_freed;   // blocks of the wanted order formed
+  unsigned long time_us;        // time spent compacting
+  int last_order;               // order the last compaction was for
+  int last_index_before;        // its fragmentation index before
+  int last_index_after;         // and after
+};
+
+int fragmentation_index(int order);
+unsigned long compact_memory(int order);
+int try_to_compact_pages(int order);
+void compact_get_stats(struct compact_stats *stats);
+void compact_print_stats(void);
+
+#endif
+
+#endif /* _COMPACTION_H */
@@ -14,12 +14,22 @@
 #define PSR_MODE_EL3t 0x0000000c
 #define PSR_MODE_EL3h 0x0000000d
 
+/*
+ * User address space layout
+ */
+#define USER_CODE_START 0x1000           // page 0 is a guard page
+#define USER_STACK_TOP 0x0000800000000000 // grows down from here
+#define USER_STACK_SIZE 0x100000          // 1 MiB, faulted in on demand
+
 int copy_process(unsigned long clone_flags, unsigned long fn, unsigned long arg,
                  long pri);
-int move_to_user_mode(unsigned long start, unsigned long size,
-                      unsigned long pc);
+int move_to_user_mode(unsigned long start, unsigned long text_size,
+                      unsigned long size, unsigned long pc);
+int map_user_image(struct task_struct *task, unsigned long start,
+                   unsigned long text_size, unsigned long size);
 struct pt_regs *task_pt_regs(struct task_struct *tsk);
 
+long alloc_pid(void);
 void free_pid(long pid);
 
 struct pt_regs {
@@ -0,0 +1,37 @@
+#ifndef _KHUGEPAGED_H
+#define _KHUGEPAGED_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Background promotion of user memory to 2 MiB blocks.
+ *
+ * The khugepaged kernel thread wakes every khugepaged_sleep_us, walks the
+ * aligned 2 MiB ranges of anonymous VMAs from where it last stopped, and
+ * collapses each fully populated PTE table it finds into a block (see
+ * collapse_huge_pmd). Each wakeup looks at no more than
+ * khugepaged_pmds_to_scan ranges, which bounds how long it runs.
+ */
+
+#define KHUGEPAGED_SLEEP_US 1000000
+#define KHUGEPAGED_PMDS_TO_SCAN 64
+
+struct khugepaged_stats {
+  unsigned long full_scans;   // passes over every address space
+  unsigned long pmds_scanned; // 2 MiB ranges looked at
+  unsigned long collapsed;    // PTE tables promoted to blocks
+  unsigned long alloc_failed; // promotions abandoned for lack of a block
+  unsigned long scan_time_us; // time spent scanning and copying
+};
+
+extern unsigned long khugepaged_sleep_us;
+extern unsigned long khugepaged_pmds_to_scan;
+
+void khugepaged(void);
+unsigned long khugepaged_scan(unsigned long pmds);
+void khugepaged_get_stats(struct khugepaged_stats *stats);
+void khugepaged_print_stats(void);
+
+#endif
+
+#endif /* _KHUGEPAGED_H */
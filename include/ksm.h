@@ -0,0 +1,51 @@
+#ifndef _KSM_H
+#define _KSM_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Same-page merging.
+ *
+ * The ksmd kernel thread wakes every ksm_sleep_us and hashes up to
+ * ksm_pages_to_scan pages of anonymous memory, walking every address space
+ * from where it last stopped. Pages with identical contents are merged into
+ * one read-only page shared copy-on-write (see merge_page), so forks still
+ * holding the data they started with give back their duplicate copies.
+ *
+ * Merged pages sit in the stable tree, which holds a reference to each.
+ * Every other page scanned goes into the unstable tree, so a later page
+ * with the same contents can be merged with it; that tree is rebuilt on
+ * every pass, as its pages may change at any time. Both trees are ordered
+ * by hash, and a hash match is only merged after a full compare.
+ *
+ * A stable page takes at most ksm_max_sharing mappings, well within the
+ * 16-bit counts of struct page; past that, identical pages start another
+ * stable page.
+ */
+
+#define KSM_SLEEP_US 200000
+#define KSM_PAGES_TO_SCAN 256
+#define KSM_MAX_SHARING 256
+
+struct ksm_stats {
+  unsigned long full_scans;    // passes over every address space
+  unsigned long pages_scanned; // pages hashed
+  unsigned long merged;        // mappings moved onto a shared page
+  unsigned long pages_shared;  // merged pages still in use
+  unsigned long pages_sharing; // mappings of them past the first: pages saved
+  unsigned long scan_time_us;  // time spent hashing and merging
+};
+
+extern unsigned long ksm_sleep_us;
+extern unsigned long ksm_pages_to_scan;
+extern unsigned long ksm_max_sharing;
+
+void ksm_init(void);
+void ksmd(void);
+unsigned long ksm_scan(unsigned long pages);
+void ksm_get_stats(struct ksm_stats *stats);
+void ksm_print_stats(void);
+
+#endif
+
+#endif /* _KSM_H */
@@ -0,0 +1,32 @@
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * LZ4 block format compression.
+ *
+ * Output is a standard LZ4 block: sequences of literals and back references
+ * of at least LZ4_MIN_MATCH bytes within the last 64 KiB. The compressor is
+ * the single-pass greedy one, with a hash table of recent positions kept in
+ * a caller-supplied workspace so that callers decide how it is shared.
+ */
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_LOG 12
+#define LZ4_MAX_INPUT 0xffff // positions must fit the hash table entries
+#define LZ4_WORKSPACE_SIZE ((1 << LZ4_HASH_LOG) * sizeof(unsigned short))
+
+// Compress n bytes of src into at most cap bytes of dst. Returns the
+// compressed size, or 0 when it would not fit in cap or n is too large.
+int lz4_compress(const unsigned char *src, int n, unsigned char *dst, int cap,
+                 void *workspace);
+
+// Decompress the n-byte block at src into at most cap bytes of dst. Returns
+// the decompressed size, or -1 if the block is malformed or does not fit.
+int lz4_decompress(const unsigned char *src, int n, unsigned char *dst,
+                   int cap);
+
+#endif
+
+#endif /* _LZ4_H */
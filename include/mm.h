@@ -21,29 +21,124 @@
 
 #define PTRS_PER_TABLE (1 << TABLE_SHIFT)
 
-#define PGD_SHIFT PAGE_SHIFT + 3 * TABLE_SHIFT
-#define PUD_SHIFT PAGE_SHIFT + 2 * TABLE_SHIFT
-#define PMD_SHIFT PAGE_SHIFT + TABLE_SHIFT
+// Buddy allocator orders 0..MAX_ORDER-1, largest block 4 MiB
+#define MAX_ORDER 11
+
+#define PGD_SHIFT (PAGE_SHIFT + 3 * TABLE_SHIFT)
+#define PUD_SHIFT (PAGE_SHIFT + 2 * TABLE_SHIFT)
+#define PMD_SHIFT (PAGE_SHIFT + TABLE_SHIFT)
 
 #define PG_DIR_SIZE (3 * PAGE_SIZE)
 
+// A level-2 block maps one SECTION_SIZE (2 MiB) run of this allocation order
+#define HUGE_PAGE_ORDER (SECTION_SHIFT - PAGE_SHIFT)
+#define HUGE_PAGE_PAGES (1UL << HUGE_PAGE_ORDER)
+
+// CONT_PTES adjacent PTEs mapping one naturally aligned, physically
+// contiguous run can carry the contiguous hint and share a TLB entry
+#define CONT_PTE_ORDER 4
+#define CONT_PTES (1UL << CONT_PTE_ORDER)
+#define CONT_PTE_SIZE (CONT_PTES << PAGE_SHIFT)
+
+// Emptied page tables an address space keeps for reuse before freeing them
+#define TABLE_CACHE_PAGES 4
+
+// Pages mapped by one anonymous fault: the naturally aligned window holding
+// the faulting page, clipped to its VMA. A power of two up to PTRS_PER_TABLE.
+#define FAULT_AROUND_PAGES 16
+
 #ifndef __ASSEMBLER__
 
 #include "sched.h"
 
+// struct page flags
+#define PG_KERNEL 0x1    // kernel image, task stacks, slabs and the like
+#define PG_USER 0x2      // mapped by at least one user page table entry
+#define PG_PAGETABLE 0x4 // a translation table
+#define PG_ZERO 0x8      // the shared zero page
+#define PG_PINNED 0x10   // never freed; references and mappings not counted
+#define PG_KSM 0x20      // merged by the same-page scanner, see ksm.h
+#define PG_YOUNG 0x40    // accessed since last aged, see test_and_clear_young
+
+#define PAGE_NONE 0xffffffffU // end of a page list
+
+// Metadata for one physical page frame, 16 bytes, in the mem_map array
+// indexed by PFN. The list links are PFNs so the entry stays small; free
+// blocks are kept on the buddy lists through them.
+struct page {
+  unsigned int next;
+  unsigned int prev;
+  unsigned short refcount; // the last put_page frees the block
+  unsigned short mapcount; // user page table entries mapping the page
+  unsigned short flags;
+  unsigned char order; // buddy state of a block head, see mm.c
+};
+
+extern struct page *mem_map;
+
+void mem_init(void);
+struct page *phys_to_page(unsigned long p);
+unsigned long alloc_pages(int order);
+void free_pages(unsigned long addr, int order);
+int page_alloc_order(unsigned long addr);
+unsigned long free_area_count(int order);
+int free_block_order(unsigned long p);
+unsigned long alloc_page_at(unsigned long p);
+unsigned long nr_free_pages(void);
 unsigned long get_free_page();
+unsigned long get_free_page_nozero();
 void free_page(unsigned long p);
-void map_page(struct task_struct *task, unsigned long va, unsigned long page);
+void get_page(unsigned long p);
+void put_page(unsigned long p);
+int page_count(unsigned long p);
+int page_mapcount(unsigned long p);
+int memcmp_pages(unsigned long a, unsigned long b);
+void split_page(unsigned long p, int order);
+void zero_pool_refill(void);
+void zero_pool_drain(void);
+int zero_pool_pages(void);
+int map_range(struct task_struct *task, unsigned long va, unsigned long pa,
+              unsigned long npages, unsigned long prot);
+int unmap_range(struct task_struct *task, unsigned long va,
+                unsigned long npages);
+int map_page(struct task_struct *task, unsigned long va, unsigned long page);
+int map_page_prot(struct task_struct *task, unsigned long va,
+                  unsigned long page, unsigned long flags);
 void memzero(unsigned long src, unsigned long n);
 void memcpy(unsigned long dst, unsigned long src, unsigned long n);
 
 int copy_virt_memory(struct task_struct *dst);
 unsigned long allocate_kernel_page();
 unsigned long allocate_user_page(struct task_struct *task, unsigned long va);
-void map_guard_page(struct task_struct *task, unsigned long va);
+int map_guard_page(struct task_struct *task, unsigned long va);
+int map_block(struct task_struct *task, unsigned long va, unsigned long block,
+              unsigned long flags);
+unsigned long *pte_lookup(struct task_struct *task, unsigned long va);
+unsigned long *pmd_lookup(struct task_struct *task, unsigned long va);
+int collapse_huge_pmd(struct task_struct *task, unsigned long va);
+int swap_out_page(struct task_struct *task, unsigned long va);
+int merge_page(struct task_struct *task, unsigned long va,
+               unsigned long kpage);
+int migrate_page(struct task_struct *task, unsigned long va,
+                 unsigned long new_page);
+int test_and_clear_young(struct task_struct *task, unsigned long va,
+                         unsigned long *size);
+int handle_access_fault(struct task_struct *task, unsigned long addr);
+int do_mem_abort(unsigned long addr, unsigned long esr);
+int handle_mm_fault(struct task_struct *task, unsigned long addr, int write);
+int set_fault_around_pages(unsigned long pages);
+unsigned long get_fault_around_pages(void);
+void fault_print_stats(void);
+void exit_mm(struct task_struct *task);
+int copy_to_user(unsigned long dst, const void *src, unsigned long n);
+int copy_from_user(void *dst, unsigned long src, unsigned long n);
+long strncpy_from_user(char *dst, unsigned long src, long n);
 
 extern unsigned long pg_dir;
 
+extern unsigned char empty_zero_page[PAGE_SIZE];
+#define ZERO_PAGE ((unsigned long)empty_zero_page - VA_START)
+
 #endif
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef _MM_WALK_H
+#define _MM_WALK_H
+
+#ifndef __ASSEMBLER__
+
+#include "sched.h"
+
+/*
+ * A resumable walk over the anonymous memory of every address space, in
+ * pid and address order, for the background scanners: khugepaged, ksmd,
+ * reclaim and wssd. Each keeps one struct mm_walk as its cursor and only
+ * supplies what to do at each position it is given.
+ *
+ * Each call to walk_mms visits up to budget positions, step apart,
+ * skipping 2 MiB ranges with nothing mapped, and returns 1, with the walk
+ * back at the start, once it has wrapped around every address space.
+ */
+
+struct mm_walk {
+  long pid;           // where the walk stopped: the address space of the
+  unsigned long addr; // task with this pid, at this address
+  unsigned long step; // PAGE_SIZE, or SECTION_SIZE for whole 2 MiB ranges
+  unsigned long budget;
+  // Visit addr in task, returning the address to go on from. Setting
+  // budget to 0 ends the call early.
+  unsigned long (*entry)(struct mm_walk *walk, struct task_struct *task,
+                         unsigned long addr);
+  // If set, called once every VMA of task has been visited
+  void (*mm_done)(struct mm_walk *walk, struct task_struct *task);
+};
+
+int walk_mms(struct mm_walk *walk);
+
+#endif
+
+#endif /* _MM_WALK_H */
@@ -0,0 +1,49 @@
+#ifndef _MMAP_H
+#define _MMAP_H
+
+/*
+ * Anonymous memory mappings.
+ *
+ * mmap only records a VMA; pages are zero-filled on first touch by the
+ * fault handler. munmap drops the VMAs in the range, splitting any that
+ * straddle its ends, and hands the resident pages back to the allocator.
+ * MAP_HUGETLB mappings are placed on a 2 MiB boundary and faulted in as
+ * level-2 blocks wherever a whole block fits.
+ *
+ * PROT_EXEC is refused. Only data aborts from EL0 reach the fault handler,
+ * so nothing could fault an executable page in, and no I-cache maintenance
+ * is done on the pages it fills.
+ */
+
+// prot, same bits as VM_READ/VM_WRITE/VM_EXEC
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+// flags
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_HUGETLB 0x40000 // back with 2 MiB blocks where possible
+
+#define MAP_FAILED ((unsigned long)-1)
+
+// Mappings without MAP_FIXED are placed first-fit from MMAP_BASE, below the
+// stack
+#define MMAP_BASE 0x0000100000000000
+#define MMAP_END (USER_STACK_TOP - USER_STACK_SIZE)
+
+#ifndef __ASSEMBLER__
+
+#include "fork.h"
+#include "sched.h"
+
+unsigned long do_mmap(struct task_struct *task, unsigned long addr,
+                      unsigned long len, unsigned long prot,
+                      unsigned long flags);
+int do_munmap(struct task_struct *task, unsigned long addr, unsigned long len);
+
+#endif
+
+#endif /* _MMAP_H */
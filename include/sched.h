@@ -15,6 +15,7 @@
 
 #define TASK_RUNNING 0
 #define TASK_ZOMBIE 1
+#define TASK_WAITING 2 // blocked in do_wait until a child exits
 
 #define PF_KTHREAD 0x00000002
 
@@ -44,19 +45,21 @@ struct cpu_context {
   unsigned long pc;
 };
 
-#define MAX_PROCESS_PAGES 16
-
-struct user_page {
-  unsigned long phys_addr;
-  unsigned long virt_addr;
-};
+struct avl_node;
 
 struct mm_struct {
   unsigned long pgd;
-  int user_pages_count;
-  struct user_page user_pages[MAX_PROCESS_PAGES];
-  int kernel_pages_count;
-  unsigned long kernel_pages[MAX_PROCESS_PAGES];
+  struct avl_node *mmap; // VMA tree, see vma.h
+  int map_count;         // number of VMAs
+  unsigned long rss;     // resident user pages
+  unsigned long nr_ptes; // page table pages, including the PGD
+  unsigned long context_id; // ASID and its generation, see asid.h
+  unsigned long min_flt;    // user faults resolved, see handle_mm_fault
+  unsigned long table_cache;      // emptied page tables kept for reuse
+  unsigned long nr_cached_tables; // not counted in nr_ptes
+  unsigned long nr_swap;          // pages swapped out, see swap.h
+  unsigned long wss;       // pages referenced over the last aging pass, wss.h
+  unsigned long wss_young; // pages found referenced so far this pass
 };
 
 struct task_struct {
@@ -69,7 +72,12 @@ struct task_struct {
   long pid;
   unsigned long flags;
   struct mm_struct mm;
+  // Address space live in TTBR0 while this task runs: &mm for user tasks,
+  // borrowed from the previous task for kernel threads
+  struct mm_struct *active_mm;
   struct task_struct *next_task;
+  struct task_struct *parent;
+  long exit_code;
 };
 
 extern void sched_init(void);
@@ -78,8 +86,15 @@ extern void timer_tick(void);
 extern void preempt_disable(void);
 extern void preempt_enable(void);
 extern void switch_to(struct task_struct *next);
+extern void switch_active_mm(struct task_struct *prev,
+                             struct task_struct *next);
 extern void cpu_switch_to(struct task_struct *prev, struct task_struct *next);
+extern struct task_struct *next_mm_task(long pid);
+extern void kthread_poll(const unsigned long *period_us, void (*fn)(void));
 extern void exit_process(void);
+extern void do_exit(long code);
+extern long do_wait(long *exit_code);
+extern void reap_zombies(void);
 
 #define INIT_TASK                                                              \
   {/* cpu_context: x19..pc (13 regs) */                                        \
@@ -91,10 +106,14 @@ extern void exit_process(void);
    /* priority */ 15,                                                          \
    /* preempt_count */ 0,                                                      \
    /* pid */ 0,                                                                \
-   /* flags */ PF_KTHREAD, /* mm: pgd, user_pages_count, user_pages[],         \
-                              kernel_pages_count, kernel_pages[] */            \
-   {0, 0, {{0}}, 0, {0}},                                                      \
-   /* next_task */ 0}
+   /* flags */ PF_KTHREAD,                                                     \
+   /* mm: pgd, mmap, map_count, rss, nr_ptes, context_id, min_flt,            \
+      table_cache, nr_cached_tables, nr_swap, wss, wss_young */                \
+   {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},                                       \
+   /* active_mm */ 0,                                                          \
+   /* next_task */ 0,                                                          \
+   /* parent */ 0,                                                             \
+   /* exit_code */ 0}
 
 #endif
 #endif
@@ -0,0 +1,68 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Slab caches for fixed-size kernel objects.
+ *
+ * Each slab is one page with a struct slab header at its start followed by
+ * the objects, so an object address never falls on a page boundary. kfree
+ * relies on this to tell slab objects from whole-page allocations.
+ *
+ * A cache constructor runs once per object when its slab is created, so
+ * objects must be handed back to kmem_cache_free in constructed state.
+ */
+
+// kmalloc size classes are powers of two from 16 to 1024 bytes; bigger
+// requests are served by the page allocator directly.
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+#define KMALLOC_MAX_SIZE (1 << KMALLOC_MAX_SHIFT)
+#define KMALLOC_CACHES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+struct slab;
+
+struct kmem_cache_stats {
+  unsigned long objects_in_use;
+  unsigned long objects_total; // capacity of all slabs
+  unsigned long slabs;
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long hits; // allocations served without growing the cache
+};
+
+struct kmem_cache {
+  const char *name;
+  unsigned long object_size;
+  unsigned long objects_per_slab;
+  unsigned long first_object; // offset of the first object in a slab page
+  unsigned long free_offset;  // where a free object stores its list link
+  void (*ctor)(void *obj);
+  struct slab *partial;
+  struct slab *full;
+  struct slab *empty; // at most one spare slab is kept
+  struct kmem_cache_stats stats;
+  struct kmem_cache *next;
+};
+
+void kmem_cache_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align,
+                                     void (*ctor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *cache);
+int kmem_cache_grow(struct kmem_cache *cache, unsigned long page);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+void kmem_cache_get_stats(struct kmem_cache *cache,
+                          struct kmem_cache_stats *stats);
+void kmem_cache_print_stats(void);
+
+void *kmalloc(unsigned long size);
+void *kzalloc(unsigned long size);
+void kfree(void *obj);
+struct kmem_cache *kmalloc_cache(unsigned long size);
+
+#endif
+
+#endif /* _SLAB_H */
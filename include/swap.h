@@ -0,0 +1,62 @@
+#ifndef _SWAP_H
+#define _SWAP_H
+
+#ifndef __ASSEMBLER__
+
+#include "arm/mmu.h"
+#include "mm.h"
+
+/*
+ * Compressed in-memory swap.
+ *
+ * When the page allocator runs dry, try_to_free_pages walks the anonymous
+ * VMAs of every address space from where it last stopped and swaps out the
+ * private pages it finds (see swap_out_page): each one is LZ4-compressed
+ * into the swap store, its PTE becomes a swap entry naming the store slot,
+ * and the page is freed. The next fault on the entry decompresses it into a
+ * fresh page. fork shares swap entries by counting references to the slot.
+ *
+ * The store keeps compressed pages in slab caches of SWAP_CLASS_SIZE steps.
+ * A page filled with one repeated word is kept as just that word, and a page
+ * LZ4 cannot get down to SWAP_MAX_COMPRESSED bytes stays where it is.
+ */
+
+#define SWAP_SLOTS 65536
+#define SWAP_CLASS_SIZE 256
+#define SWAP_MAX_COMPRESSED 3072 // bigger saves too little to be worth it
+#define SWAP_CLASSES (SWAP_MAX_COMPRESSED / SWAP_CLASS_SIZE)
+#define SWAP_CLUSTER 32     // pages reclaim aims to free per call
+#define SWAP_SCAN_PAGES 4096 // entries reclaim looks at per call at most
+
+// A swap entry is an invalid PTE with PTE_SWAP set and the store slot in
+// the output address field. Slot 0 is never used.
+#define swp_entry(slot) (((unsigned long)(slot) << PAGE_SHIFT) | PTE_SWAP)
+#define swp_slot(entry) (((entry) & PTE_ADDR_MASK) >> PAGE_SHIFT)
+#define is_swap_pte(entry) (((entry) & (PTE_VALID | PTE_SWAP)) == PTE_SWAP)
+
+struct swap_stats {
+  unsigned long stored;          // pages in the store
+  unsigned long same_filled;     // of those, kept as one repeated word
+  unsigned long compr_bytes;     // compressed size of the rest
+  unsigned long pool_bytes;      // slab space holding it
+  unsigned long swap_outs;       // pages compressed and freed
+  unsigned long swap_ins;        // pages faulted back in
+  unsigned long swap_in_time_us; // time spent decompressing them
+  unsigned long incompressible;  // pages left in place
+  unsigned long reclaim_scanned; // entries looked at by reclaim
+  unsigned long reclaim_time_us; // time spent in reclaim
+};
+
+void swap_init(void);
+int swap_compress(unsigned long page);
+unsigned long swap_commit(unsigned long page);
+int swap_load(unsigned long slot, unsigned long page);
+void swap_dup(unsigned long slot);
+void swap_free(unsigned long slot);
+unsigned long try_to_free_pages(unsigned long nr);
+void swap_get_stats(struct swap_stats *stats);
+void swap_print_stats(void);
+
+#endif
+
+#endif /* _SWAP_H */
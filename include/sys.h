@@ -1,15 +1,19 @@
 #ifndef _SYS_H
 #define _SYS_H
 
-#define __NR_syscalls 5
+#define __NR_syscalls 8
 
 #ifndef __ASSEMBLER__
 
 void sys_write(char *buf);
 int sys_fork(void);
-void sys_exit(void);
+void sys_exit(long code);
 long sys_getpid(void);
 void sys_priority(long priority);
+long sys_wait(long *status);
+unsigned long sys_mmap(unsigned long addr, unsigned long len,
+                       unsigned long prot, unsigned long flags);
+int sys_munmap(unsigned long addr, unsigned long len);
 
 #endif
 #endif
@@ -95,7 +95,7 @@ struct test_case {
 };
 
 /* Maximum number of tests that can be registered */
-#define MAX_TESTS 128
+#define MAX_TESTS 256
 
 /* Test suite structure for grouping tests */
 struct test_suite {
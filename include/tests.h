@@ -24,5 +24,17 @@ void register_irq_tests(void);
 void register_fork_tests(void);
 void register_printf_tests(void);
 void register_utils_tests(void);
+void register_cache_tests(void);
+void register_slab_tests(void);
+void register_vma_tests(void);
+void register_asid_tests(void);
+void register_tlbflush_tests(void);
+void register_mmap_tests(void);
+void register_khugepaged_tests(void);
+void register_vmalloc_tests(void);
+void register_swap_tests(void);
+void register_ksm_tests(void);
+void register_wss_tests(void);
+void register_compaction_tests(void);
 
 #endif /* _TESTS_H */
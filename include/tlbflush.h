@@ -0,0 +1,52 @@
+#ifndef _TLBFLUSH_H
+#define _TLBFLUSH_H
+
+#ifndef __ASSEMBLER__
+
+#include "sched.h"
+
+/*
+ * TLB invalidation for user address spaces.
+ *
+ * Every flush names the mm and goes by its ASID (see asid.h), so other
+ * address spaces keep their entries, and an mm with no ASID in the current
+ * generation has nothing to flush at all. Pages and ranges use last-level
+ * TLBIs. flush_tlb_pgtable is for a PTE table being unlinked: it drops
+ * the cached walks and every translation the table held. A range longer
+ * than TLB_FLUSH_MAX_PAGES drops the whole ASID.
+ *
+ * flush_tlb_kernel_range is the one exception: it drops global kernel
+ * translations, such as vmalloc's, from every ASID.
+ *
+ * A tlb_gather batches the invalidations of a multi-page update into one
+ * range, issued with a single dsb ish; isb. Pages handed to it are only
+ * put once their translations are gone.
+ */
+
+#define TLB_FLUSH_MAX_PAGES 64
+#define TLB_GATHER_PAGES 16
+
+struct tlb_gather {
+  struct mm_struct *mm;
+  unsigned long start; // pending range, empty when start == end
+  unsigned long end;
+  int freed_tables; // cached walks must go as well
+  int nr_pages;
+  unsigned long pages[TLB_GATHER_PAGES]; // put after the flush
+};
+
+void flush_tlb_page_mm(struct mm_struct *mm, unsigned long va);
+void flush_tlb_range(struct mm_struct *mm, unsigned long start,
+                     unsigned long end);
+void flush_tlb_pgtable(struct mm_struct *mm, unsigned long va);
+void flush_tlb_kernel_range(unsigned long start, unsigned long end);
+
+void tlb_gather_init(struct tlb_gather *tlb, struct mm_struct *mm);
+void tlb_gather_page(struct tlb_gather *tlb, unsigned long va,
+                     unsigned long page);
+void tlb_gather_table(struct tlb_gather *tlb, unsigned long va);
+void tlb_gather_flush(struct tlb_gather *tlb);
+
+#endif
+
+#endif /* _TLBFLUSH_H */
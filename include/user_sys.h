@@ -6,14 +6,21 @@
 #define SYS_EXIT_NUMBER 2
 #define SYS_GETPID_NUMBER 3
 #define SYS_PRIORITY_NUMBER 4
+#define SYS_WAIT_NUMBER 5
+#define SYS_MMAP_NUMBER 6
+#define SYS_MUNMAP_NUMBER 7
 
 #ifndef __ASSEMBLER__
 
 void call_sys_write(char *buf);
 int call_sys_fork();
-void call_sys_exit();
+void call_sys_exit(long code);
 long call_sys_getpid();
 void call_sys_priority(long priority);
+long call_sys_wait(long *status);
+unsigned long call_sys_mmap(unsigned long addr, unsigned long len,
+                            unsigned long prot, unsigned long flags);
+int call_sys_munmap(unsigned long addr, unsigned long len);
 
 extern void user_delay(unsigned long);
 extern unsigned long get_sp(void);
@@ -2,6 +2,8 @@
 #define _UTILS_H
 
 #define CONST_DIV_CEIL(a, b) ((a + b - 1) / b)
+#define container_of(ptr, type, member)                                        \
+  ((type *)((unsigned long)(ptr) - __builtin_offsetof(type, member)))
 
 extern void delay(unsigned long);
 extern void put32(unsigned long, unsigned int);
@@ -9,6 +11,25 @@ extern unsigned int get32(unsigned long);
 extern int get_el(void);
 extern void set_pgd(unsigned long pgd);
 extern unsigned long get_pgd(void);
+extern void flush_tlb_all(void);
+extern void flush_tlb_page(unsigned long va);
+extern void flush_tlb_asid(unsigned long asid);
+extern void tlbi_vale1is(unsigned long arg);
+extern void tlbi_vae1is(unsigned long arg);
+extern void tlbi_vaale1is(unsigned long arg);
+extern void tlbi_sync(void);
+extern void cpu_set_ttbr0(unsigned long ttbr0);
+extern unsigned long get_id_aa64mmfr0(void);
+extern void enable_asid16(void);
 extern void wfe();
+extern void pmu_enable_cycle_counter(void);
+extern unsigned long get_cycles(void);
+extern void pmu_enable_event_counter(unsigned long counter,
+                                     unsigned long event);
+extern unsigned long pmu_read_event_counter(unsigned long counter);
+
+// PMU common event numbers
+#define PMU_EVENT_L1I_TLB_REFILL 0x02
+#define PMU_EVENT_L1D_TLB_REFILL 0x05
 
 #endif
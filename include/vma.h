@@ -0,0 +1,50 @@
+#ifndef _VMA_H
+#define _VMA_H
+
+#ifndef __ASSEMBLER__
+
+#include "avl.h"
+#include "sched.h"
+
+/*
+ * Virtual memory areas.
+ *
+ * A user address space is a set of disjoint, page-aligned VMAs kept in an
+ * AVL tree ordered by start address. VMAs only say what may be mapped; the
+ * page tables record what is resident, and pages are filled in on first
+ * touch by the fault handler.
+ */
+
+#define VM_READ 0x1
+#define VM_WRITE 0x2
+#define VM_EXEC 0x4
+#define VM_ANON 0x8       // backed by zero-filled anonymous memory
+#define VM_HUGEPAGE 0x10  // faulted in as 2 MiB blocks where they fit
+
+struct vm_area_struct {
+  unsigned long vm_start;
+  unsigned long vm_end; // exclusive
+  unsigned long vm_flags;
+  struct avl_node vm_node;
+};
+
+void vma_init(void);
+struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long addr);
+struct vm_area_struct *find_vma_intersection(struct mm_struct *mm,
+                                             unsigned long start,
+                                             unsigned long end);
+struct vm_area_struct *vma_first(struct mm_struct *mm);
+struct vm_area_struct *vma_next(struct mm_struct *mm,
+                                struct vm_area_struct *vma);
+int insert_vma(struct mm_struct *mm, unsigned long start, unsigned long end,
+               unsigned long flags);
+void remove_vma(struct mm_struct *mm, struct vm_area_struct *vma);
+int split_vma(struct mm_struct *mm, struct vm_area_struct *vma,
+              unsigned long addr);
+int copy_vmas(struct mm_struct *dst, struct mm_struct *src);
+void exit_vmas(struct mm_struct *mm);
+unsigned long vma_pte_flags(struct vm_area_struct *vma);
+
+#endif
+
+#endif /* _VMA_H */
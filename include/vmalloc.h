@@ -0,0 +1,36 @@
+#ifndef _VMALLOC_H
+#define _VMALLOC_H
+
+#include "peripherals/base.h"
+
+/*
+ * Virtually contiguous kernel buffers.
+ *
+ * The linear map covers the first GiB of TTBR1 space, so vmalloc takes the
+ * GiB after it. Each allocation is backed by individually allocated pages
+ * mapped with global 4 KiB kernel PTEs and is followed by an unmapped guard
+ * page, so an overrun faults instead of running into the next buffer. The
+ * page tables under the region are allocated on demand and kept.
+ */
+
+#define VMALLOC_START (VA_START + 0x40000000UL)
+#define VMALLOC_END (VMALLOC_START + 0x40000000UL)
+
+#ifndef __ASSEMBLER__
+
+struct vm_struct {
+  unsigned long addr;
+  unsigned long size; // mapped bytes, not counting the guard page
+  struct vm_struct *next; // areas in address order
+};
+
+void vmalloc_init(void);
+void *vmalloc(unsigned long size);
+void *vzalloc(unsigned long size);
+void vfree(void *addr);
+unsigned long vmalloc_to_phys(void *addr);
+int is_vmalloc_addr(unsigned long addr);
+
+#endif
+
+#endif /* _VMALLOC_H */
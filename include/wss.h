@@ -0,0 +1,43 @@
+#ifndef _WSS_H
+#define _WSS_H
+
+#ifndef __ASSEMBLER__
+
+/*
+ * Working set estimation.
+ *
+ * While wss_enabled is set, the wssd kernel thread wakes every wss_sleep_us
+ * and ages up to wss_pages_to_scan pages of anonymous memory, walking every
+ * address space from where it last stopped. A page accessed since the hand
+ * last passed counts towards its address space's working set, and has its
+ * access flag cleared again (see test_and_clear_young). At the end of each
+ * address space, mm->wss becomes the number of pages it touched between two
+ * passes, which last_pass_us says how long took.
+ *
+ * Reclaim reads the same bits for its clock (see swap.h), so under memory
+ * pressure the two hands share what they see and the estimate runs low.
+ */
+
+#define WSS_SLEEP_US 100000
+#define WSS_PAGES_TO_SCAN 1024
+
+struct wss_stats {
+  unsigned long full_scans;    // passes over every address space
+  unsigned long pages_scanned; // pages aged
+  unsigned long young;         // of those, accessed since the last pass
+  unsigned long last_pass_us;  // how long the last full pass took
+  unsigned long scan_time_us;  // time spent aging
+};
+
+extern unsigned long wss_enabled;
+extern unsigned long wss_sleep_us;
+extern unsigned long wss_pages_to_scan;
+
+void wssd(void);
+unsigned long wss_scan(unsigned long pages);
+void wss_get_stats(struct wss_stats *stats);
+void wss_print_stats(void);
+
+#endif
+
+#endif /* _WSS_H */
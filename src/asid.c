@@ -0,0 +1,118 @@
+#include "asid.h"
+#include "mm.h"
+#include "utils.h"
+
+#define MAX_ASID_BITS 16
+#define ASID_MAP_WORDS ((1UL << MAX_ASID_BITS) / 64)
+
+static unsigned long nr_asid_bits;
+static unsigned long asid_generation;
+static unsigned long asid_next;
+static unsigned long asid_map[ASID_MAP_WORDS];
+static unsigned long nr_rollovers;
+// The address space live in TTBR0, which keeps its ASID across a rollover
+static struct mm_struct *active_mm;
+// Empty table for TTBR0 when no user address space is live, so stray
+// accesses fault instead of walking whatever sits at physical address 0
+static unsigned long reserved_pgd[PAGE_SIZE / sizeof(unsigned long)]
+    __attribute__((aligned(PAGE_SIZE)));
+
+#define NUM_ASIDS (1UL << nr_asid_bits)
+#define ASID_MASK (NUM_ASIDS - 1)
+
+static int context_is_current(unsigned long context_id) {
+  return ((context_id ^ asid_generation) >> nr_asid_bits) == 0;
+}
+
+static void asid_set(unsigned long asid) {
+  asid_map[asid / 64] |= 1UL << (asid % 64);
+}
+
+void asid_init(void) {
+  // ID_AA64MMFR0_EL1.ASIDBits is 0b0010 when 16-bit ASIDs are supported
+  if (((get_id_aa64mmfr0() >> 4) & 0xf) == 2) {
+    nr_asid_bits = 16;
+    enable_asid16();
+  } else {
+    nr_asid_bits = 8;
+  }
+  asid_generation = NUM_ASIDS;
+  asid_next = 1;
+  asid_set(0);
+  // Drop the boot identity map: its entries are global and would shadow
+  // user mappings in every ASID
+  switch_mm(0);
+  flush_tlb_all();
+}
+
+unsigned long asid_bits(void) { return nr_asid_bits; }
+
+unsigned long asid_rollovers(void) { return nr_rollovers; }
+
+static unsigned long asid_find_free(unsigned long from) {
+  for (unsigned long asid = from; asid < NUM_ASIDS; asid++) {
+    unsigned long word = asid_map[asid / 64];
+    if (word == ~0UL) {
+      asid |= 63; // skip the rest of a full word
+      continue;
+    }
+    if (!(word & (1UL << (asid % 64)))) {
+      return asid;
+    }
+  }
+  return 0;
+}
+
+static void asid_rollover(void) {
+  asid_generation += NUM_ASIDS;
+  memzero((unsigned long)asid_map, sizeof(asid_map));
+  asid_set(0);
+  if (active_mm) {
+    unsigned long asid = active_mm->context_id & ASID_MASK;
+    asid_set(asid);
+    active_mm->context_id = asid_generation | asid;
+  }
+  nr_rollovers++;
+  // Every other ASID may now be handed to a different address space
+  flush_tlb_all();
+}
+
+unsigned long asid_get(struct mm_struct *mm) {
+  preempt_disable();
+  if (!context_is_current(mm->context_id)) {
+    unsigned long asid = asid_find_free(asid_next);
+    if (asid == 0) {
+      asid_rollover();
+      asid = asid_find_free(1);
+    }
+    asid_set(asid);
+    asid_next = asid + 1;
+    mm->context_id = asid_generation | asid;
+  }
+  preempt_enable();
+  return mm->context_id & ASID_MASK;
+}
+
+void switch_mm(struct mm_struct *mm) {
+  preempt_disable();
+  if (!mm || !mm->pgd) {
+    active_mm = 0;
+    cpu_set_ttbr0((unsigned long)reserved_pgd - VA_START);
+  } else {
+    unsigned long asid = asid_get(mm);
+    active_mm = mm;
+    cpu_set_ttbr0(mm->pgd | (asid << 48));
+  }
+  preempt_enable();
+}
+
+unsigned long asid_of(struct mm_struct *mm) {
+  return context_is_current(mm->context_id) ? mm->context_id & ASID_MASK : 0;
+}
+
+void flush_tlb_mm(struct mm_struct *mm) {
+  // A context from an old generation has nothing left in the TLB
+  if (context_is_current(mm->context_id)) {
+    flush_tlb_asid(mm->context_id & ASID_MASK);
+  }
+}
@@ -0,0 +1,135 @@
+#include "avl.h"
+
+static int avl_height(struct avl_node *node) {
+  return node ? node->height : 0;
+}
+
+static void avl_update(struct avl_node *node) {
+  int left = avl_height(node->left);
+  int right = avl_height(node->right);
+  node->height = 1 + (left > right ? left : right);
+}
+
+static struct avl_node *avl_rotate_right(struct avl_node *node) {
+  struct avl_node *pivot = node->left;
+  node->left = pivot->right;
+  pivot->right = node;
+  avl_update(node);
+  avl_update(pivot);
+  return pivot;
+}
+
+static struct avl_node *avl_rotate_left(struct avl_node *node) {
+  struct avl_node *pivot = node->right;
+  node->right = pivot->left;
+  pivot->left = node;
+  avl_update(node);
+  avl_update(pivot);
+  return pivot;
+}
+
+// Restore the height invariant at node after one of its subtrees changed
+static struct avl_node *avl_rebalance(struct avl_node *node) {
+  avl_update(node);
+  int balance = avl_height(node->left) - avl_height(node->right);
+  if (balance > 1) {
+    if (avl_height(node->left->left) < avl_height(node->left->right)) {
+      node->left = avl_rotate_left(node->left);
+    }
+    return avl_rotate_right(node);
+  }
+  if (balance < -1) {
+    if (avl_height(node->right->right) < avl_height(node->right->left)) {
+      node->right = avl_rotate_right(node->right);
+    }
+    return avl_rotate_left(node);
+  }
+  return node;
+}
+
+static struct avl_node *avl_insert_at(struct avl_node *root,
+                                      struct avl_node *node, avl_cmp_fn cmp) {
+  if (!root) {
+    node->left = 0;
+    node->right = 0;
+    node->height = 1;
+    return node;
+  }
+  if (cmp(node, root) < 0) {
+    root->left = avl_insert_at(root->left, node, cmp);
+  } else {
+    root->right = avl_insert_at(root->right, node, cmp);
+  }
+  return avl_rebalance(root);
+}
+
+static struct avl_node *avl_remove_min(struct avl_node *root,
+                                       struct avl_node **min) {
+  if (!root->left) {
+    *min = root;
+    return root->right;
+  }
+  root->left = avl_remove_min(root->left, min);
+  return avl_rebalance(root);
+}
+
+static struct avl_node *avl_erase_at(struct avl_node *root,
+                                     struct avl_node *node, avl_cmp_fn cmp) {
+  if (!root) {
+    return 0;
+  }
+  if (root == node) {
+    if (!node->right) {
+      return node->left;
+    }
+    // Replace the node with its in-order successor
+    struct avl_node *min;
+    struct avl_node *right = avl_remove_min(node->right, &min);
+    min->left = node->left;
+    min->right = right;
+    return avl_rebalance(min);
+  }
+  if (cmp(node, root) < 0) {
+    root->left = avl_erase_at(root->left, node, cmp);
+  } else {
+    root->right = avl_erase_at(root->right, node, cmp);
+  }
+  return avl_rebalance(root);
+}
+
+void avl_insert(struct avl_node **root, struct avl_node *node,
+                avl_cmp_fn cmp) {
+  *root = avl_insert_at(*root, node, cmp);
+}
+
+void avl_erase(struct avl_node **root, struct avl_node *node, avl_cmp_fn cmp) {
+  *root = avl_erase_at(*root, node, cmp);
+}
+
+struct avl_node *avl_first(struct avl_node *root) {
+  if (!root) {
+    return 0;
+  }
+  while (root->left) {
+    root = root->left;
+  }
+  return root;
+}
+
+struct avl_node *avl_next(struct avl_node *root, struct avl_node *node,
+                          avl_cmp_fn cmp) {
+  if (node->right) {
+    return avl_first(node->right);
+  }
+  // No right subtree: the successor is the last ancestor we went left at
+  struct avl_node *successor = 0;
+  while (root && root != node) {
+    if (cmp(node, root) < 0) {
+      successor = root;
+      root = root->left;
+    } else {
+      root = root->right;
+    }
+  }
+  return successor;
+}
@@ -0,0 +1,257 @@
+#include "compaction.h"
+#include "arm/mmu.h"
+#include "mm.h"
+#include "printf.h"
+#include "sched.h"
+#include "timer.h"
+#include "vma.h"
+
+static struct compact_stats stats;
+
+// Failed allocations to let by without compacting, per order
+static unsigned int defer_shift[MAX_ORDER];
+static unsigned int considered[MAX_ORDER];
+
+// The blocks being emptied, and the size of each
+static unsigned long targets[COMPACT_BATCH];
+static long target_cost[COMPACT_BATCH];
+static int nr_targets;
+static unsigned long target_size;
+
+// Where the search for destination pages goes on from, downwards
+static unsigned long free_cursor;
+
+int fragmentation_index(int order) {
+  if (order < 0 || order >= MAX_ORDER) {
+    return 0;
+  }
+  unsigned long blocks = 0;
+  unsigned long free_pages = 0;
+  for (int o = 0; o < MAX_ORDER; o++) {
+    unsigned long n = free_area_count(o);
+    if (n && o >= order) {
+      return -1000;
+    }
+    blocks += n;
+    free_pages += n << o;
+  }
+  if (blocks == 0) {
+    return 0;
+  }
+  return 1000 - (1000 + free_pages * 1000 / (1UL << order)) / blocks;
+}
+
+// A page migrate_page can move: a private, counted user page
+static int page_movable(unsigned long p) {
+  struct page *page = phys_to_page(p);
+  return page_alloc_order(p) == 0 && (page->flags & PG_USER) &&
+         !(page->flags & (PG_KERNEL | PG_PAGETABLE | PG_PINNED | PG_KSM)) &&
+         page->refcount == 1 && page->mapcount == 1;
+}
+
+// Pages to move for the aligned block of 2^order pages at p to be free, or
+// -1 if one of them cannot be moved
+static long block_cost(unsigned long p, int order) {
+  long used = 0;
+  unsigned long i = 0;
+  while (i < (1UL << order)) {
+    unsigned long q = p + i * PAGE_SIZE;
+    int free = free_block_order(q);
+    if (free >= 0) {
+      // Free blocks are aligned to their size, so q heads this one
+      i += 1UL << free;
+      continue;
+    }
+    if (!page_movable(q)) {
+      return -1;
+    }
+    used++;
+    i++;
+  }
+  return used;
+}
+
+static int in_target(unsigned long p) {
+  for (int i = 0; i < nr_targets; i++) {
+    if (p >= targets[i] && p < targets[i] + target_size) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Keep the COMPACT_BATCH cheapest blocks that are not free already
+static void choose_targets(int order) {
+  nr_targets = 0;
+  target_size = PAGE_SIZE << order;
+  for (unsigned long p = LOW_MEMORY; p + target_size <= HIGH_MEMORY;
+       p += target_size) {
+    long cost = block_cost(p, order);
+    if (cost <= 0) {
+      continue;
+    }
+    int i = nr_targets;
+    if (i == COMPACT_BATCH) {
+      if (cost >= target_cost[COMPACT_BATCH - 1]) {
+        continue;
+      }
+      i--;
+    } else {
+      nr_targets++;
+    }
+    for (; i > 0 && target_cost[i - 1] > cost; i--) {
+      targets[i] = targets[i - 1];
+      target_cost[i] = target_cost[i - 1];
+    }
+    targets[i] = p;
+    target_cost[i] = cost;
+  }
+}
+
+// The next free page down from free_cursor worth moving a page into: in
+// none of the targets, and in a free block too small to be of use itself
+static unsigned long take_destination(int order) {
+  while (free_cursor > LOW_MEMORY) {
+    free_cursor -= PAGE_SIZE;
+    int free = free_block_order(free_cursor);
+    if (free >= 0 && free < order && !in_target(free_cursor)) {
+      return alloc_page_at(free_cursor);
+    }
+  }
+  return 0;
+}
+
+// Move every page of the targets that a task on the task list maps
+static void migrate_targets(int order) {
+  for (struct task_struct *task = next_mm_task(0); task;
+       task = next_mm_task(task->pid + 1)) {
+    struct mm_struct *mm = &task->mm;
+    for (struct vm_area_struct *vma = vma_first(mm); vma;
+         vma = vma_next(mm, vma)) {
+      unsigned long addr = vma->vm_start;
+      while (addr < vma->vm_end) {
+        // Skip 2 MiB ranges with no PTE table, and blocks
+        unsigned long *pmd = pmd_lookup(task, addr);
+        if (pmd == 0 || (*pmd & MM_TYPE_MASK) != MM_TYPE_PAGE_TABLE) {
+          addr = (addr + SECTION_SIZE) & ~((unsigned long)SECTION_SIZE - 1);
+          continue;
+        }
+        unsigned long *pte = pte_lookup(task, addr);
+        if ((*pte & PTE_VALID) && in_target(*pte & PTE_ADDR_MASK)) {
+          unsigned long dst = take_destination(order);
+          if (dst == 0) {
+            return;
+          }
+          if (migrate_page(task, addr, dst)) {
+            stats.migrated++;
+          } else {
+            free_page(dst);
+            stats.migrate_failed++;
+          }
+        }
+        addr += PAGE_SIZE;
+      }
+    }
+  }
+}
+
+// Empty up to COMPACT_BATCH blocks of the order. Returns the number freed.
+static unsigned long compact_batch(int order) {
+  choose_targets(order);
+  if (nr_targets == 0) {
+    return 0;
+  }
+  free_cursor = HIGH_MEMORY;
+  migrate_targets(order);
+  unsigned long freed = 0;
+  for (int i = 0; i < nr_targets; i++) {
+    if (free_block_order(targets[i]) >= order) {
+      freed++;
+    }
+  }
+  nr_targets = 0;
+  stats.blocks_freed += freed;
+  return freed;
+}
+
+// Compact for blocks of the order, in batches while full_run is set and
+// each batch makes progress. Returns the number of blocks freed.
+static unsigned long compact(int order, int full_run) {
+  unsigned long start = time_since_boot();
+  unsigned long freed = 0;
+  preempt_disable();
+  stats.last_order = order;
+  stats.last_index_before = fragmentation_index(order);
+  while (1) {
+    unsigned long batch = compact_batch(order);
+    freed += batch;
+    if (batch == 0 || !full_run) {
+      break;
+    }
+  }
+  stats.last_index_after = fragmentation_index(order);
+  if (freed) {
+    stats.success++;
+    defer_shift[order] = 0;
+    considered[order] = 0;
+  } else {
+    stats.fail++;
+  }
+  preempt_enable();
+  stats.time_us += time_since_boot() - start;
+  return freed;
+}
+
+// Compact all memory for blocks of the order. Returns the number formed.
+unsigned long compact_memory(int order) {
+  if (order <= 0 || order >= MAX_ORDER) {
+    return 0;
+  }
+  // Pooled pages cannot be moved
+  zero_pool_drain();
+  return compact(order, 1);
+}
+
+// Compact for a failed allocation of the order, unless recent attempts
+// failed. Returns 1 if a block of the order was formed.
+int try_to_compact_pages(int order) {
+  if (order <= 0 || order >= MAX_ORDER) {
+    return 0;
+  }
+  if (defer_shift[order] &&
+      ++considered[order] < (1U << defer_shift[order])) {
+    stats.deferred++;
+    return 0;
+  }
+  stats.stalls++;
+  if (compact(order, 0)) {
+    return 1;
+  }
+  considered[order] = 0;
+  if (defer_shift[order] < COMPACT_MAX_DEFER_SHIFT) {
+    defer_shift[order]++;
+  }
+  return 0;
+}
+
+void compact_get_stats(struct compact_stats *out) {
+  preempt_disable();
+  *out = stats;
+  preempt_enable();
+}
+
+void compact_print_stats(void) {
+  struct compact_stats s;
+  compact_get_stats(&s);
+  printf("compaction: stalls %lu deferred %lu success %lu fail %lu "
+         "migrated %lu failed %lu blocks %lu time %lu us\r\n",
+         s.stalls, s.deferred, s.success, s.fail, s.migrated,
+         s.migrate_failed, s.blocks_freed, s.time_us);
+  printf("compaction: order %d fragmentation index %d -> %d\r\n",
+         s.last_order, s.last_index_before, s.last_index_after);
+  printf("compaction: fragmentation index by order:");
+  for (int order = 1; order < MAX_ORDER; order++) {
+    printf(" %d", fragmentation_index(order));
+  }
+  printf("\r\n");
+}
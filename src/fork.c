@@ -1,8 +1,11 @@
 #include "fork.h"
+#include "arm/mmu.h"
+#include "asid.h"
 #include "entry.h"
 #include "mm.h"
 #include "sched.h"
 #include "utils.h"
+#include "vma.h"
 #include <limits.h>
 
 #define ULONG_BITS (sizeof(unsigned long) * 8)
@@ -66,7 +69,13 @@ int copy_process(unsigned long clone_flags, unsigned long fn, unsigned long arg,
     struct pt_regs *cur_regs = task_pt_regs(current);
     *childregs = *cur_regs;
     childregs->regs[0] = 0;
-    copy_virt_memory(p);
+    if (copy_virt_memory(p) < 0) {
+      exit_mm(p);
+      free_page(page - VA_START);
+      free_pid(pid);
+      preempt_enable();
+      return -1;
+    }
   }
   p->flags = clone_flags;
   p->priority = pri;
@@ -74,6 +83,8 @@ int copy_process(unsigned long clone_flags, unsigned long fn, unsigned long arg,
   p->counter = p->priority;
   p->preempt_count = 1; // disable preemtion until schedule_tail
   p->pid = pid;
+  p->parent = current;
+  p->exit_code = 0;
 
   p->cpu_context.pc = (unsigned long)ret_from_fork;
   p->cpu_context.sp = (unsigned long)childregs;
@@ -91,36 +102,97 @@ int copy_process(unsigned long clone_flags, unsigned long fn, unsigned long arg,
   return pid;
 }
 
-int move_to_user_mode(unsigned long start, unsigned long size,
-                      unsigned long pc) {
+// Copy the size byte initialised data at start into one physically
+// contiguous run of private pages and map them at va with a single map_range
+static int map_user_data(struct task_struct *task, unsigned long va,
+                         unsigned long start, unsigned long size) {
+  unsigned long pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  int order = 0;
+  while ((1UL << order) < pages) {
+    order++;
+  }
+  unsigned long image = alloc_pages(order);
+  if (image == 0) {
+    return -1;
+  }
+  split_page(image, order);
+  for (unsigned long i = pages; i < (1UL << order); i++) {
+    put_page(image + i * PAGE_SIZE);
+  }
+  memcpy(image + VA_START, start, size);
+  memzero(image + VA_START + size, pages * PAGE_SIZE - size);
+
+  if (map_range(task, va, image, pages, MMU_PTE_FLAGS | PTE_UXN) < 0) {
+    // Pages the failed walk did not reach were never handed to the mm
+    for (unsigned long i = 0; i < pages; i++) {
+      unsigned long page = image + i * PAGE_SIZE;
+      unsigned long *pte = pte_lookup(task, va + i * PAGE_SIZE);
+      if (pte == 0 || (*pte & PTE_ADDR_MASK) != page) {
+        put_page(page);
+      }
+    }
+    return -1;
+  }
+  return 0;
+}
+
+int map_user_image(struct task_struct *task, unsigned long start,
+                   unsigned long text_size, unsigned long size) {
+  // The text and read-only data are mapped straight out of the kernel image,
+  // so every process shares the same physical pages and I-cache lines. They
+  // sit below LOW_MEMORY, where page references are not counted, so fork
+  // and exit leave them alone.
+  unsigned long text_end = USER_CODE_START + text_size;
+  if (insert_vma(&task->mm, USER_CODE_START, text_end, VM_READ | VM_EXEC) < 0) {
+    return -1;
+  }
+  if (map_range(task, USER_CODE_START, start - VA_START,
+                text_size >> PAGE_SHIFT, MMU_PTE_FLAGS | MM_AP_RDONLY) < 0) {
+    return -1;
+  }
+
+  // .data and .bss get private pages; the tail of the last one is zeroed
+  unsigned long data_size = size - text_size;
+  if (data_size == 0) {
+    return 0;
+  }
+  unsigned long data_end = text_end + ((data_size + PAGE_SIZE - 1) & PAGE_MASK);
+  if (insert_vma(&task->mm, text_end, data_end,
+                 VM_READ | VM_WRITE | VM_ANON) < 0) {
+    return -1;
+  }
+  return map_user_data(task, text_end, start + text_size, data_size);
+}
+
+int move_to_user_mode(unsigned long start, unsigned long text_size,
+                      unsigned long size, unsigned long pc) {
 
   struct pt_regs *regs = task_pt_regs(current);
   regs->pstate = PSR_MODE_EL0t;
-  regs->pc = PAGE_SIZE + pc; // Code starts at PAGE_SIZE (0x1000)
-  regs->sp = 3 * PAGE_SIZE;  // Stack above code
+  regs->pc = USER_CODE_START + pc;
+  regs->sp = USER_STACK_TOP;
 
   // Map page 0 as a guard page (no user access permissions)
-  map_guard_page(current, 0);
-
-  // Map user code at PAGE_SIZE instead of 0
-  unsigned long code_page = allocate_user_page(current, PAGE_SIZE);
-  if (code_page == 0) {
+  if (map_guard_page(current, 0) < 0) {
     return -1;
   }
-  memcpy(code_page, start, size);
 
-  // Pre-allocate stack pages (2 and 3) so syscalls don't cause faults
-  unsigned long stack_page_2 = allocate_user_page(current, 2 * PAGE_SIZE);
-  if (stack_page_2 == 0) {
+  // User code at USER_CODE_START instead of 0
+  if (map_user_image(current, start, text_size, size) < 0) {
     return -1;
   }
 
-  unsigned long stack_page_3 = allocate_user_page(current, 3 * PAGE_SIZE);
-  if (stack_page_3 == 0) {
+  if (insert_vma(&current->mm, USER_STACK_TOP - USER_STACK_SIZE,
+                 USER_STACK_TOP, VM_READ | VM_WRITE | VM_ANON) < 0) {
+    return -1;
+  }
+  // Pre-fault the top of the stack; the rest comes in on demand
+  if (allocate_user_page(current, USER_STACK_TOP - PAGE_SIZE) == 0) {
     return -1;
   }
 
-  set_pgd(current->mm.pgd);
+  current->active_mm = &current->mm;
+  switch_mm(&current->mm);
   return 0;
 }
 
@@ -1,14 +1,23 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "asid.h"
 #include "fork.h"
 #include "irq.h"
+#include "khugepaged.h"
+#include "ksm.h"
+#include "mm.h"
 #include "printf.h"
 #include "sched.h"
+#include "slab.h"
+#include "swap.h"
 #include "timer.h"
 #include "uart.h"
 #include "user.h"
 #include "utils.h"
+#include "vma.h"
+#include "vmalloc.h"
+#include "wss.h"
 
 /* Test mode support */
 #ifdef TEST_MODE
@@ -19,15 +28,24 @@
 void kernel_process() {
   printf("Kernel process started. EL %d\r\n", get_el());
   unsigned long begin = (unsigned long)&user_begin;
+  unsigned long data = (unsigned long)&user_data_begin;
   unsigned long end = (unsigned long)&user_end;
   unsigned long process = (unsigned long)&user_process;
-  int err = move_to_user_mode(begin, end - begin, process - begin);
+  int err =
+      move_to_user_mode(begin, data - begin, end - begin, process - begin);
   if (err < 0) {
     printf("Error while moving process to user mode\n\r");
   }
 }
 
 void kernel_main() {
+  mem_init();
+  kmem_cache_init();
+  vma_init();
+  vmalloc_init();
+  swap_init();
+  ksm_init();
+  asid_init();
   uart_init();
   init_printf(NULL, uart_putc);
   irq_vector_init();
@@ -53,8 +71,19 @@ void kernel_main() {
     printf("error while starting kernel process");
     return;
   }
+  if (copy_process(PF_KTHREAD, (unsigned long)&khugepaged, 0, 1) < 0) {
+    printf("error while starting khugepaged\r\n");
+  }
+  if (copy_process(PF_KTHREAD, (unsigned long)&ksmd, 0, 1) < 0) {
+    printf("error while starting ksmd\r\n");
+  }
+  if (copy_process(PF_KTHREAD, (unsigned long)&wssd, 0, 1) < 0) {
+    printf("error while starting wssd\r\n");
+  }
 
   while (1) {
+    reap_zombies();
+    zero_pool_refill();
     wfe();
     schedule();
   }
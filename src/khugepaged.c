@@ -0,0 +1,60 @@
+#include "khugepaged.h"
+#include "mm.h"
+#include "mm_walk.h"
+#include "printf.h"
+#include "sched.h"
+#include "timer.h"
+
+unsigned long khugepaged_sleep_us = KHUGEPAGED_SLEEP_US;
+unsigned long khugepaged_pmds_to_scan = KHUGEPAGED_PMDS_TO_SCAN;
+
+static struct khugepaged_stats stats;
+
+static unsigned long scan_pmd(struct mm_walk *walk __attribute__((unused)),
+                              struct task_struct *task, unsigned long addr) {
+  stats.pmds_scanned++;
+  int ret = collapse_huge_pmd(task, addr);
+  if (ret > 0) {
+    stats.collapsed++;
+  } else if (ret < 0) {
+    stats.alloc_failed++;
+  }
+  return addr + SECTION_SIZE;
+}
+
+// Where the last scan stopped, going a 2 MiB range at a time
+static struct mm_walk cursor = {.step = SECTION_SIZE, .entry = scan_pmd};
+
+// Look at up to pmds 2 MiB ranges, resuming where the last call stopped.
+// Returns the number of ranges collapsed.
+unsigned long khugepaged_scan(unsigned long pmds) {
+  unsigned long start = time_since_boot();
+  unsigned long collapsed = stats.collapsed;
+  preempt_disable();
+  cursor.budget = pmds;
+  if (walk_mms(&cursor)) {
+    stats.full_scans++;
+  }
+  preempt_enable();
+  stats.scan_time_us += time_since_boot() - start;
+  return stats.collapsed - collapsed;
+}
+
+static void khugepaged_tick(void) { khugepaged_scan(khugepaged_pmds_to_scan); }
+
+void khugepaged(void) { kthread_poll(&khugepaged_sleep_us, khugepaged_tick); }
+
+void khugepaged_get_stats(struct khugepaged_stats *out) {
+  preempt_disable();
+  *out = stats;
+  preempt_enable();
+}
+
+void khugepaged_print_stats(void) {
+  struct khugepaged_stats s;
+  khugepaged_get_stats(&s);
+  printf("khugepaged: full_scans %lu scanned %lu collapsed %lu "
+         "alloc_failed %lu time %lu us\r\n",
+         s.full_scans, s.pmds_scanned, s.collapsed, s.alloc_failed,
+         s.scan_time_us);
+}
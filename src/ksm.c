@@ -0,0 +1,249 @@
+#include "ksm.h"
+#include "arm/mmu.h"
+#include "avl.h"
+#include "mm.h"
+#include "mm_walk.h"
+#include "printf.h"
+#include "sched.h"
+#include "slab.h"
+#include "timer.h"
+#include "utils.h"
+
+unsigned long ksm_sleep_us = KSM_SLEEP_US;
+unsigned long ksm_pages_to_scan = KSM_PAGES_TO_SCAN;
+unsigned long ksm_max_sharing = KSM_MAX_SHARING;
+
+static struct ksm_stats stats;
+
+// A page in one of the trees. Stable nodes hold a reference to a merged
+// page; unstable ones name a page mapped at va in the task with pid.
+struct ksm_node {
+  struct avl_node node;
+  struct ksm_node *next; // every node of the same tree
+  unsigned long page;
+  unsigned int hash;
+  long pid;
+  unsigned long va;
+};
+
+#define node_to_ksm(n) container_of(n, struct ksm_node, node)
+
+static struct kmem_cache *ksm_cache;
+
+static struct avl_node *stable_root;
+static struct ksm_node *stable_list;
+static struct avl_node *unstable_root;
+static struct ksm_node *unstable_list;
+
+// Pages with equal hashes are told apart by where their node lives, which
+// never changes, unlike the contents of an unstable page
+static int ksm_cmp(const struct avl_node *a, const struct avl_node *b) {
+  unsigned int hash_a = node_to_ksm(a)->hash;
+  unsigned int hash_b = node_to_ksm(b)->hash;
+  if (hash_a != hash_b) {
+    return hash_a < hash_b ? -1 : 1;
+  }
+  return a < b ? -1 : a > b;
+}
+
+void ksm_init(void) {
+  ksm_cache = kmem_cache_create("ksm_node", sizeof(struct ksm_node), 0, 0);
+}
+
+// FNV-1a over the words of the page
+static unsigned int page_hash(unsigned long page) {
+  const unsigned long *words = (const unsigned long *)(page + VA_START);
+  unsigned long hash = 0xcbf29ce484222325UL;
+  for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+    hash = (hash ^ words[i]) * 0x100000001b3UL;
+  }
+  return (unsigned int)(hash ^ (hash >> 32));
+}
+
+// A node below root whose page has the contents of page and room for
+// another mapping. Nodes with the same hash can sit on either side of the
+// first one found.
+static struct ksm_node *tree_search(struct avl_node *root, unsigned int hash,
+                                    unsigned long page) {
+  while (root) {
+    struct ksm_node *n = node_to_ksm(root);
+    if (hash < n->hash) {
+      root = root->left;
+    } else if (hash > n->hash) {
+      root = root->right;
+    } else if ((unsigned long)page_mapcount(n->page) < ksm_max_sharing &&
+               memcmp_pages(n->page, page) == 0) {
+      return n;
+    } else {
+      struct ksm_node *found = tree_search(root->left, hash, page);
+      return found ? found : tree_search(root->right, hash, page);
+    }
+  }
+  return 0;
+}
+
+static struct task_struct *find_task(long pid) {
+  for (struct task_struct *p = initial_task; p; p = p->next_task) {
+    if (p->pid == pid && p->mm.pgd && p->state != TASK_ZOMBIE) {
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Merge the page the unstable node n names, and the page at va in task,
+// into a new stable page. Returns 1 when merged.
+static int merge_unstable(struct ksm_node *n, struct task_struct *task,
+                          unsigned long va) {
+  // The unstable page may have been freed and reused since it was seen
+  struct task_struct *owner = find_task(n->pid);
+  unsigned long *pte = owner ? pte_lookup(owner, n->va) : 0;
+  if (pte == 0 || !(*pte & PTE_VALID) || (*pte & PTE_ADDR_MASK) != n->page) {
+    return 0;
+  }
+  if (merge_page(owner, n->va, n->page) <= 0 ||
+      merge_page(task, va, n->page) <= 0) {
+    return 0;
+  }
+  avl_erase(&unstable_root, &n->node, ksm_cmp);
+  struct ksm_node **link = &unstable_list;
+  while (*link != n) {
+    link = &(*link)->next;
+  }
+  *link = n->next;
+
+  get_page(n->page);
+  phys_to_page(n->page)->flags |= PG_KSM;
+  n->next = stable_list;
+  stable_list = n;
+  avl_insert(&stable_root, &n->node, ksm_cmp);
+  return 1;
+}
+
+static void scan_page(struct task_struct *task, unsigned long va) {
+  unsigned long *pte = pte_lookup(task, va);
+  if (pte == 0 || !(*pte & PTE_VALID)) {
+    return;
+  }
+  unsigned long page = *pte & PTE_ADDR_MASK;
+  struct page *meta = phys_to_page(page);
+  // The zero page and pages merged already
+  if (page_count(page) == 0 || (meta->flags & PG_KSM)) {
+    return;
+  }
+  stats.pages_scanned++;
+  unsigned int hash = page_hash(page);
+
+  struct ksm_node *n = tree_search(stable_root, hash, page);
+  if (n) {
+    if (merge_page(task, va, n->page) > 0) {
+      stats.merged++;
+    }
+    return;
+  }
+  n = tree_search(unstable_root, hash, page);
+  if (n) {
+    if (merge_unstable(n, task, va)) {
+      stats.merged++;
+    }
+    return;
+  }
+  n = kmem_cache_alloc(ksm_cache);
+  if (n == 0) {
+    return;
+  }
+  n->page = page;
+  n->hash = hash;
+  n->pid = task->pid;
+  n->va = va;
+  n->next = unstable_list;
+  unstable_list = n;
+  avl_insert(&unstable_root, &n->node, ksm_cmp);
+}
+
+static unsigned long scan_entry(struct mm_walk *walk __attribute__((unused)),
+                                struct task_struct *task, unsigned long addr) {
+  // Blocks are left whole
+  unsigned long *pmd = pmd_lookup(task, addr);
+  if ((*pmd & MM_TYPE_MASK) != MM_TYPE_PAGE_TABLE) {
+    return (addr + SECTION_SIZE) & ~((unsigned long)SECTION_SIZE - 1);
+  }
+  scan_page(task, addr);
+  return addr + PAGE_SIZE;
+}
+
+// Where the last scan stopped
+static struct mm_walk cursor = {.step = PAGE_SIZE, .entry = scan_entry};
+
+// End of a pass: forget the unstable tree, and give back merged pages
+// nobody maps any more
+static void end_pass(void) {
+  while (unstable_list) {
+    struct ksm_node *n = unstable_list;
+    unstable_list = n->next;
+    kmem_cache_free(ksm_cache, n);
+  }
+  unstable_root = 0;
+
+  struct ksm_node **link = &stable_list;
+  while (*link) {
+    struct ksm_node *n = *link;
+    if (page_mapcount(n->page) > 0) {
+      link = &n->next;
+      continue;
+    }
+    *link = n->next;
+    avl_erase(&stable_root, &n->node, ksm_cmp);
+    phys_to_page(n->page)->flags &= ~PG_KSM;
+    put_page(n->page);
+    kmem_cache_free(ksm_cache, n);
+  }
+  stats.full_scans++;
+}
+
+// Hash up to pages pages, resuming where the last call stopped. Returns the
+// number of mappings merged.
+unsigned long ksm_scan(unsigned long pages) {
+  if (ksm_cache == 0) {
+    return 0;
+  }
+  unsigned long start = time_since_boot();
+  unsigned long merged = stats.merged;
+  preempt_disable();
+  cursor.budget = pages;
+  if (walk_mms(&cursor)) {
+    end_pass();
+  }
+  preempt_enable();
+  stats.scan_time_us += time_since_boot() - start;
+  return stats.merged - merged;
+}
+
+static void ksm_tick(void) { ksm_scan(ksm_pages_to_scan); }
+
+void ksmd(void) { kthread_poll(&ksm_sleep_us, ksm_tick); }
+
+void ksm_get_stats(struct ksm_stats *out) {
+  preempt_disable();
+  *out = stats;
+  // Counted afresh, as copy-on-write and unmapping undo merges
+  out->pages_shared = 0;
+  out->pages_sharing = 0;
+  for (struct ksm_node *n = stable_list; n; n = n->next) {
+    int mapcount = page_mapcount(n->page);
+    if (mapcount > 0) {
+      out->pages_shared++;
+      out->pages_sharing += mapcount - 1;
+    }
+  }
+  preempt_enable();
+}
+
+void ksm_print_stats(void) {
+  struct ksm_stats s;
+  ksm_get_stats(&s);
+  printf("ksm: full_scans %lu scanned %lu merged %lu shared %lu saved %lu "
+         "time %lu us\r\n",
+         s.full_scans, s.pages_scanned, s.merged, s.pages_shared,
+         s.pages_sharing, s.scan_time_us);
+}
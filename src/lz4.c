@@ -0,0 +1,184 @@
+#include "lz4.h"
+#include "mm.h"
+
+// The last LZ4_LAST_LITERALS bytes of a block are always literals, and the
+// last match starts at least LZ4_MFLIMIT bytes before the end
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_RUN_MASK 15 // a 4-bit token length of 15 continues in extra bytes
+
+static unsigned int read32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int lz4_hash(unsigned int sequence) {
+  return (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+// Worst-case encoded size of a sequence with lit literals and a match of
+// mlen bytes beyond LZ4_MIN_MATCH: token, both length runs, literals, offset
+static unsigned long sequence_bound(unsigned long lit, unsigned long mlen) {
+  return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+// Emit the part of a length past the token's 15 as a run of 255s and a
+// final byte below 255
+static unsigned char *put_length(unsigned char *op, unsigned long len) {
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+static unsigned char *put_literals(unsigned char *op, const unsigned char *lit,
+                                   unsigned long len, unsigned char *token) {
+  if (len >= LZ4_RUN_MASK) {
+    *token = LZ4_RUN_MASK << 4;
+    op = put_length(op, len - LZ4_RUN_MASK);
+  } else {
+    *token = (unsigned char)(len << 4);
+  }
+  memcpy((unsigned long)op, (unsigned long)lit, len);
+  return op + len;
+}
+
+int lz4_compress(const unsigned char *src, int n, unsigned char *dst, int cap,
+                 void *workspace) {
+  if (n < 0 || n > LZ4_MAX_INPUT || cap <= 0) {
+    return 0;
+  }
+  unsigned short *table = workspace;
+  // Stale entries would only cost a failed compare, but must stay in range
+  memzero((unsigned long)table, LZ4_WORKSPACE_SIZE);
+
+  const unsigned char *ip = src;
+  const unsigned char *anchor = src;
+  const unsigned char *iend = src + n;
+  const unsigned char *matchlimit = iend - LZ4_LAST_LITERALS;
+  unsigned char *op = dst;
+  unsigned char *oend = dst + cap;
+
+  if (n > LZ4_MFLIMIT) {
+    const unsigned char *mflimit = iend - LZ4_MFLIMIT;
+    while (ip < mflimit) {
+      unsigned int sequence = read32(ip);
+      unsigned int h = lz4_hash(sequence);
+      const unsigned char *ref = src + table[h];
+      table[h] = (unsigned short)(ip - src);
+      if (ref >= ip || read32(ref) != sequence) {
+        ip++;
+        continue;
+      }
+      // Grow the match backwards into pending literals, then forwards
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      const unsigned char *mp = ip + LZ4_MIN_MATCH;
+      const unsigned char *rp = ref + LZ4_MIN_MATCH;
+      while (mp < matchlimit && *mp == *rp) {
+        mp++;
+        rp++;
+      }
+
+      unsigned long lit = ip - anchor;
+      unsigned long mlen = mp - ip - LZ4_MIN_MATCH;
+      if (sequence_bound(lit, mlen) > (unsigned long)(oend - op)) {
+        return 0;
+      }
+      unsigned char *token = op++;
+      op = put_literals(op, anchor, lit, token);
+      unsigned long offset = ip - ref;
+      *op++ = (unsigned char)offset;
+      *op++ = (unsigned char)(offset >> 8);
+      if (mlen >= LZ4_RUN_MASK) {
+        *token |= LZ4_RUN_MASK;
+        op = put_length(op, mlen - LZ4_RUN_MASK);
+      } else {
+        *token |= (unsigned char)mlen;
+      }
+
+      ip = mp;
+      anchor = ip;
+      // Remember a position inside the match too, for the next one
+      table[lz4_hash(read32(ip - 2))] = (unsigned short)(ip - 2 - src);
+    }
+  }
+
+  unsigned long lit = iend - anchor;
+  if (1 + lit / 255 + 1 + lit > (unsigned long)(oend - op)) {
+    return 0;
+  }
+  unsigned char *token = op++;
+  op = put_literals(op, anchor, lit, token);
+  return op - dst;
+}
+
+// Add the extra bytes of a length that saturated its token field. Returns
+// -1 if they run past the end of the block.
+static int get_length(const unsigned char **ip, const unsigned char *iend,
+                      unsigned long *len) {
+  unsigned char b;
+  do {
+    if (*ip >= iend) {
+      return -1;
+    }
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+int lz4_decompress(const unsigned char *src, int n, unsigned char *dst,
+                   int cap) {
+  const unsigned char *ip = src;
+  const unsigned char *iend = src + n;
+  unsigned char *op = dst;
+  unsigned char *oend = dst + cap;
+
+  while (ip < iend) {
+    unsigned int token = *ip++;
+    unsigned long len = token >> 4;
+    if (len == LZ4_RUN_MASK && get_length(&ip, iend, &len) < 0) {
+      return -1;
+    }
+    if (len > (unsigned long)(iend - ip) || len > (unsigned long)(oend - op)) {
+      return -1;
+    }
+    memcpy((unsigned long)op, (unsigned long)ip, len);
+    ip += len;
+    op += len;
+    if (ip == iend) {
+      break; // the last sequence has no match
+    }
+
+    if (iend - ip < 2) {
+      return -1;
+    }
+    unsigned long offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (unsigned long)(op - dst)) {
+      return -1;
+    }
+    len = token & LZ4_RUN_MASK;
+    if (len == LZ4_RUN_MASK && get_length(&ip, iend, &len) < 0) {
+      return -1;
+    }
+    len += LZ4_MIN_MATCH;
+    if (len > (unsigned long)(oend - op)) {
+      return -1;
+    }
+    const unsigned char *ref = op - offset;
+    if (offset >= len) {
+      memcpy((unsigned long)op, (unsigned long)ref, len);
+      op += len;
+    } else {
+      // Overlapping: the match repeats the last offset bytes
+      for (unsigned long i = 0; i < len; i++) {
+        *op++ = *ref++;
+      }
+    }
+  }
+  return op - dst;
+}
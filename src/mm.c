@@ -1,35 +1,329 @@
 #include "mm.h"
 #include "arm/mmu.h"
+#include "arm/sysregs.h"
+#include "asid.h"
+#include "cache.h"
+#include "compaction.h"
 #include "peripherals/base.h"
+#include "printf.h"
 #include "sched.h"
+#include "swap.h"
+#include "tlbflush.h"
 #include "utils.h"
-#include <stddef.h>
+#include "vma.h"
 
-#define ULONG_BITS (sizeof(unsigned long) * 8)
-#define MEM_MAP_BITMAP_LENGTH CONST_DIV_CEIL(PAGING_PAGES, ULONG_BITS)
+/*
+ * Page frame metadata and the binary buddy allocator over
+ * [LOW_MEMORY, HIGH_MEMORY).
+ *
+ * mem_map holds one struct page per frame of RAM, indexed by PFN. It takes
+ * the first MEM_MAP_PAGES pages above LOW_MEMORY; those and everything
+ * below LOW_MEMORY are pinned and never reach the allocator.
+ *
+ * Free blocks of 2^order pages sit on per-order lists linked through the
+ * struct page of their head, so allocating and freeing never touch the
+ * free memory itself. A page's order field is PAGE_ORDER_FREE | order for
+ * the head of a free block, PAGE_ORDER_ALLOCATED | order for the head of an
+ * allocated block, and 0 for every other page. LOW_MEMORY is aligned to the
+ * largest block, so buddies can be found from the PFN directly.
+ *
+ * Refcounts and flags are kept on the head page of an allocated block, and
+ * dropping the last reference frees the whole block.
+ */
 
-static unsigned long mem_map[MEM_MAP_BITMAP_LENGTH] = {
-    0,
+#define PAGE_ORDER_FREE 0x80
+#define PAGE_ORDER_ALLOCATED 0x40
+
+#define NR_PAGES (HIGH_MEMORY >> PAGE_SHIFT)
+#define MEM_MAP_PAGES                                                          \
+  ((NR_PAGES * sizeof(struct page) + PAGE_SIZE - 1) >> PAGE_SHIFT)
+#define PFN(addr) ((addr) >> PAGE_SHIFT)
+#define PFN_TO_PAGE(pfn) ((unsigned long)(pfn) << PAGE_SHIFT)
+
+struct free_area {
+  unsigned int head; // PFN of the first free block, or PAGE_NONE
+  unsigned long nr_free;
 };
 
-#define GET_MEM_BIT(bitmap, bit)                                               \
-  ((bitmap[bit / ULONG_BITS] >> (bit % ULONG_BITS)) & 0x1)
+struct page *mem_map;
+static struct free_area free_area[MAX_ORDER];
+
+struct page *phys_to_page(unsigned long p) {
+  if (p >= HIGH_MEMORY) {
+    return 0;
+  }
+  return &mem_map[PFN(p)];
+}
+
+static void free_area_add(unsigned long pfn, int order) {
+  struct page *page = &mem_map[pfn];
+  struct free_area *area = &free_area[order];
+  page->prev = PAGE_NONE;
+  page->next = area->head;
+  if (area->head != PAGE_NONE) {
+    mem_map[area->head].prev = pfn;
+  }
+  area->head = pfn;
+  area->nr_free++;
+  page->order = PAGE_ORDER_FREE | order;
+}
+
+static void free_area_del(unsigned long pfn, int order) {
+  struct page *page = &mem_map[pfn];
+  struct free_area *area = &free_area[order];
+  if (page->prev != PAGE_NONE) {
+    mem_map[page->prev].next = page->next;
+  } else {
+    area->head = page->next;
+  }
+  if (page->next != PAGE_NONE) {
+    mem_map[page->next].prev = page->prev;
+  }
+  area->nr_free--;
+  page->order = 0;
+}
+
+void mem_init(void) {
+  mem_map = (struct page *)(LOW_MEMORY + VA_START);
+  memzero((unsigned long)mem_map, NR_PAGES * sizeof(struct page));
+  unsigned long pfn = PFN(LOW_MEMORY) + MEM_MAP_PAGES;
+  for (unsigned long i = 0; i < pfn; i++) {
+    mem_map[i].flags = PG_KERNEL | PG_PINNED;
+  }
+  struct page *zero = phys_to_page(ZERO_PAGE);
+  if (zero) {
+    zero->flags |= PG_ZERO;
+  }
+
+  for (int order = 0; order < MAX_ORDER; order++) {
+    free_area[order].head = PAGE_NONE;
+    free_area[order].nr_free = 0;
+  }
+  while (pfn < NR_PAGES) {
+    int order = MAX_ORDER - 1;
+    while ((pfn & ((1UL << order) - 1)) || pfn + (1UL << order) > NR_PAGES) {
+      order--;
+    }
+    free_area_add(pfn, order);
+    pfn += 1UL << order;
+  }
+}
+
+static unsigned long __alloc_pages(int order) {
+  preempt_disable();
+  int current_order = order;
+  while (current_order < MAX_ORDER &&
+         free_area[current_order].head == PAGE_NONE) {
+    current_order++;
+  }
+  if (current_order == MAX_ORDER) {
+    preempt_enable();
+    return 0;
+  }
+  unsigned long pfn = free_area[current_order].head;
+  free_area_del(pfn, current_order);
+  // Split, returning the upper halves to the smaller free lists
+  while (current_order > order) {
+    current_order--;
+    free_area_add(pfn + (1UL << current_order), current_order);
+  }
+  mem_map[pfn].order = PAGE_ORDER_ALLOCATED | order;
+  mem_map[pfn].refcount = 1;
+  preempt_enable();
+  return PFN_TO_PAGE(pfn);
+}
+
+void free_pages(unsigned long addr, int order) {
+  if (addr < LOW_MEMORY || addr >= HIGH_MEMORY || order < 0 ||
+      order >= MAX_ORDER) {
+    return;
+  }
+  unsigned long pfn = PFN(addr);
+  preempt_disable();
+  struct page *page = &mem_map[pfn];
+  if (page->order != (PAGE_ORDER_ALLOCATED | order)) {
+    preempt_enable();
+    return; // not the head of an allocated block of this order
+  }
+  page->order = 0;
+  page->refcount = 0;
+  page->mapcount = 0;
+  page->flags = 0;
+  // Coalesce with the buddy for as long as it is a free block of our order
+  while (order < MAX_ORDER - 1) {
+    unsigned long buddy = pfn ^ (1UL << order);
+    if (buddy >= NR_PAGES ||
+        mem_map[buddy].order != (PAGE_ORDER_FREE | order)) {
+      break;
+    }
+    free_area_del(buddy, order);
+    pfn &= ~(1UL << order);
+    order++;
+  }
+  free_area_add(pfn, order);
+  preempt_enable();
+}
+
+int page_alloc_order(unsigned long addr) {
+  if (addr < LOW_MEMORY || addr >= HIGH_MEMORY) {
+    return -1;
+  }
+  unsigned char state = mem_map[PFN(addr)].order;
+  if (!(state & PAGE_ORDER_ALLOCATED)) {
+    return -1;
+  }
+  return state & ~PAGE_ORDER_ALLOCATED;
+}
+
+unsigned long free_area_count(int order) {
+  if (order < 0 || order >= MAX_ORDER) {
+    return 0;
+  }
+  return free_area[order].nr_free;
+}
+
+// The order of the free block holding the page p, or -1 if it is not free
+int free_block_order(unsigned long p) {
+  if (p < LOW_MEMORY || p >= HIGH_MEMORY) {
+    return -1;
+  }
+  unsigned long pfn = PFN(p);
+  for (int order = 0; order < MAX_ORDER; order++) {
+    unsigned long head = pfn & ~((1UL << order) - 1);
+    if (mem_map[head].order == (PAGE_ORDER_FREE | order)) {
+      return order;
+    }
+  }
+  return -1;
+}
+
+// Allocate the page p itself, if it is free, splitting the free block that
+// holds it and giving the rest back. Returns p, or 0.
+unsigned long alloc_page_at(unsigned long p) {
+  preempt_disable();
+  int order = free_block_order(p);
+  if (order < 0) {
+    preempt_enable();
+    return 0;
+  }
+  unsigned long pfn = PFN(p);
+  unsigned long head = pfn & ~((1UL << order) - 1);
+  free_area_del(head, order);
+  // Halve towards pfn, freeing the half it is not in each time
+  while (order > 0) {
+    order--;
+    unsigned long half = 1UL << order;
+    if (pfn & half) {
+      free_area_add(head, order);
+      head += half;
+    } else {
+      free_area_add(head + half, order);
+    }
+  }
+  mem_map[pfn].order = PAGE_ORDER_ALLOCATED;
+  mem_map[pfn].refcount = 1;
+  preempt_enable();
+  return p;
+}
+
+/*
+ * The page every read of untouched anonymous memory maps, read-only. It sits
+ * in the kernel BSS, below LOW_MEMORY, so its mappings carry no references
+ * and it is never freed.
+ */
+unsigned char empty_zero_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+/*
+ * Pool of pre-zeroed pages, refilled from the idle loop so allocations that
+ * need a clean page (faults, page tables) do not pay for memzero inline.
+ */
 
-#define SET_MEM_BIT(bitmap, bit, value)                                        \
-  do {                                                                         \
-    size_t _index = (bit) / ULONG_BITS;                                        \
-    size_t _pos = (bit) % ULONG_BITS;                                          \
-    if (value)                                                                 \
-      (bitmap)[_index] |= 1UL << _pos;                                         \
-    else                                                                       \
-      (bitmap)[_index] &= ~(1UL << _pos);                                      \
-  } while (0)
+#define ZERO_POOL_SIZE 64
+#define ZERO_POOL_BATCH 8
+
+static unsigned long zero_pool[ZERO_POOL_SIZE];
+static int zero_pool_count;
+
+static unsigned long zero_pool_take(void) {
+  unsigned long page = 0;
+  preempt_disable();
+  if (zero_pool_count > 0) {
+    page = zero_pool[--zero_pool_count];
+  }
+  preempt_enable();
+  return page;
+}
+
+void zero_pool_refill(void) {
+  for (int i = 0; i < ZERO_POOL_BATCH; i++) {
+    if (zero_pool_count >= ZERO_POOL_SIZE) {
+      return;
+    }
+    unsigned long page = __alloc_pages(0);
+    if (page == 0) {
+      return;
+    }
+    memzero(page + VA_START, PAGE_SIZE);
+    preempt_disable();
+    if (zero_pool_count < ZERO_POOL_SIZE) {
+      zero_pool[zero_pool_count++] = page;
+      page = 0;
+    }
+    preempt_enable();
+    if (page) {
+      free_pages(page, 0);
+    }
+  }
+}
+
+void zero_pool_drain(void) {
+  unsigned long page;
+  while ((page = zero_pool_take()) != 0) {
+    free_pages(page, 0);
+  }
+}
+
+int zero_pool_pages(void) { return zero_pool_count; }
+
+unsigned long alloc_pages(int order) {
+  if (order < 0 || order >= MAX_ORDER) {
+    return 0;
+  }
+  unsigned long page = __alloc_pages(order);
+  if (page == 0 && order == 0) {
+    // A pooled page is as free as any other, just zeroed already
+    page = zero_pool_take();
+  }
+  // Pooled pages may be all that stands between us and a merge: give them
+  // back one at a time, only until one completes the block
+  unsigned long pooled;
+  while (page == 0 && order > 0 && (pooled = zero_pool_take()) != 0) {
+    free_pages(pooled, 0);
+    page = __alloc_pages(order);
+  }
+  if (page == 0 && order == 0 && try_to_free_pages(SWAP_CLUSTER) > 0) {
+    page = __alloc_pages(order);
+  }
+  if (page == 0 && order > 0 && try_to_compact_pages(order) > 0) {
+    page = __alloc_pages(order);
+  }
+  return page;
+}
+
+unsigned long nr_free_pages(void) {
+  unsigned long pages = zero_pool_count;
+  for (int order = 0; order < MAX_ORDER; order++) {
+    pages += free_area[order].nr_free << order;
+  }
+  return pages;
+}
 
 unsigned long allocate_kernel_page() {
   unsigned long page = get_free_page();
   if (page == 0) {
     return 0;
   }
+  mem_map[PFN(page)].flags |= PG_KERNEL;
   return page + VA_START;
 }
 
@@ -38,34 +332,180 @@ unsigned long allocate_user_page(struct task_struct *task, unsigned long va) {
   if (page == 0) {
     return 0;
   }
-  map_page(task, va, page);
+  if (map_page(task, va, page) < 0) {
+    free_page(page);
+    return 0;
+  }
   return page + VA_START;
 }
 
 unsigned long get_free_page() {
-  for (unsigned long i = 0; i < PAGING_PAGES; i++) {
-    if (GET_MEM_BIT(mem_map, i) == 0) {
-      SET_MEM_BIT(mem_map, i, 1);
-      unsigned long page = LOW_MEMORY + i * PAGE_SIZE;
-      memzero(page + VA_START, PAGE_SIZE);
-      return page;
+  unsigned long page = zero_pool_take();
+  if (page) {
+    return page;
+  }
+  page = alloc_pages(0);
+  if (page == 0) {
+    return 0;
+  }
+  memzero(page + VA_START, PAGE_SIZE);
+  return page;
+}
+
+unsigned long get_free_page_nozero() { return alloc_pages(0); }
+
+void free_page(unsigned long p) { free_pages(p, 0); }
+
+// The struct page whose references and mappings are counted for p, or 0 for
+// pinned and out of range pages
+static struct page *counted_page(unsigned long p) {
+  struct page *page = phys_to_page(p);
+  if (page == 0 || (page->flags & PG_PINNED)) {
+    return 0;
+  }
+  return page;
+}
+
+void get_page(unsigned long p) {
+  struct page *page = counted_page(p);
+  if (page == 0) {
+    return;
+  }
+  preempt_disable();
+  page->refcount++;
+  preempt_enable();
+}
+
+void put_page(unsigned long p) {
+  struct page *page = counted_page(p);
+  if (page == 0) {
+    return;
+  }
+  preempt_disable();
+  if (page->refcount > 0 && --page->refcount == 0) {
+    free_pages(p, page->order & ~PAGE_ORDER_ALLOCATED);
+  }
+  preempt_enable();
+}
+
+int page_count(unsigned long p) {
+  struct page *page = counted_page(p);
+  return page ? page->refcount : 0;
+}
+
+int page_mapcount(unsigned long p) {
+  struct page *page = counted_page(p);
+  return page ? page->mapcount : 0;
+}
+
+// Order two pages by their contents, like memcmp on the words; 0 when they
+// are identical
+int memcmp_pages(unsigned long a, unsigned long b) {
+  const unsigned long *wa = (const unsigned long *)(a + VA_START);
+  const unsigned long *wb = (const unsigned long *)(b + VA_START);
+  for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+    if (wa[i] != wb[i]) {
+      return wa[i] < wb[i] ? -1 : 1;
     }
   }
   return 0;
 }
 
-void free_page(unsigned long p) {
-  SET_MEM_BIT(mem_map, (p - LOW_MEMORY) / PAGE_SIZE, 0);
+// A user page table entry now maps the page or block headed by p
+static void page_add_mapping(unsigned long p) {
+  struct page *page = counted_page(p);
+  if (page == 0) {
+    return;
+  }
+  preempt_disable();
+  page->mapcount++;
+  page->flags |= PG_USER;
+  preempt_enable();
+}
+
+// One fewer user page table entry maps p. The reference that mapping held
+// is dropped separately, once the TLB no longer holds it.
+static void page_remove_mapping(unsigned long p) {
+  struct page *page = counted_page(p);
+  if (page == 0) {
+    return;
+  }
+  preempt_disable();
+  if (page->mapcount > 0 && --page->mapcount == 0) {
+    page->flags &= ~PG_USER;
+  }
+  preempt_enable();
+}
+
+// Turn the allocated block of 2^order pages at p into single pages holding
+// one reference each, so they can be mapped and freed one at a time. Every
+// page takes the block's flags; mappings of the block stay with p.
+void split_page(unsigned long p, int order) {
+  if (page_alloc_order(p) != order) {
+    return;
+  }
+  struct page *page = &mem_map[PFN(p)];
+  preempt_disable();
+  for (unsigned long i = 0; i < (1UL << order); i++) {
+    page[i].order = PAGE_ORDER_ALLOCATED;
+    page[i].refcount = 1;
+    page[i].flags = page->flags;
+  }
+  preempt_enable();
+}
+
+// A zeroed page table page, from mm's cache of emptied tables if it has one
+static unsigned long table_alloc(struct mm_struct *mm) {
+  unsigned long table = mm->table_cache;
+  if (table == 0) {
+    table = get_free_page();
+    if (table) {
+      mem_map[PFN(table)].flags |= PG_PAGETABLE;
+    }
+    return table;
+  }
+  // The link is the only non-zero word of a cached table
+  unsigned long *link = (unsigned long *)(table + VA_START);
+  mm->table_cache = *link;
+  mm->nr_cached_tables--;
+  *link = 0;
+  return table;
+}
+
+// Give back an all-zero table page, keeping a few for the next table_alloc
+static void table_release(struct mm_struct *mm, unsigned long table) {
+  if (mm->nr_cached_tables >= TABLE_CACHE_PAGES) {
+    free_page(table);
+    return;
+  }
+  *(unsigned long *)(table + VA_START) = mm->table_cache;
+  mm->table_cache = table;
+  mm->nr_cached_tables++;
 }
 
-unsigned long map_table(unsigned long *table, unsigned long shift,
-                        unsigned long va, int *new_table) {
+static void table_cache_drain(struct mm_struct *mm) {
+  while (mm->table_cache) {
+    free_page(table_alloc(mm));
+  }
+}
+
+// Returns the next level table for va, allocating it if missing, or 0 when
+// out of memory
+static unsigned long map_table(struct mm_struct *mm, unsigned long *table,
+                               unsigned long shift, unsigned long va,
+                               int *new_table) {
   unsigned long index = va >> shift;
   index = index & (PTRS_PER_TABLE - 1);
   if (!table[index]) {
+    unsigned long next_level_table = table_alloc(mm);
+    if (next_level_table == 0) {
+      *new_table = 0;
+      return 0;
+    }
     *new_table = 1;
-    unsigned long next_level_table = get_free_page();
     unsigned long entry = next_level_table | MM_TYPE_PAGE_TABLE;
+    // The zeroed table must be visible to the walker before it is linked in
+    dsb_ishst();
     table[index] = entry;
     return next_level_table;
   } else {
@@ -74,109 +514,1297 @@ unsigned long map_table(unsigned long *table, unsigned long shift,
   return table[index] & PAGE_MASK;
 }
 
-void map_table_entry(unsigned long *pte, unsigned long va, unsigned long pa) {
-  unsigned long index = va >> PAGE_SHIFT;
-  index = index & (PTRS_PER_TABLE - 1);
-  unsigned long entry = pa | MMU_PTE_FLAGS;
-  pte[index] = entry;
+static const unsigned long table_shift[] = {PGD_SHIFT, PUD_SHIFT, PMD_SHIFT,
+                                            PAGE_SHIFT};
+
+static int pmd_block(unsigned long entry) {
+  return (entry & MM_TYPE_MASK) == MM_TYPE_BLOCK;
 }
 
-void map_table_entry_guard(unsigned long *pte, unsigned long va) {
-  unsigned long index = va >> PAGE_SHIFT;
-  index = index & (PTRS_PER_TABLE - 1);
-  // Map to physical address 0 with no user access permissions (AP=0b00)
-  unsigned long entry = 0 | MMU_PTE_FLAGS_GUARD;
-  pte[index] = entry;
+static int pte_user_page(unsigned long entry) {
+  return (entry & PTE_VALID) && (entry & MM_ACCESS_PERMISSION);
+}
+
+/*
+ * Contiguous hint. The architecture requires all CONT_PTES entries of a
+ * group to agree on it, and changing it on live entries needs
+ * break-before-make, so it is only ever set or cleared on a whole group at
+ * once, with every entry invalid and flushed in between.
+ */
+
+// First entry of the CONT_PTES-aligned group holding pte
+static unsigned long *cont_group(unsigned long *pte) {
+  return (unsigned long *)((unsigned long)pte &
+                           ~(CONT_PTES * sizeof(unsigned long) - 1));
+}
+
+static int cont_group_empty(unsigned long *group) {
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    if (group[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Rewrite the group holding pte (mapping va) with the hint set or cleared
+static void cont_rewrite(struct mm_struct *mm, unsigned long *pte,
+                         unsigned long va, int cont) {
+  unsigned long *group = cont_group(pte);
+  unsigned long start = va & ~((unsigned long)CONT_PTE_SIZE - 1);
+  unsigned long entries[CONT_PTES];
+  preempt_disable();
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    entries[i] = cont ? group[i] | PTE_CONT : group[i] & ~PTE_CONT;
+    group[i] = 0;
+  }
+  flush_tlb_range(mm, start, start + CONT_PTE_SIZE);
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    group[i] = entries[i];
+  }
+  dsb_ishst();
+  preempt_enable();
+}
+
+// Set the hint on the group holding pte if its entries map one naturally
+// aligned, physically contiguous run of user pages with equal attributes
+static void pte_cont_fold(struct mm_struct *mm, unsigned long *pte,
+                          unsigned long va) {
+  unsigned long *group = cont_group(pte);
+  unsigned long first = group[0];
+  unsigned long base = first & PTE_ADDR_MASK;
+  if (!pte_user_page(first) || (first & PTE_CONT) ||
+      (base & (CONT_PTE_SIZE - 1))) {
+    return;
+  }
+  for (unsigned long i = 1; i < CONT_PTES; i++) {
+    if (group[i] != (first + i * PAGE_SIZE)) {
+      return;
+    }
+  }
+  cont_rewrite(mm, pte, va, 1);
+}
+
+// Clear the hint from the group holding pte so that one entry can change
+static void pte_cont_unfold(struct mm_struct *mm, unsigned long *pte,
+                            unsigned long va) {
+  if (*pte & PTE_CONT) {
+    cont_rewrite(mm, pte, va, 0);
+  }
 }
 
-void map_page(struct task_struct *task, unsigned long va, unsigned long page) {
-  unsigned long pgd;
+// Kernel VA of the level-2 entry for va, creating any missing tables above it
+static unsigned long *pmd_alloc(struct task_struct *task, unsigned long va) {
   if (!task->mm.pgd) {
-    task->mm.pgd = get_free_page();
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = task->mm.pgd;
+    task->mm.pgd = table_alloc(&task->mm);
+    if (!task->mm.pgd) {
+      return 0;
+    }
+    task->mm.nr_ptes++;
+  }
+  unsigned long table = task->mm.pgd;
+  for (int level = 0; level < 2; level++) {
+    int new_table;
+    table = map_table(&task->mm, (unsigned long *)(table + VA_START),
+                      table_shift[level], va, &new_table);
+    if (table == 0) {
+      return 0;
+    }
+    task->mm.nr_ptes += new_table;
+  }
+  unsigned long index = (va >> PMD_SHIFT) & (PTRS_PER_TABLE - 1);
+  return (unsigned long *)(table + VA_START) + index;
+}
+
+// Replace the block at *pmd (covering va) with a PTE table mapping the same
+// memory page by page. A block nobody else maps is split in place, keeping
+// the contiguous hint on every group; a shared one is copied, so the other
+// sharers keep their block.
+static int split_huge_pmd(struct task_struct *task, unsigned long *pmd,
+                          unsigned long va) {
+  unsigned long block = *pmd & PTE_ADDR_MASK;
+  unsigned long attrs =
+      (*pmd & ~(PTE_ADDR_MASK | MM_TYPE_MASK)) | MM_TYPE_PAGE;
+  unsigned long table = table_alloc(&task->mm);
+  if (table == 0) {
+    return -1;
+  }
+  unsigned long *entries = (unsigned long *)(table + VA_START);
+  int shared = page_count(block) > 1;
+  if (!shared) {
+    attrs |= PTE_CONT;
+  }
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES; i++) {
+    unsigned long page = block + i * PAGE_SIZE;
+    if (shared) {
+      unsigned long copy = get_free_page_nozero();
+      if (copy == 0) {
+        while (i-- > 0) {
+          free_page(entries[i] & PTE_ADDR_MASK);
+          entries[i] = 0;
+        }
+        table_release(&task->mm, table);
+        return -1;
+      }
+      memcpy(copy + VA_START, page + VA_START, PAGE_SIZE);
+      flush_icache_range(copy + VA_START, PAGE_SIZE);
+      page = copy;
+    }
+    entries[i] = page | attrs;
+  }
+  if (!shared) {
+    split_page(block, HUGE_PAGE_ORDER);
+  }
+  // The head keeps the block's mapping, every other page gains one
+  for (unsigned long i = shared ? 0 : 1; i < HUGE_PAGE_PAGES; i++) {
+    page_add_mapping(entries[i] & PTE_ADDR_MASK);
+  }
+  // Break before make: the block leaves the TLB before the table goes in
+  *pmd = 0;
+  flush_tlb_page_mm(&task->mm, va);
+  *pmd = table | MM_TYPE_PAGE_TABLE;
+  dsb_ishst();
+  task->mm.nr_ptes++;
+  if (shared) {
+    page_remove_mapping(block);
+    put_page(block);
+  }
+  return 0;
+}
+
+// Kernel VA of the PTE for va, creating any missing tables on the way and
+// splitting a block that covers va
+static unsigned long *pte_alloc(struct task_struct *task, unsigned long va) {
+  unsigned long *pmd = pmd_alloc(task, va);
+  if (pmd == 0) {
+    return 0;
+  }
+  if (pmd_block(*pmd) && split_huge_pmd(task, pmd, va) < 0) {
+    return 0;
   }
-  pgd = task->mm.pgd;
   int new_table;
-  unsigned long pud =
-      map_table((unsigned long *)(pgd + VA_START), PGD_SHIFT, va, &new_table);
-  if (new_table) {
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = pud;
+  unsigned long table =
+      map_table(&task->mm, (unsigned long *)((unsigned long)pmd & PAGE_MASK),
+                PMD_SHIFT, va, &new_table);
+  if (table == 0) {
+    return 0;
+  }
+  task->mm.nr_ptes += new_table;
+  unsigned long index = (va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1);
+  return (unsigned long *)(table + VA_START) + index;
+}
+
+// Fill the n entries from pte, which map va onwards within one PTE table.
+// Whatever was mapped is taken down and flushed from the TLB first, so no
+// stale translation outlives its replacement; whole runs are then written
+// with the contiguous hint directly, and the runs at either end may have
+// been completed by this call.
+static void map_ptes(struct task_struct *task, unsigned long *pte,
+                     unsigned long va, unsigned long pa, unsigned long n,
+                     unsigned long prot) {
+  int user = pte_user_page(prot);
+  int cont = user && ((va ^ pa) & (CONT_PTE_SIZE - 1)) == 0;
+  struct tlb_gather tlb;
+  tlb_gather_init(&tlb, &task->mm);
+  for (unsigned long i = 0; i < n; i++) {
+    unsigned long addr = va + i * PAGE_SIZE;
+    if (pte[i] == 0) {
+      continue;
+    }
+    pte_cont_unfold(&task->mm, pte + i, addr);
+    if (pte_user_page(pte[i])) {
+      page_remove_mapping(pte[i] & PTE_ADDR_MASK);
+      task->mm.rss--;
+    } else if (is_swap_pte(pte[i])) {
+      swap_free(swp_slot(pte[i]));
+      task->mm.nr_swap--;
+    }
+    if (pte[i] & PTE_VALID) {
+      // The caller owns the pages: nothing to put after the flush
+      tlb_gather_page(&tlb, addr, 0);
+    }
+    pte[i] = 0;
+  }
+  tlb_gather_flush(&tlb);
+
+  unsigned long i = 0;
+  while (i < n) {
+    unsigned long addr = va + i * PAGE_SIZE;
+    if (cont && (addr & (CONT_PTE_SIZE - 1)) == 0 && n - i >= CONT_PTES) {
+      for (unsigned long j = 0; j < CONT_PTES; j++, i++) {
+        pte[i] = (pa + i * PAGE_SIZE) | prot | PTE_CONT;
+        page_add_mapping(pa + i * PAGE_SIZE);
+      }
+      task->mm.rss += CONT_PTES;
+      continue;
+    }
+    pte[i] = (pa + i * PAGE_SIZE) | prot;
+    if (user) {
+      page_add_mapping(pa + i * PAGE_SIZE);
+      task->mm.rss++;
+    }
+    i++;
+  }
+  dsb_ishst();
+  if (cont) {
+    pte_cont_fold(&task->mm, pte, va);
+    pte_cont_fold(&task->mm, pte + n - 1, va + (n - 1) * PAGE_SIZE);
+  }
+}
+
+// Map npages pages of physically contiguous memory from pa at va with page
+// flags prot, replacing whatever was there. Each PTE table on the way is
+// walked to once. On failure the pages mapped so far stay mapped.
+int map_range(struct task_struct *task, unsigned long va, unsigned long pa,
+              unsigned long npages, unsigned long prot) {
+  while (npages > 0) {
+    unsigned long *pte = pte_alloc(task, va);
+    if (pte == 0) {
+      return -1;
+    }
+    unsigned long n =
+        PTRS_PER_TABLE - ((va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1));
+    if (n > npages) {
+      n = npages;
+    }
+    map_ptes(task, pte, va, pa, n, prot);
+    va += n * PAGE_SIZE;
+    pa += n * PAGE_SIZE;
+    npages -= n;
+  }
+  return 0;
+}
+
+int map_page_prot(struct task_struct *task, unsigned long va,
+                  unsigned long page, unsigned long flags) {
+  return map_range(task, va, page, 1, flags);
+}
+
+int map_page(struct task_struct *task, unsigned long va, unsigned long page) {
+  return map_range(task, va, page, 1, MMU_PTE_FLAGS);
+}
+
+int map_guard_page(struct task_struct *task, unsigned long va) {
+  // Map to physical address 0 with no user access permissions (AP=0b00)
+  return map_range(task, va, 0, 1, MMU_PTE_FLAGS_GUARD);
+}
+
+// Map the 2 MiB block at physical address block at va with a level-2 block
+// descriptor. flags are page flags, as for map_page_prot. Fails if anything
+// is already mapped in that 2 MiB.
+int map_block(struct task_struct *task, unsigned long va, unsigned long block,
+              unsigned long flags) {
+  if ((va | block) & (SECTION_SIZE - 1)) {
+    return -1;
   }
-  unsigned long pmd =
-      map_table((unsigned long *)(pud + VA_START), PUD_SHIFT, va, &new_table);
-  if (new_table) {
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = pmd;
+  unsigned long *pmd = pmd_alloc(task, va);
+  if (pmd == 0 || *pmd) {
+    return -1;
   }
-  unsigned long pte =
-      map_table((unsigned long *)(pmd + VA_START), PMD_SHIFT, va, &new_table);
-  if (new_table) {
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = pte;
+  *pmd = block | (flags & ~MM_TYPE_MASK) | MM_TYPE_BLOCK;
+  if (pte_user_page(*pmd)) {
+    task->mm.rss += HUGE_PAGE_PAGES;
+    page_add_mapping(block);
   }
-  map_table_entry((unsigned long *)(pte + VA_START), va, page);
-  struct user_page p = {page, va};
-  task->mm.user_pages[task->mm.user_pages_count++] = p;
+  dsb_ishst();
+  return 0;
 }
 
-void map_guard_page(struct task_struct *task, unsigned long va) {
-  unsigned long pgd;
+unsigned long *pmd_lookup(struct task_struct *task, unsigned long va) {
   if (!task->mm.pgd) {
-    task->mm.pgd = get_free_page();
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = task->mm.pgd;
+    return 0;
   }
-  pgd = task->mm.pgd;
-  int new_table;
-  unsigned long pud =
-      map_table((unsigned long *)(pgd + VA_START), PGD_SHIFT, va, &new_table);
-  if (new_table) {
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = pud;
+  unsigned long table = task->mm.pgd;
+  for (int level = 0; level < 2; level++) {
+    unsigned long index = (va >> table_shift[level]) & (PTRS_PER_TABLE - 1);
+    unsigned long entry = ((unsigned long *)(table + VA_START))[index];
+    if ((entry & MM_TYPE_MASK) != MM_TYPE_PAGE_TABLE) {
+      return 0;
+    }
+    table = entry & PAGE_MASK;
+  }
+  unsigned long index = (va >> PMD_SHIFT) & (PTRS_PER_TABLE - 1);
+  return (unsigned long *)(table + VA_START) + index;
+}
+
+// A PTE table can become one block if it maps 512 private user pages with
+// identical attributes, not counting the contiguous hint or access flag.
+// Each page must be mapped exactly once: a fault preempted between writing
+// its entry and page_add_mapping has a page with no mapping counted yet.
+static int huge_pmd_collapsible(unsigned long *ptes) {
+  unsigned long ignored = PTE_ADDR_MASK | PTE_CONT | MM_ACCESS;
+  unsigned long attrs = ptes[0] & ~ignored;
+  if (!pte_user_page(ptes[0]) || (attrs & PTE_COW)) {
+    return 0;
+  }
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES; i++) {
+    if ((ptes[i] & ~ignored) != attrs ||
+        page_count(ptes[i] & PTE_ADDR_MASK) != 1 ||
+        page_mapcount(ptes[i] & PTE_ADDR_MASK) != 1) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Promote the fully populated PTE table under the 2 MiB at va to a block:
+// copy its pages into one contiguous block, swap the PMD entry and free the
+// old pages and table. Returns 1 when collapsed, 0 when the range does not
+// qualify and -1 when no free block was available.
+int collapse_huge_pmd(struct task_struct *task, unsigned long va) {
+  if (va & (SECTION_SIZE - 1)) {
+    return 0;
+  }
+  struct vm_area_struct *vma = find_vma(&task->mm, va);
+  if (!vma || !(vma->vm_flags & VM_ANON) ||
+      va + SECTION_SIZE > vma->vm_end) {
+    return 0;
+  }
+  unsigned long *pmd = pmd_lookup(task, va);
+  if (pmd == 0 || (*pmd & MM_TYPE_MASK) != MM_TYPE_PAGE_TABLE) {
+    return 0;
+  }
+  unsigned long table = *pmd & PTE_ADDR_MASK;
+  unsigned long *ptes = (unsigned long *)(table + VA_START);
+  if (!huge_pmd_collapsible(ptes)) {
+    return 0;
+  }
+  unsigned long block = alloc_pages(HUGE_PAGE_ORDER);
+  if (block == 0) {
+    return -1;
   }
-  unsigned long pmd =
-      map_table((unsigned long *)(pud + VA_START), PUD_SHIFT, va, &new_table);
-  if (new_table) {
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = pmd;
+
+  // The owner must not run between the copy and the switch to the block
+  preempt_disable();
+  if (!huge_pmd_collapsible(ptes)) {
+    preempt_enable();
+    free_pages(block, HUGE_PAGE_ORDER);
+    return 0;
+  }
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES; i++) {
+    memcpy(block + VA_START + i * PAGE_SIZE,
+           (ptes[i] & PTE_ADDR_MASK) + VA_START, PAGE_SIZE);
+  }
+  flush_icache_range(block + VA_START, SECTION_SIZE);
+  unsigned long attrs =
+      (ptes[0] & ~(PTE_ADDR_MASK | MM_TYPE_MASK | PTE_CONT)) | MM_ACCESS;
+  // Break before make: all 512 old translations go, and the cached walks
+  *pmd = 0;
+  flush_tlb_pgtable(&task->mm, va);
+  *pmd = block | attrs | MM_TYPE_BLOCK;
+  dsb_ishst();
+  preempt_enable();
+
+  page_add_mapping(block);
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES; i++) {
+    page_remove_mapping(ptes[i] & PTE_ADDR_MASK);
+    put_page(ptes[i] & PTE_ADDR_MASK);
+  }
+  free_page(table);
+  task->mm.nr_ptes--;
+  return 1;
+}
+
+// The entry mapping va, a page or a block, and the size it maps
+static unsigned long *leaf_lookup(struct task_struct *task, unsigned long va,
+                                  unsigned long *size) {
+  unsigned long *pmd = pmd_lookup(task, va);
+  if (pmd && pmd_block(*pmd)) {
+    *size = SECTION_SIZE;
+    return pmd;
+  }
+  *size = PAGE_SIZE;
+  return pte_lookup(task, va);
+}
+
+unsigned long *pte_lookup(struct task_struct *task, unsigned long va) {
+  if (!task->mm.pgd) {
+    return 0;
+  }
+  unsigned long table = task->mm.pgd;
+  for (int level = 0; level < 3; level++) {
+    unsigned long index = (va >> table_shift[level]) & (PTRS_PER_TABLE - 1);
+    unsigned long entry = ((unsigned long *)(table + VA_START))[index];
+    if ((entry & MM_TYPE_PAGE_TABLE) != MM_TYPE_PAGE_TABLE) {
+      return 0;
+    }
+    table = entry & PAGE_MASK;
   }
-  unsigned long pte =
-      map_table((unsigned long *)(pmd + VA_START), PMD_SHIFT, va, &new_table);
-  if (new_table) {
-    task->mm.kernel_pages[++task->mm.kernel_pages_count] = pte;
+  unsigned long index = (va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1);
+  return (unsigned long *)(table + VA_START) + index;
+}
+
+// Mirror every leaf entry below a level-`level` table into dst, sharing
+// writable user pages copy-on-write. dst's matching table is walked to once,
+// on the first leaf.
+static int copy_ptes(struct task_struct *dst, unsigned long table, int level,
+                     unsigned long base) {
+  unsigned long *entries = (unsigned long *)(table + VA_START);
+  unsigned long *dst_entries = 0;
+  for (int i = 0; i < PTRS_PER_TABLE; i++) {
+    unsigned long entry = entries[i];
+    if (!(entry & PTE_VALID) && !is_swap_pte(entry)) {
+      continue;
+    }
+    unsigned long va = base + ((unsigned long)i << table_shift[level]);
+    if (level < 3 && (entry & MM_TYPE_MASK) == MM_TYPE_PAGE_TABLE) {
+      if (copy_ptes(dst, entry & PTE_ADDR_MASK, level + 1, va) < 0) {
+        return -1;
+      }
+      continue;
+    }
+    // Share the page or block read-only; whichever side writes first takes
+    // a copy
+    if (pte_user_page(entry) && !(entry & MM_AP_RDONLY)) {
+      entry |= MM_AP_RDONLY | PTE_COW;
+      entries[i] = entry;
+    }
+    if (dst_entries == 0) {
+      dst_entries = level == 3 ? pte_alloc(dst, base) : pmd_alloc(dst, base);
+      if (dst_entries == 0) {
+        return -1;
+      }
+    }
+    dst_entries[i] = entry;
+    if (is_swap_pte(entry)) {
+      // Both sides fault the page back in from the one slot
+      swap_dup(swp_slot(entry));
+      dst->mm.nr_swap++;
+      continue;
+    }
+    get_page(entry & PTE_ADDR_MASK);
+    if (pte_user_page(entry)) {
+      dst->mm.rss += level == 3 ? 1 : HUGE_PAGE_PAGES;
+      page_add_mapping(entry & PTE_ADDR_MASK);
+    }
   }
-  map_table_entry_guard((unsigned long *)(pte + VA_START), va);
+  return 0;
 }
 
 int copy_virt_memory(struct task_struct *dst) {
   struct task_struct *src = current;
-  for (int i = 0; i < src->mm.user_pages_count; i++) {
-    unsigned long kernel_va =
-        allocate_user_page(dst, src->mm.user_pages[i].virt_addr);
-    if (kernel_va == 0) {
+  if (copy_vmas(&dst->mm, &src->mm) < 0) {
+    return -1;
+  }
+  int ret = 0;
+  if (src->mm.pgd) {
+    ret = copy_ptes(dst, src->mm.pgd, 0, 0);
+  }
+  // The parent may still hold writable translations for the shared pages
+  flush_tlb_mm(&src->mm);
+  return ret;
+}
+
+static void free_table(unsigned long table, int level) {
+  unsigned long *entries = (unsigned long *)(table + VA_START);
+  for (int i = 0; i < PTRS_PER_TABLE; i++) {
+    unsigned long entry = entries[i];
+    if (is_swap_pte(entry)) {
+      swap_free(swp_slot(entry));
+      continue;
+    }
+    if (!(entry & PTE_VALID)) {
+      continue;
+    }
+    if (level < 3 && (entry & MM_TYPE_MASK) == MM_TYPE_PAGE_TABLE) {
+      free_table(entry & PTE_ADDR_MASK, level + 1);
+    } else {
+      if (pte_user_page(entry)) {
+        page_remove_mapping(entry & PTE_ADDR_MASK);
+      }
+      put_page(entry & PTE_ADDR_MASK);
+    }
+  }
+  free_page(table);
+}
+
+// Drop task's user pages, page tables and VMAs. The tables must not be live
+// in TTBR0 when this runs.
+void exit_mm(struct task_struct *task) {
+  if (task->mm.pgd) {
+    free_table(task->mm.pgd, 0);
+  }
+  exit_vmas(&task->mm);
+  table_cache_drain(&task->mm);
+  task->mm.pgd = 0;
+  task->mm.rss = 0;
+  task->mm.nr_ptes = 0;
+  task->mm.nr_swap = 0;
+  task->mm.wss = 0;
+  task->mm.wss_young = 0;
+}
+
+// Replace the shared page behind pte (mapping va) with a private, writable one
+static int do_cow_fault(struct task_struct *task, unsigned long va,
+                        unsigned long *pte) {
+  pte_cont_unfold(&task->mm, pte, va);
+  unsigned long old_page = *pte & PTE_ADDR_MASK;
+  unsigned long attrs = *pte & ~(PTE_ADDR_MASK | MM_AP_RDONLY | PTE_COW);
+  preempt_disable();
+  if (page_count(old_page) == 1) {
+    // Every other sharer has already copied or gone away
+    *pte = old_page | attrs;
+    preempt_enable();
+    flush_tlb_page_mm(&task->mm, va);
+    // The last page of a run to be made writable again restores the hint
+    pte_cont_fold(&task->mm, pte, va);
+    return 0;
+  }
+  preempt_enable();
+
+  unsigned long new_page;
+  if (old_page == ZERO_PAGE) {
+    // Nothing to copy, any clean page will do
+    new_page = get_free_page();
+    if (new_page == 0) {
+      return -1;
+    }
+  } else {
+    new_page = get_free_page_nozero();
+    if (new_page == 0) {
       return -1;
     }
-    // Use physical address + VA_START to access in kernel context, not user
-    // virtual address
-    unsigned long src_kernel_va = src->mm.user_pages[i].phys_addr + VA_START;
-    memcpy(kernel_va, src_kernel_va, PAGE_SIZE);
+    memcpy(new_page + VA_START, old_page + VA_START, PAGE_SIZE);
+    // User pages hold code as well as data
+    flush_icache_range(new_page + VA_START, PAGE_SIZE);
+  }
+  preempt_disable();
+  if (!(*pte & PTE_VALID) || (*pte & PTE_ADDR_MASK) != old_page) {
+    // Merged, migrated or swapped while we copied: retry the access
+    preempt_enable();
+    free_page(new_page);
+    return 0;
   }
+  // Break before make: the output address changes
+  *pte = 0;
+  flush_tlb_page_mm(&task->mm, va);
+  *pte = new_page | attrs;
+  dsb_ishst();
+  page_add_mapping(new_page);
+  page_remove_mapping(old_page);
+  put_page(old_page);
+  preempt_enable();
   return 0;
 }
 
-int do_mem_abort(unsigned long addr, unsigned long esr) {
-  unsigned long fsc = (esr & 0x3f); // Fault Status Code is bits 5:0
-
-  // Check if this is a translation fault (FSC = 0x04 for level 0, 0x05 for
-  // level 1, etc.) or a permission fault (FSC = 0x0c for level 0, 0x0d for
-  // level 1, etc.) We handle translation faults (page doesn't exist yet)
-  unsigned long fsc_type = fsc & 0x3c; // bits 5:2 indicate fault type
+// Copy-on-write for a shared block: take a private 2 MiB copy, or failing
+// that split the block into pages and copy just the one written
+static int do_huge_cow_fault(struct task_struct *task, unsigned long va,
+                             unsigned long *pmd) {
+  unsigned long block_va = va & ~((unsigned long)SECTION_SIZE - 1);
+  unsigned long old_block = *pmd & PTE_ADDR_MASK;
+  unsigned long attrs = *pmd & ~(PTE_ADDR_MASK | MM_AP_RDONLY | PTE_COW);
+  preempt_disable();
+  if (page_count(old_block) == 1) {
+    *pmd = old_block | attrs;
+    preempt_enable();
+    flush_tlb_page_mm(&task->mm, block_va);
+    return 0;
+  }
+  preempt_enable();
 
-  if (fsc_type == 0x04 || fsc_type == 0x0c) { // Translation or permission fault
-    if (current->mm.user_pages_count >= MAX_PROCESS_PAGES) {
+  unsigned long new_block = alloc_pages(HUGE_PAGE_ORDER);
+  if (new_block == 0) {
+    if (split_huge_pmd(task, pmd, va) < 0) {
       return -1;
     }
+    return do_cow_fault(task, va & PAGE_MASK, pte_lookup(task, va));
+  }
+  memcpy(new_block + VA_START, old_block + VA_START, SECTION_SIZE);
+  flush_icache_range(new_block + VA_START, SECTION_SIZE);
+  preempt_disable();
+  if (!pmd_block(*pmd) || (*pmd & PTE_ADDR_MASK) != old_block) {
+    preempt_enable();
+    free_pages(new_block, HUGE_PAGE_ORDER);
+    return 0;
+  }
+  // Break before make, over the whole block
+  *pmd = 0;
+  flush_tlb_range(&task->mm, block_va, block_va + SECTION_SIZE);
+  *pmd = new_block | attrs;
+  dsb_ishst();
+  page_add_mapping(new_block);
+  page_remove_mapping(old_block);
+  put_page(old_block);
+  preempt_enable();
+  return 0;
+}
+
+// Back the whole 2 MiB around va with one zeroed block, if the VMA covers
+// it, nothing is mapped there yet and a contiguous block is free
+static int do_huge_anonymous_fault(struct task_struct *task,
+                                   struct vm_area_struct *vma,
+                                   unsigned long va) {
+  unsigned long start = va & ~((unsigned long)SECTION_SIZE - 1);
+  if (start < vma->vm_start || start + SECTION_SIZE > vma->vm_end) {
+    return -1;
+  }
+  unsigned long *pmd = pmd_lookup(task, start);
+  if (pmd && *pmd) {
+    return -1;
+  }
+  unsigned long block = alloc_pages(HUGE_PAGE_ORDER);
+  if (block == 0) {
+    return -1;
+  }
+  memzero(block + VA_START, SECTION_SIZE);
+  if (map_block(task, start, block, vma_pte_flags(vma)) < 0) {
+    free_pages(block, HUGE_PAGE_ORDER);
+    return -1;
+  }
+  return 0;
+}
+
+static unsigned long fault_around_pages = FAULT_AROUND_PAGES;
+
+int set_fault_around_pages(unsigned long pages) {
+  if (pages == 0 || pages > PTRS_PER_TABLE || (pages & (pages - 1))) {
+    return -1;
+  }
+  fault_around_pages = pages;
+  return 0;
+}
+
+unsigned long get_fault_around_pages(void) { return fault_around_pages; }
+
+// Minor faults per process, to tune the fault-around window by
+void fault_print_stats(void) {
+  printf("fault: around %lu pages\r\n", fault_around_pages);
+  preempt_disable();
+  for (struct task_struct *p = next_mm_task(0); p;
+       p = next_mm_task(p->pid + 1)) {
+    printf("fault: pid %ld min_flt %lu rss %lu\r\n", p->pid, p->mm.min_flt,
+           p->mm.rss);
+  }
+  preempt_enable();
+}
+
+// Back the empty group of CONT_PTES entries starting at entry with one zeroed
+// run mapped under the contiguous hint. The entries are invalid, so no
+// break-before-make is needed. Best effort: a run is not worth draining the
+// zero pool for.
+static int map_cont_run(struct task_struct *task, unsigned long *entry,
+                        unsigned long flags) {
+  if (!cont_group_empty(entry)) {
+    return -1;
+  }
+  unsigned long run = __alloc_pages(CONT_PTE_ORDER);
+  if (run == 0) {
+    return -1;
+  }
+  memzero(run + VA_START, CONT_PTE_SIZE);
+  split_page(run, CONT_PTE_ORDER);
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    entry[i] = (run + i * PAGE_SIZE) | flags | PTE_CONT;
+    page_add_mapping(run + i * PAGE_SIZE);
+  }
+  task->mm.rss += CONT_PTES;
+  return 0;
+}
+
+// Map the zero page read-only over the empty slots of [start, end), va's
+// included. Writable VMAs get it copy-on-write, so the first write to each
+// page takes a private one.
+static void map_zero_pages(struct task_struct *task, unsigned long *pte,
+                           struct vm_area_struct *vma, unsigned long va,
+                           unsigned long start, unsigned long end) {
+  unsigned long entry_value = ZERO_PAGE | vma_pte_flags(vma) | MM_AP_RDONLY;
+  if (vma->vm_flags & VM_WRITE) {
+    entry_value |= PTE_COW;
+  }
+  unsigned long *entry = pte - ((va - start) >> PAGE_SHIFT);
+  for (unsigned long addr = start; addr < end; addr += PAGE_SIZE, entry++) {
+    if (*entry == 0) {
+      *entry = entry_value;
+      task->mm.rss++;
+    }
+  }
+  dsb_ishst();
+}
+
+// Map a zeroed page at va, then fill the empty slots of the fault-around
+// window with more. The window is aligned to its size, so it never leaves
+// the PTE table holding va and one walk serves every page in it. Whole
+// aligned groups of the window are mapped as contiguous runs when possible.
+// A read maps the shared zero page across the window instead.
+static int do_anonymous_fault(struct task_struct *task,
+                              struct vm_area_struct *vma, unsigned long va,
+                              int write) {
+  if ((vma->vm_flags & VM_HUGEPAGE) &&
+      do_huge_anonymous_fault(task, vma, va) == 0) {
+    return 0;
+  }
+  unsigned long *pte = pte_alloc(task, va);
+  if (pte == 0) {
+    return -1;
+  }
+  unsigned long flags = vma_pte_flags(vma);
+  unsigned long window = fault_around_pages << PAGE_SHIFT;
+  unsigned long start = va & ~(window - 1);
+  unsigned long end = start + window;
+  if (start < vma->vm_start) {
+    start = vma->vm_start;
+  }
+  if (end > vma->vm_end) {
+    end = vma->vm_end;
+  }
+  if (!write) {
+    map_zero_pages(task, pte, vma, va, start, end);
+    return 0;
+  }
+
+  unsigned long run = va & ~((unsigned long)CONT_PTE_SIZE - 1);
+  if (run < start || run + CONT_PTE_SIZE > end ||
+      map_cont_run(task, cont_group(pte), flags) < 0) {
     unsigned long page = get_free_page();
     if (page == 0) {
       return -1;
     }
-    map_page(current, addr & PAGE_MASK, page);
+    *pte = page | flags;
+    page_add_mapping(page);
+    task->mm.rss++;
+  }
+
+  unsigned long *entry = pte - ((va - start) >> PAGE_SHIFT);
+  for (unsigned long addr = start; addr < end; addr += PAGE_SIZE, entry++) {
+    // Anything already there (pages, guard pages) is left alone
+    if (*entry) {
+      continue;
+    }
+    if ((addr & (CONT_PTE_SIZE - 1)) == 0 && addr + CONT_PTE_SIZE <= end &&
+        map_cont_run(task, entry, flags) == 0) {
+      addr += CONT_PTE_SIZE - PAGE_SIZE;
+      entry += CONT_PTES - 1;
+      continue;
+    }
+    // Neighbours are best effort
+    unsigned long page = get_free_page();
+    if (page == 0) {
+      break;
+    }
+    *entry = page | flags;
+    page_add_mapping(page);
+    task->mm.rss++;
+  }
+  dsb_ishst();
+  return 0;
+}
+
+// Unmap a whole contiguous run, starting at pte, in one break
+static void zap_cont_run(struct tlb_gather *tlb, unsigned long *pte,
+                         unsigned long va) {
+  unsigned long entries[CONT_PTES];
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    entries[i] = pte[i];
+    pte[i] = 0;
+  }
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    tlb->mm->rss--;
+    page_remove_mapping(entries[i] & PTE_ADDR_MASK);
+    tlb_gather_page(tlb, va + i * PAGE_SIZE, entries[i] & PTE_ADDR_MASK);
+  }
+}
+
+// Clear the entries for [va, end) from the PTE table slot pte onwards
+static void zap_ptes(struct tlb_gather *tlb, unsigned long *pte,
+                     unsigned long va, unsigned long end) {
+  while (va < end) {
+    if (*pte & PTE_CONT) {
+      if ((va & (CONT_PTE_SIZE - 1)) == 0 && end - va >= CONT_PTE_SIZE) {
+        zap_cont_run(tlb, pte, va);
+        va += CONT_PTE_SIZE;
+        pte += CONT_PTES;
+        continue;
+      }
+      // Only part of the run goes, the rest loses the hint
+      pte_cont_unfold(tlb->mm, pte, va);
+    }
+    unsigned long entry = *pte;
+    if (entry) {
+      *pte = 0;
+      if (pte_user_page(entry)) {
+        tlb->mm->rss--;
+        page_remove_mapping(entry & PTE_ADDR_MASK);
+        tlb_gather_page(tlb, va, entry & PTE_ADDR_MASK);
+      } else if (entry & PTE_VALID) {
+        tlb_gather_page(tlb, va, 0);
+      } else if (is_swap_pte(entry)) {
+        swap_free(swp_slot(entry));
+        tlb->mm->nr_swap--;
+      }
+    }
+    va += PAGE_SIZE;
+    pte++;
+  }
+}
+
+// Unlink the PTE table under *pmd (covering va) if nothing is left in it
+static void pte_table_release(struct tlb_gather *tlb, unsigned long *pmd,
+                              unsigned long va) {
+  unsigned long table = *pmd & PTE_ADDR_MASK;
+  unsigned long *entries = (unsigned long *)(table + VA_START);
+  for (int i = 0; i < PTRS_PER_TABLE; i++) {
+    if (entries[i]) {
+      return;
+    }
+  }
+  *pmd = 0;
+  // No walk may still go through the table once it can be reused
+  tlb_gather_table(tlb, va);
+  tlb_gather_flush(tlb);
+  tlb->mm->nr_ptes--;
+  table_release(tlb->mm, table);
+}
+
+// Unmap npages pages from va in task, dropping each page's reference once
+// the TLB no longer holds it. PTE tables left empty go to the table cache.
+// Blocks the range only partly covers are split first, which is the only
+// way this can fail.
+int unmap_range(struct task_struct *task, unsigned long va,
+                unsigned long npages) {
+  struct tlb_gather tlb;
+  tlb_gather_init(&tlb, &task->mm);
+  unsigned long end = va + npages * PAGE_SIZE;
+  int ret = 0;
+  while (va < end) {
+    unsigned long next =
+        (va + SECTION_SIZE) & ~((unsigned long)SECTION_SIZE - 1);
+    if (next > end) {
+      next = end;
+    }
+    unsigned long *pmd = pmd_lookup(task, va);
+    if (pmd == 0 || *pmd == 0) {
+      va = next;
+      continue;
+    }
+    if (pmd_block(*pmd)) {
+      if (next - va == SECTION_SIZE) {
+        unsigned long entry = *pmd;
+        *pmd = 0;
+        task->mm.rss -= HUGE_PAGE_PAGES;
+        page_remove_mapping(entry & PTE_ADDR_MASK);
+        tlb_gather_page(&tlb, va, entry & PTE_ADDR_MASK);
+        va = next;
+        continue;
+      }
+      if (split_huge_pmd(task, pmd, va) < 0) {
+        ret = -1;
+        break;
+      }
+    }
+    unsigned long *pte = (unsigned long *)((*pmd & PTE_ADDR_MASK) + VA_START) +
+                         ((va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1));
+    zap_ptes(&tlb, pte, va, next);
+    pte_table_release(&tlb, pmd, va);
+    va = next;
+  }
+  tlb_gather_flush(&tlb);
+  return ret;
+}
+
+// Map kpage, which must hold the same contents, read-only in place of the
+// anonymous page mapped at va, so that the two share it copy-on-write. The
+// mapping is write-protected before the contents are compared, so they
+// cannot change underneath; passing the page va maps as kpage just does
+// that. Returns 1 when va maps kpage, 0 when it does not qualify or the
+// contents differ.
+int merge_page(struct task_struct *task, unsigned long va,
+               unsigned long kpage) {
+  struct vm_area_struct *vma = find_vma(&task->mm, va);
+  unsigned long *pte = pte_lookup(task, va);
+  if (!vma || !(vma->vm_flags & VM_ANON) || pte == 0 ||
+      !pte_user_page(*pte)) {
+    return 0;
+  }
+  unsigned long page = *pte & PTE_ADDR_MASK;
+  // The zero page is shared already
+  if (counted_page(page) == 0 || counted_page(kpage) == 0) {
+    return 0;
+  }
+  pte_cont_unfold(&task->mm, pte, va);
+  if (!(*pte & MM_AP_RDONLY)) {
+    *pte |= MM_AP_RDONLY | PTE_COW;
+    flush_tlb_page_mm(&task->mm, va);
+  }
+  if (page == kpage) {
+    return 1;
+  }
+  if (memcmp_pages(page, kpage) != 0) {
+    // The next write takes the page back, as it is still the only copy
+    return 0;
+  }
+
+  preempt_disable();
+  unsigned long entry = *pte;
+  *pte = 0;
+  flush_tlb_page_mm(&task->mm, va);
+  *pte = kpage | (entry & ~PTE_ADDR_MASK);
+  dsb_ishst();
+  get_page(kpage);
+  page_add_mapping(kpage);
+  page_remove_mapping(page);
+  put_page(page);
+  preempt_enable();
+  return 1;
+}
+
+// Move the private user page mapped at va into new_page, a page allocated
+// for it, and free the old one. Returns 1 when moved, 0 when the page is
+// shared or not a counted user page, in which case new_page is untouched.
+int migrate_page(struct task_struct *task, unsigned long va,
+                 unsigned long new_page) {
+  unsigned long *pte = pte_lookup(task, va);
+  if (pte == 0 || !pte_user_page(*pte)) {
+    return 0;
+  }
+  unsigned long page = *pte & PTE_ADDR_MASK;
+  struct page *meta = counted_page(page);
+  // Other mappings would need finding; merged pages belong to their tree
+  if (meta == 0 || meta->refcount != 1 || meta->mapcount != 1 ||
+      (meta->flags & (PG_KERNEL | PG_PAGETABLE | PG_KSM))) {
+    return 0;
+  }
+
+  preempt_disable();
+  pte_cont_unfold(&task->mm, pte, va);
+  unsigned long entry = *pte;
+  // No store through the old translation may land after the copy is taken
+  *pte = 0;
+  flush_tlb_page_mm(&task->mm, va);
+  memcpy(new_page + VA_START, page + VA_START, PAGE_SIZE);
+  // User pages hold code as well as data
+  flush_icache_range(new_page + VA_START, PAGE_SIZE);
+  *pte = new_page | (entry & ~PTE_ADDR_MASK);
+  dsb_ishst();
+  page_add_mapping(new_page);
+  phys_to_page(new_page)->flags |= meta->flags & PG_YOUNG;
+  page_remove_mapping(page);
+  put_page(page);
+  preempt_enable();
+  return 1;
+}
+
+// Swap out the private anonymous page mapped at va: compress it into the
+// swap store, leave a swap entry in its place and free it. Returns 1 when
+// the page went, 0 when it is shared, executable, not anonymous memory or
+// does not compress, and -1 when the store had no free slot for it.
+int swap_out_page(struct task_struct *task, unsigned long va) {
+  struct vm_area_struct *vma = find_vma(&task->mm, va);
+  unsigned long *pte = pte_lookup(task, va);
+  // Instruction aborts are not routed to do_mem_abort, so executable pages
+  // could never be faulted back in
+  if (!vma || (vma->vm_flags & (VM_ANON | VM_EXEC)) != VM_ANON || pte == 0 ||
+      !pte_user_page(*pte)) {
+    return 0;
+  }
+  unsigned long page = *pte & PTE_ADDR_MASK;
+  struct page *meta = counted_page(page);
+  // Pages shared by fork would need every mapping found; they are left be
+  if (meta == 0 || meta->refcount != 1 || meta->mapcount != 1) {
+    return 0;
+  }
+
+  preempt_disable();
+  pte_cont_unfold(&task->mm, pte, va);
+  unsigned long entry = *pte;
+  // No store through the old translation may land after the copy is taken
+  *pte = 0;
+  flush_tlb_page_mm(&task->mm, va);
+  if (swap_compress(page) < 0) {
+    *pte = entry;
+    dsb_ishst();
+    preempt_enable();
     return 0;
   }
+  page_remove_mapping(page);
+  // The store takes the page from here, growing into it if it must
+  unsigned long slot = swap_commit(page);
+  if (slot == 0) {
+    // No free slot. The page is still ours and still holds the data.
+    *pte = entry;
+    page_add_mapping(page);
+    dsb_ishst();
+    preempt_enable();
+    return -1;
+  }
+  *pte = swp_entry(slot);
+  dsb_ishst();
+  task->mm.rss--;
+  task->mm.nr_swap++;
+  preempt_enable();
+  return 1;
+}
+
+/*
+ * Access flag tracking. The A53 does not set the access flag in hardware,
+ * so every entry is made with it set. Clearing it makes the next access
+ * through the entry take an access flag fault, which marks the page young
+ * and sets the flag again. Entries under the contiguous hint are cleared and
+ * set a whole group at a time, so the group always agrees.
+ */
+
+// Whether the page, contiguous run or block mapped at va has been accessed
+// since the last call, clearing the access flag so that the next access
+// tells. Returns 1 if it was, 0 if not and -1 if no counted user page is
+// mapped there. *size is the memory the answer covers; va must be aligned
+// to it for the answer to cover va's whole run or block.
+int test_and_clear_young(struct task_struct *task, unsigned long va,
+                         unsigned long *size) {
+  struct vm_area_struct *vma = find_vma(&task->mm, va);
+  unsigned long *entry = leaf_lookup(task, va, size);
+  // Instruction aborts are not routed to do_mem_abort, so executable
+  // mappings must keep the flag
+  if (!vma || (vma->vm_flags & VM_EXEC) || entry == 0 ||
+      !pte_user_page(*entry) || counted_page(*entry & PTE_ADDR_MASK) == 0) {
+    *size = PAGE_SIZE;
+    return -1;
+  }
+  unsigned long n = 1;
+  if (*size == PAGE_SIZE && (*entry & PTE_CONT)) {
+    entry = cont_group(entry);
+    n = CONT_PTES;
+    *size = CONT_PTE_SIZE;
+  }
+  int young = 0;
+  preempt_disable();
+  for (unsigned long i = 0; i < n; i++) {
+    if (entry[i] & MM_ACCESS) {
+      young = 1;
+    }
+    struct page *page = counted_page(entry[i] & PTE_ADDR_MASK);
+    if (page && (page->flags & PG_YOUNG)) {
+      page->flags &= ~PG_YOUNG;
+      young = 1;
+    }
+  }
+  // Entries without the flag are never held in the TLB, so only a young
+  // one needs flushing
+  if (young) {
+    for (unsigned long i = 0; i < n; i++) {
+      entry[i] &= ~MM_ACCESS;
+    }
+    unsigned long start = va & ~(*size - 1);
+    if (n > 1) {
+      flush_tlb_range(&task->mm, start, start + *size);
+    } else {
+      flush_tlb_page_mm(&task->mm, start);
+    }
+  }
+  preempt_enable();
+  return young;
+}
+
+// An access flag fault at addr: mark the page young and set the flag back
+int handle_access_fault(struct task_struct *task, unsigned long addr) {
+  unsigned long size;
+  unsigned long *entry = leaf_lookup(task, addr & PAGE_MASK, &size);
+  if (entry == 0 || !pte_user_page(*entry)) {
+    return -1;
+  }
+  unsigned long n = 1;
+  if (size == PAGE_SIZE && (*entry & PTE_CONT)) {
+    entry = cont_group(entry);
+    n = CONT_PTES;
+  }
+  preempt_disable();
+  for (unsigned long i = 0; i < n; i++) {
+    entry[i] |= MM_ACCESS;
+  }
+  dsb_ishst();
+  struct page *page = counted_page(*entry & PTE_ADDR_MASK);
+  if (page) {
+    page->flags |= PG_YOUNG;
+  }
+  preempt_enable();
+  task->mm.min_flt++;
+  return 0;
+}
+
+// Bring the page named by the swap entry at pte back into a fresh page.
+// The slot is freed with its last swap entry.
+static int do_swap_fault(struct task_struct *task,
+                         struct vm_area_struct *vma, unsigned long *pte) {
+  unsigned long page = get_free_page_nozero();
+  if (page == 0) {
+    return -1;
+  }
+  unsigned long slot = swp_slot(*pte);
+  if (swap_load(slot, page) < 0) {
+    free_page(page);
+    return -1;
+  }
+  // User pages hold code as well as data
+  flush_icache_range(page + VA_START, PAGE_SIZE);
+  *pte = page | vma_pte_flags(vma);
+  dsb_ishst();
+  page_add_mapping(page);
+  task->mm.rss++;
+  task->mm.nr_swap--;
+  swap_free(slot);
+  return 0;
+}
+
+static int __handle_mm_fault(struct task_struct *task, unsigned long addr,
+                             int write) {
+  struct vm_area_struct *vma = find_vma(&task->mm, addr);
+  if (!vma || !(vma->vm_flags & (write ? VM_WRITE : VM_READ))) {
+    return -1;
+  }
+  unsigned long va = addr & PAGE_MASK;
+  unsigned long *pmd = pmd_lookup(task, va);
+  if (pmd && pmd_block(*pmd)) {
+    if (write && (*pmd & PTE_COW)) {
+      return do_huge_cow_fault(task, va, pmd);
+    }
+    if (pte_user_page(*pmd) && !(write && (*pmd & MM_AP_RDONLY))) {
+      flush_tlb_page_mm(&task->mm, va);
+      return 0;
+    }
+    return -1;
+  }
+  unsigned long *pte = pte_lookup(task, va);
+  if (pte && (*pte & PTE_VALID)) {
+    if (write && (*pte & PTE_COW)) {
+      return do_cow_fault(task, va, pte);
+    }
+    // Already accessible, so the fault came from a stale TLB entry
+    if (pte_user_page(*pte) && !(write && (*pte & MM_AP_RDONLY))) {
+      flush_tlb_page_mm(&task->mm, va);
+      return 0;
+    }
+    return -1;
+  }
+  // Only anonymous memory is filled on demand; the shared user text is
+  // mapped up front
+  if (!(vma->vm_flags & VM_ANON)) {
+    return -1;
+  }
+  if (pte && is_swap_pte(*pte)) {
+    return do_swap_fault(task, vma, pte);
+  }
+  return do_anonymous_fault(task, vma, va, write);
+}
+
+int handle_mm_fault(struct task_struct *task, unsigned long addr, int write) {
+  int ret = __handle_mm_fault(task, addr, write);
+  if (ret == 0) {
+    task->mm.min_flt++;
+  }
+  return ret;
+}
+
+// The kernel alias of the user address va, faulted in for a load or store
+// the way the task's own would be, and the bytes from it to the end of its
+// page or block in *left. Called with preemption disabled, which keeps the
+// page from being swapped out or migrated until the caller is done with it.
+// Returns 0 if the access would fault.
+static unsigned long user_alias(unsigned long va, int write,
+                                unsigned long *left) {
+  unsigned long size;
+  unsigned long *entry = leaf_lookup(current, va, &size);
+  if (entry == 0 || !pte_user_page(*entry) ||
+      (write && (*entry & MM_AP_RDONLY))) {
+    if (handle_mm_fault(current, va, write) < 0) {
+      return 0;
+    }
+    entry = leaf_lookup(current, va, &size);
+    if (entry == 0 || !pte_user_page(*entry) ||
+        (write && (*entry & MM_AP_RDONLY))) {
+      return 0;
+    }
+  }
+  unsigned long offset = va & (size - 1);
+  *left = size - offset;
+  return (*entry & PTE_ADDR_MASK) + VA_START + offset;
+}
+
+// Kernel stores to user memory go through here rather than the user VA, so
+// they fault pages in and resolve copy-on-write instead of faulting at EL1.
+int copy_to_user(unsigned long dst, const void *src, unsigned long n) {
+  unsigned long from = (unsigned long)src;
+  while (n > 0) {
+    unsigned long chunk;
+    preempt_disable();
+    unsigned long to = user_alias(dst, 1, &chunk);
+    if (to == 0) {
+      preempt_enable();
+      return -1;
+    }
+    if (chunk > n) {
+      chunk = n;
+    }
+    memcpy(to, from, chunk);
+    preempt_enable();
+    dst += chunk;
+    from += chunk;
+    n -= chunk;
+  }
+  return 0;
+}
+
+// Kernel loads from user memory, for the same reason: the page may be
+// swapped out, or its access flag cleared, under the task.
+int copy_from_user(void *dst, unsigned long src, unsigned long n) {
+  unsigned long to = (unsigned long)dst;
+  while (n > 0) {
+    unsigned long chunk;
+    preempt_disable();
+    unsigned long from = user_alias(src, 0, &chunk);
+    if (from == 0) {
+      preempt_enable();
+      return -1;
+    }
+    if (chunk > n) {
+      chunk = n;
+    }
+    memcpy(to, from, chunk);
+    preempt_enable();
+    src += chunk;
+    to += chunk;
+    n -= chunk;
+  }
+  return 0;
+}
+
+// Copy the string at the user address src into dst, up to n bytes. Returns
+// its length, n if it did not end within n bytes (dst is then not
+// terminated), or -1 if reading it faults.
+long strncpy_from_user(char *dst, unsigned long src, long n) {
+  long len = 0;
+  while (len < n) {
+    unsigned long chunk;
+    preempt_disable();
+    const char *from = (const char *)user_alias(src + len, 0, &chunk);
+    if (from == 0) {
+      preempt_enable();
+      return -1;
+    }
+    for (; chunk > 0 && len < n; chunk--, len++) {
+      dst[len] = *from++;
+      if (dst[len] == 0) {
+        preempt_enable();
+        return len;
+      }
+    }
+    preempt_enable();
+  }
+  return len;
+}
+
+int do_mem_abort(unsigned long addr, unsigned long esr) {
+  unsigned long fsc = (esr & 0x3f); // Fault Status Code is bits 5:0
+
+  // Check if this is a translation fault (FSC = 0x04 for level 0, 0x05 for
+  // level 1, etc.) or a permission fault (FSC = 0x0c for level 0, 0x0d for
+  // level 1, etc.) Both are resolved against the task's VMAs: missing pages
+  // are faulted in and writes to pages shared by fork are copied.
+  unsigned long fsc_type = fsc & 0x3c; // bits 5:2 indicate fault type
+
+  if (fsc_type == 0x04 || fsc_type == 0x0c) { // Translation or permission fault
+    return handle_mm_fault(current, addr, (esr & ESR_ELx_WNR) != 0);
+  }
+  if (fsc_type == 0x08) { // Access flag fault, see test_and_clear_young
+    return handle_access_fault(current, addr);
+  }
   return -1;
 }
@@ -0,0 +1,61 @@
+#include "mm_walk.h"
+#include "arm/mmu.h"
+#include "mm.h"
+#include "vma.h"
+
+// Visit task from walk->addr until the budget runs out. Returns 1 once every
+// VMA has been looked at.
+static int walk_mm(struct mm_walk *walk, struct task_struct *task) {
+  struct mm_struct *mm = &task->mm;
+  for (struct vm_area_struct *vma = vma_first(mm); vma;
+       vma = vma_next(mm, vma)) {
+    if (vma->vm_end <= walk->addr || !(vma->vm_flags & VM_ANON)) {
+      continue;
+    }
+    unsigned long addr = (vma->vm_start + walk->step - 1) & ~(walk->step - 1);
+    if (addr < walk->addr) {
+      addr = walk->addr;
+    }
+    while (addr + walk->step <= vma->vm_end) {
+      if (walk->budget == 0) {
+        walk->addr = addr;
+        return 0;
+      }
+      // Skip 2 MiB ranges with nothing mapped
+      unsigned long *pmd = pmd_lookup(task, addr);
+      if (pmd == 0 || !(*pmd & PTE_VALID)) {
+        addr = (addr + SECTION_SIZE) & ~((unsigned long)SECTION_SIZE - 1);
+        continue;
+      }
+      walk->budget--;
+      addr = walk->entry(walk, task, addr);
+    }
+  }
+  return 1;
+}
+
+// Go on with walk from where it stopped, until its budget runs out. Returns
+// 1, with the walk back at the start, once it has wrapped around every
+// address space. Called with preemption disabled.
+int walk_mms(struct mm_walk *walk) {
+  while (walk->budget > 0) {
+    struct task_struct *task = next_mm_task(walk->pid);
+    if (!task) {
+      walk->pid = 0;
+      walk->addr = 0;
+      return 1;
+    }
+    if (task->pid != walk->pid) {
+      walk->pid = task->pid;
+      walk->addr = 0;
+    }
+    if (walk_mm(walk, task)) {
+      if (walk->mm_done) {
+        walk->mm_done(walk, task);
+      }
+      walk->pid++;
+      walk->addr = 0;
+    }
+  }
+  return 0;
+}
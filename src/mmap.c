@@ -0,0 +1,99 @@
+#include "mmap.h"
+#include "mm.h"
+#include "vma.h"
+
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & PAGE_MASK)
+
+// First align-aligned gap of len bytes at or above MMAP_BASE, or 0
+static unsigned long get_unmapped_area(struct mm_struct *mm, unsigned long len,
+                                       unsigned long align) {
+  unsigned long addr = MMAP_BASE;
+  for (struct vm_area_struct *vma = vma_first(mm); vma;
+       vma = vma_next(mm, vma)) {
+    if (vma->vm_end <= addr) {
+      continue;
+    }
+    if (vma->vm_start >= addr + len) {
+      break;
+    }
+    addr = (vma->vm_end + align - 1) & ~(align - 1);
+  }
+  return addr + len <= MMAP_END ? addr : 0;
+}
+
+static int range_ok(unsigned long addr, unsigned long len) {
+  return addr >= PAGE_SIZE && addr + len > addr && addr + len <= MMAP_END;
+}
+
+unsigned long do_mmap(struct task_struct *task, unsigned long addr,
+                      unsigned long len, unsigned long prot,
+                      unsigned long flags) {
+  // No PROT_EXEC: instruction aborts from EL0 are not routed to the fault
+  // handler, so a lazily populated executable page could never come in
+  if (len == 0 || !(flags & MAP_ANONYMOUS) ||
+      (prot & ~(PROT_READ | PROT_WRITE))) {
+    return MAP_FAILED;
+  }
+  len = PAGE_ALIGN(len);
+  if (len == 0) {
+    return MAP_FAILED;
+  }
+  unsigned long vm_flags = prot | VM_ANON;
+  unsigned long align = PAGE_SIZE;
+  if (flags & MAP_HUGETLB) {
+    vm_flags |= VM_HUGEPAGE;
+    align = SECTION_SIZE;
+  }
+  struct mm_struct *mm = &task->mm;
+  if (flags & MAP_FIXED) {
+    if ((addr & ~PAGE_MASK) || !range_ok(addr, len)) {
+      return MAP_FAILED;
+    }
+    if (do_munmap(task, addr, len) < 0) {
+      return MAP_FAILED;
+    }
+  } else {
+    // Take the hint if the range is free, otherwise search
+    addr &= PAGE_MASK;
+    if (!range_ok(addr, len) || find_vma_intersection(mm, addr, addr + len)) {
+      addr = get_unmapped_area(mm, len, align);
+      if (addr == 0) {
+        return MAP_FAILED;
+      }
+    }
+  }
+  if (insert_vma(mm, addr, addr + len, vm_flags) < 0) {
+    return MAP_FAILED;
+  }
+  return addr;
+}
+
+int do_munmap(struct task_struct *task, unsigned long addr, unsigned long len) {
+  if ((addr & ~PAGE_MASK) || len == 0) {
+    return -1;
+  }
+  unsigned long end = addr + PAGE_ALIGN(len);
+  if (end <= addr) {
+    return -1;
+  }
+  struct mm_struct *mm = &task->mm;
+  struct vm_area_struct *vma;
+  while ((vma = find_vma_intersection(mm, addr, end))) {
+    // Trim the VMA to the range, then drop it and whatever it had mapped
+    if (vma->vm_start < addr) {
+      if (split_vma(mm, vma, addr) < 0) {
+        return -1;
+      }
+      continue;
+    }
+    if (vma->vm_end > end && split_vma(mm, vma, end) < 0) {
+      return -1;
+    }
+    if (unmap_range(task, vma->vm_start,
+                    (vma->vm_end - vma->vm_start) >> PAGE_SHIFT) < 0) {
+      return -1;
+    }
+    remove_vma(mm, vma);
+  }
+  return 0;
+}
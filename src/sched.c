@@ -1,7 +1,9 @@
 #include "sched.h"
+#include "asid.h"
 #include "fork.h"
 #include "irq.h"
 #include "mm.h"
+#include "timer.h"
 #include "utils.h"
 
 static struct task_struct init_task = INIT_TASK;
@@ -48,10 +50,20 @@ void switch_to(struct task_struct *next) {
   }
   struct task_struct *prev = current;
   current = next;
-  set_pgd(next->mm.pgd);
+  switch_active_mm(prev, next);
   cpu_switch_to(prev, next);
 }
 
+// Kernel threads never touch user memory, so they keep running on whatever
+// address space was live and user -> kthread -> same user leaves TTBR0 alone
+void switch_active_mm(struct task_struct *prev, struct task_struct *next) {
+  struct mm_struct *mm = next->mm.pgd ? &next->mm : prev->active_mm;
+  next->active_mm = mm;
+  if (mm != prev->active_mm) {
+    switch_mm(mm);
+  }
+}
+
 void schedule_tail(void) { preempt_enable(); }
 
 void timer_tick(void) {
@@ -67,10 +79,111 @@ void timer_tick(void) {
   disable_irq();
 }
 
-void exit_process() {
+// The live task with a user address space and the lowest pid >= pid, for
+// scanners that walk every address space in pid order
+struct task_struct *next_mm_task(long pid) {
+  struct task_struct *found = 0;
+  for (struct task_struct *p = initial_task; p; p = p->next_task) {
+    if (p->pid >= pid && p->mm.pgd && p->state != TASK_ZOMBIE &&
+        (!found || p->pid < found->pid)) {
+      found = p;
+    }
+  }
+  return found;
+}
+
+// Body of a background scanner thread: call fn every *period_us, read afresh
+// each time so it can be tuned, and yield the CPU in between
+void kthread_poll(const unsigned long *period_us, void (*fn)(void)) {
+  unsigned long last = time_since_boot();
+  while (1) {
+    unsigned long now = time_since_boot();
+    if (now - last >= *period_us) {
+      fn();
+      last = now;
+    }
+    schedule();
+  }
+}
+
+// Unlink a reaped zombie and free its PID and task/stack page
+static void release_task(struct task_struct *task) {
+  struct task_struct *p = initial_task;
+  while (p->next_task && p->next_task != task) {
+    p = p->next_task;
+  }
+  if (p->next_task == task) {
+    p->next_task = task->next_task;
+  }
+  free_pid(task->pid);
+  free_page((unsigned long)task - VA_START);
+}
+
+void do_exit(long code) {
   preempt_disable();
-  current->state = TASK_ZOMBIE;
-  free_pid(current->pid);
+  struct task_struct *task = current;
+  if (task->mm.pgd) {
+    // Stop walking the tables before handing them back
+    switch_mm(0);
+    task->active_mm = 0;
+    exit_mm(task);
+  }
+  // Orphans are adopted by init, which reaps them from the idle loop
+  for (struct task_struct *p = initial_task; p; p = p->next_task) {
+    if (p->parent == task) {
+      p->parent = initial_task;
+    }
+  }
+  task->exit_code = code;
+  task->state = TASK_ZOMBIE;
+  if (task->parent && task->parent->state == TASK_WAITING) {
+    task->parent->state = TASK_RUNNING;
+  }
   preempt_enable();
   schedule();
 }
+
+void exit_process() { do_exit(0); }
+
+long do_wait(long *exit_code) {
+  while (1) {
+    preempt_disable();
+    int children = 0;
+    for (struct task_struct *p = initial_task; p; p = p->next_task) {
+      if (p->parent != current) {
+        continue;
+      }
+      children++;
+      if (p->state == TASK_ZOMBIE) {
+        long pid = p->pid;
+        if (exit_code) {
+          *exit_code = p->exit_code;
+        }
+        release_task(p);
+        preempt_enable();
+        return pid;
+      }
+    }
+    if (children == 0) {
+      preempt_enable();
+      return -1;
+    }
+    // The exiting child sets us running again
+    current->state = TASK_WAITING;
+    preempt_enable();
+    schedule();
+  }
+}
+
+void reap_zombies(void) {
+  preempt_disable();
+  struct task_struct *p = initial_task;
+  while (p) {
+    struct task_struct *next = p->next_task;
+    if (p->state == TASK_ZOMBIE && p->parent == initial_task) {
+      release_task(p);
+    }
+    p = next;
+  }
+  preempt_enable();
+}
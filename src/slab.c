@@ -0,0 +1,319 @@
+#include "slab.h"
+#include "mm.h"
+#include "printf.h"
+#include "sched.h"
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;
+  struct slab *prev;
+  void *freelist; // free objects, linked at cache->free_offset
+  unsigned long inuse;
+};
+
+#define SLAB_HEADER_SIZE sizeof(struct slab)
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+// Caches are themselves slab objects, allocated from cache_cache
+static struct kmem_cache cache_cache;
+static struct kmem_cache *kmalloc_caches[KMALLOC_CACHES];
+static struct kmem_cache *cache_list;
+
+static const char *kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-16",  "kmalloc-32",  "kmalloc-64",  "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"};
+
+static void slab_list_add(struct slab **list, struct slab *slab) {
+  slab->prev = 0;
+  slab->next = *list;
+  if (*list) {
+    (*list)->prev = slab;
+  }
+  *list = slab;
+}
+
+static void slab_list_del(struct slab **list, struct slab *slab) {
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    *list = slab->next;
+  }
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+}
+
+static void cache_setup(struct kmem_cache *cache, const char *name,
+                        unsigned long size, unsigned long align,
+                        void (*ctor)(void *)) {
+  if (align < sizeof(void *)) {
+    align = sizeof(void *);
+  }
+  cache->name = name;
+  if (size < sizeof(void *)) {
+    size = sizeof(void *);
+  }
+  // The free list link overwrites part of a free object, which would undo
+  // the constructor, so caches with a ctor keep the link past the object.
+  cache->free_offset = ctor ? ALIGN_UP(size, sizeof(void *)) : 0;
+  cache->object_size =
+      ALIGN_UP(ctor ? cache->free_offset + sizeof(void *) : size, align);
+  cache->first_object = ALIGN_UP(SLAB_HEADER_SIZE, align);
+  cache->objects_per_slab =
+      (PAGE_SIZE - cache->first_object) / cache->object_size;
+  cache->ctor = ctor;
+  cache->partial = 0;
+  cache->full = 0;
+  cache->empty = 0;
+  memzero((unsigned long)&cache->stats, sizeof(cache->stats));
+  cache->next = cache_list;
+  cache_list = cache;
+}
+
+// Carve page into constructed objects
+static struct slab *slab_carve(struct kmem_cache *cache, unsigned long page) {
+  phys_to_page(page)->flags = PG_KERNEL;
+  page += VA_START;
+  struct slab *slab = (struct slab *)page;
+  slab->cache = cache;
+  slab->inuse = 0;
+  slab->freelist = 0;
+  unsigned long obj = page + cache->first_object;
+  obj += (cache->objects_per_slab - 1) * cache->object_size;
+  // Thread the free list back to front so objects are handed out in order
+  for (unsigned long i = 0; i < cache->objects_per_slab; i++) {
+    if (cache->ctor) {
+      cache->ctor((void *)obj);
+    }
+    *(void **)(obj + cache->free_offset) = slab->freelist;
+    slab->freelist = (void *)obj;
+    obj -= cache->object_size;
+  }
+  cache->stats.slabs++;
+  cache->stats.objects_total += cache->objects_per_slab;
+  return slab;
+}
+
+// Slow path: carve a fresh page
+static struct slab *cache_grow(struct kmem_cache *cache) {
+  unsigned long page = get_free_page_nozero();
+  if (page == 0) {
+    return 0;
+  }
+  return slab_carve(cache, page);
+}
+
+static void cache_shrink_slab(struct kmem_cache *cache, struct slab *slab) {
+  cache->stats.slabs--;
+  cache->stats.objects_total -= cache->objects_per_slab;
+  free_page((unsigned long)slab - VA_START);
+}
+
+void kmem_cache_init(void) {
+  cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, 0);
+  for (int i = 0; i < KMALLOC_CACHES; i++) {
+    kmalloc_caches[i] = kmem_cache_create(
+        kmalloc_names[i], 1UL << (i + KMALLOC_MIN_SHIFT), 0, 0);
+  }
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align,
+                                     void (*ctor)(void *obj)) {
+  if (align & (align - 1)) {
+    return 0;
+  }
+  unsigned long footprint = size + (ctor ? sizeof(void *) : 0);
+  if (ALIGN_UP(SLAB_HEADER_SIZE, align ? align : 1) + footprint > PAGE_SIZE) {
+    return 0;
+  }
+  struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+  if (!cache) {
+    return 0;
+  }
+  preempt_disable();
+  cache_setup(cache, name, size, align, ctor);
+  preempt_enable();
+  return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache) {
+  if (!cache) {
+    return;
+  }
+  preempt_disable();
+  struct slab *lists[] = {cache->partial, cache->full, cache->empty};
+  for (int i = 0; i < 3; i++) {
+    struct slab *slab = lists[i];
+    while (slab) {
+      struct slab *next = slab->next;
+      cache_shrink_slab(cache, slab);
+      slab = next;
+    }
+  }
+  struct kmem_cache **link = &cache_list;
+  while (*link && *link != cache) {
+    link = &(*link)->next;
+  }
+  if (*link) {
+    *link = cache->next;
+  }
+  preempt_enable();
+  kmem_cache_free(&cache_cache, cache);
+}
+
+// Make page, which the caller holds the only reference to, the spare slab of
+// cache. For reclaim, which frees a page to make room for what it stores and
+// must not lose it to another allocation first. Returns -1, leaving the page
+// with the caller, if cache has a spare slab already.
+int kmem_cache_grow(struct kmem_cache *cache, unsigned long page) {
+  preempt_disable();
+  if (cache->empty) {
+    preempt_enable();
+    return -1;
+  }
+  struct slab *slab = slab_carve(cache, page);
+  slab->next = slab->prev = 0;
+  cache->empty = slab;
+  preempt_enable();
+  return 0;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+  preempt_disable();
+  struct slab *slab = cache->partial;
+  if (slab) {
+    cache->stats.hits++;
+  } else if (cache->empty) {
+    slab = cache->empty;
+    cache->empty = 0;
+    slab_list_add(&cache->partial, slab);
+    cache->stats.hits++;
+  } else {
+    slab = cache_grow(cache);
+    if (!slab) {
+      preempt_enable();
+      return 0;
+    }
+    slab_list_add(&cache->partial, slab);
+  }
+
+  void *obj = slab->freelist;
+  slab->freelist = *(void **)((unsigned long)obj + cache->free_offset);
+  slab->inuse++;
+  if (slab->inuse == cache->objects_per_slab) {
+    slab_list_del(&cache->partial, slab);
+    slab_list_add(&cache->full, slab);
+  }
+  cache->stats.objects_in_use++;
+  cache->stats.allocs++;
+  preempt_enable();
+  return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+  if (!obj) {
+    return;
+  }
+  struct slab *slab = (struct slab *)((unsigned long)obj & PAGE_MASK);
+  if (slab->cache != cache) {
+    return;
+  }
+  preempt_disable();
+  if (slab->inuse == cache->objects_per_slab) {
+    slab_list_del(&cache->full, slab);
+    slab_list_add(&cache->partial, slab);
+  }
+  *(void **)((unsigned long)obj + cache->free_offset) = slab->freelist;
+  slab->freelist = obj;
+  slab->inuse--;
+  if (slab->inuse == 0) {
+    // Keep one empty slab around to absorb alloc/free churn
+    slab_list_del(&cache->partial, slab);
+    if (cache->empty) {
+      cache_shrink_slab(cache, slab);
+    } else {
+      cache->empty = slab;
+      slab->next = slab->prev = 0;
+    }
+  }
+  cache->stats.objects_in_use--;
+  cache->stats.frees++;
+  preempt_enable();
+}
+
+void kmem_cache_get_stats(struct kmem_cache *cache,
+                          struct kmem_cache_stats *stats) {
+  preempt_disable();
+  *stats = cache->stats;
+  preempt_enable();
+}
+
+void kmem_cache_print_stats(void) {
+  printf("cache: inuse total slabs allocs frees hits\r\n");
+  for (struct kmem_cache *cache = cache_list; cache; cache = cache->next) {
+    struct kmem_cache_stats s;
+    kmem_cache_get_stats(cache, &s);
+    printf("%s: %lu %lu %lu %lu %lu %lu\r\n", cache->name, s.objects_in_use,
+           s.objects_total, s.slabs, s.allocs, s.frees, s.hits);
+  }
+}
+
+struct kmem_cache *kmalloc_cache(unsigned long size) {
+  if (size == 0 || size > KMALLOC_MAX_SIZE) {
+    return 0;
+  }
+  int index = 0;
+  while ((1UL << (index + KMALLOC_MIN_SHIFT)) < size) {
+    index++;
+  }
+  return kmalloc_caches[index];
+}
+
+static int size_to_order(unsigned long size) {
+  int order = 0;
+  while (order < MAX_ORDER && ((unsigned long)PAGE_SIZE << order) < size) {
+    order++;
+  }
+  return order;
+}
+
+void *kmalloc(unsigned long size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (size <= KMALLOC_MAX_SIZE) {
+    return kmem_cache_alloc(kmalloc_cache(size));
+  }
+  unsigned long page = alloc_pages(size_to_order(size));
+  if (page == 0) {
+    return 0;
+  }
+  phys_to_page(page)->flags |= PG_KERNEL;
+  return (void *)(page + VA_START);
+}
+
+void *kzalloc(unsigned long size) {
+  void *obj = kmalloc(size);
+  if (obj) {
+    memzero((unsigned long)obj, size);
+  }
+  return obj;
+}
+
+void kfree(void *obj) {
+  if (!obj) {
+    return;
+  }
+  unsigned long addr = (unsigned long)obj;
+  if ((addr & ~PAGE_MASK) == 0) {
+    // Page aligned, so it came straight from the page allocator
+    int order = page_alloc_order(addr - VA_START);
+    if (order >= 0) {
+      free_pages(addr - VA_START, order);
+    }
+    return;
+  }
+  struct slab *slab = (struct slab *)(addr & PAGE_MASK);
+  kmem_cache_free(slab->cache, obj);
+}
@@ -0,0 +1,285 @@
+#include "swap.h"
+#include "lz4.h"
+#include "mm_walk.h"
+#include "printf.h"
+#include "sched.h"
+#include "slab.h"
+#include "timer.h"
+#include "vmalloc.h"
+
+// One page held by the store. Free slots are linked through handle.
+struct swap_slot {
+  unsigned long handle; // compressed data, or the fill word when size is 0
+  unsigned short size;  // compressed bytes
+  unsigned short count; // swap entries naming the slot, 0 when free
+};
+
+static struct swap_slot *swap_map;
+static unsigned long swap_free_slot; // first free slot, 0 when full
+
+static const char *swap_cache_names[SWAP_CLASSES] = {
+    "swap-256",  "swap-512",  "swap-768",  "swap-1024",
+    "swap-1280", "swap-1536", "swap-1792", "swap-2048",
+    "swap-2304", "swap-2560", "swap-2816", "swap-3072"};
+static struct kmem_cache *swap_caches[SWAP_CLASSES];
+
+// The page swap_compress last took in, waiting for swap_commit. Reclaim
+// must not run while it is held, or it would overwrite it.
+static unsigned char pending[SWAP_MAX_COMPRESSED];
+static unsigned long pending_size; // 0 when same-filled
+static unsigned long pending_word;
+static int pending_held;
+
+static unsigned char lz4_workspace[LZ4_WORKSPACE_SIZE]
+    __attribute__((aligned(8)));
+
+static struct swap_stats stats;
+
+void swap_init(void) {
+  for (int i = 0; i < SWAP_CLASSES; i++) {
+    swap_caches[i] = kmem_cache_create(swap_cache_names[i],
+                                       (i + 1) * SWAP_CLASS_SIZE, 0, 0);
+    if (swap_caches[i] == 0) {
+      return;
+    }
+  }
+  // The slot table is only ever touched by the kernel, so it need not be
+  // physically contiguous
+  swap_map = vzalloc(SWAP_SLOTS * sizeof(struct swap_slot));
+  if (swap_map == 0) {
+    return;
+  }
+  for (unsigned long slot = SWAP_SLOTS - 1; slot > 0; slot--) {
+    swap_map[slot].handle = swap_free_slot;
+    swap_free_slot = slot;
+  }
+}
+
+static struct kmem_cache *swap_cache(unsigned long size) {
+  return swap_caches[(size - 1) / SWAP_CLASS_SIZE];
+}
+
+// Write a stored page back out: the fill word size 0 stands for, or the
+// size compressed bytes at handle
+static int swap_fill(unsigned long page, unsigned long handle,
+                     unsigned long size) {
+  unsigned long *words = (unsigned long *)(page + VA_START);
+  if (size == 0) {
+    for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+      words[i] = handle;
+    }
+    return 0;
+  }
+  int n = lz4_decompress((const unsigned char *)handle, size,
+                         (unsigned char *)words, PAGE_SIZE);
+  return n == PAGE_SIZE ? 0 : -1;
+}
+
+// Take in a copy of page for the next swap_commit. Returns -1 if the store
+// is full or the page does not compress well enough to be worth storing.
+int swap_compress(unsigned long page) {
+  if (swap_free_slot == 0) {
+    return -1;
+  }
+  unsigned long *words = (unsigned long *)(page + VA_START);
+  unsigned long i = 1;
+  while (i < PAGE_SIZE / sizeof(unsigned long) && words[i] == words[0]) {
+    i++;
+  }
+  if (i == PAGE_SIZE / sizeof(unsigned long)) {
+    pending_size = 0;
+    pending_word = words[0];
+    pending_held = 1;
+    return 0;
+  }
+  int size = lz4_compress((const unsigned char *)words, PAGE_SIZE, pending,
+                          SWAP_MAX_COMPRESSED, lz4_workspace);
+  if (size == 0) {
+    stats.incompressible++;
+    return -1;
+  }
+  pending_size = size;
+  pending_held = 1;
+  return 0;
+}
+
+// Store the page swap_compress took in, in a slot holding one reference,
+// and take page, the one it came from, off the caller's hands. If there is
+// no memory for the compressed copy, the store grows into page itself, so
+// that no other allocation gets to it first; otherwise page is put. Returns
+// the slot, or 0 with nothing stored and page left alone if there is no
+// free slot.
+unsigned long swap_commit(unsigned long page) {
+  preempt_disable();
+  unsigned long slot = swap_free_slot;
+  if (slot == 0) {
+    pending_held = 0;
+    preempt_enable();
+    return 0;
+  }
+  unsigned long handle = pending_word;
+  if (pending_size) {
+    struct kmem_cache *cache = swap_cache(pending_size);
+    void *data = kmem_cache_alloc(cache);
+    if (data == 0) {
+      // The cache had no spare slab, or the allocation would have used it
+      kmem_cache_grow(cache, page);
+      page = 0;
+      data = kmem_cache_alloc(cache);
+    }
+    memcpy((unsigned long)data, (unsigned long)pending, pending_size);
+    handle = (unsigned long)data;
+    stats.compr_bytes += pending_size;
+    stats.pool_bytes += cache->object_size;
+  } else {
+    stats.same_filled++;
+  }
+  swap_free_slot = swap_map[slot].handle;
+  swap_map[slot].handle = handle;
+  swap_map[slot].size = pending_size;
+  swap_map[slot].count = 1;
+  stats.stored++;
+  stats.swap_outs++;
+  pending_held = 0;
+  if (page) {
+    put_page(page);
+  }
+  preempt_enable();
+  return slot;
+}
+
+// Decompress the page in slot into page. The slot keeps its reference.
+int swap_load(unsigned long slot, unsigned long page) {
+  if (swap_map == 0 || slot == 0 || slot >= SWAP_SLOTS) {
+    return -1;
+  }
+  unsigned long start = time_since_boot();
+  preempt_disable();
+  struct swap_slot *s = &swap_map[slot];
+  int ret = s->count ? swap_fill(page, s->handle, s->size) : -1;
+  if (ret == 0) {
+    stats.swap_ins++;
+    stats.swap_in_time_us += time_since_boot() - start;
+  }
+  preempt_enable();
+  return ret;
+}
+
+void swap_dup(unsigned long slot) {
+  if (swap_map == 0 || slot == 0 || slot >= SWAP_SLOTS) {
+    return;
+  }
+  preempt_disable();
+  if (swap_map[slot].count) {
+    swap_map[slot].count++;
+  }
+  preempt_enable();
+}
+
+// Drop one reference to slot, freeing it with the last
+void swap_free(unsigned long slot) {
+  if (swap_map == 0 || slot == 0 || slot >= SWAP_SLOTS) {
+    return;
+  }
+  preempt_disable();
+  struct swap_slot *s = &swap_map[slot];
+  if (s->count == 0 || --s->count > 0) {
+    preempt_enable();
+    return;
+  }
+  if (s->size) {
+    struct kmem_cache *cache = swap_cache(s->size);
+    kmem_cache_free(cache, (void *)s->handle);
+    stats.compr_bytes -= s->size;
+    stats.pool_bytes -= cache->object_size;
+  } else {
+    stats.same_filled--;
+  }
+  stats.stored--;
+  s->size = 0;
+  s->handle = swap_free_slot;
+  swap_free_slot = slot;
+  preempt_enable();
+}
+
+/*
+ * Reclaim. A clock hand sweeps the anonymous memory of every address space
+ * in pid and address order. Pages accessed since it last passed have their
+ * access flag cleared and are left for the next sweep; the rest are swapped
+ * out, so the pages it takes are ones nobody has used for a whole turn.
+ */
+
+// Set while reclaiming, so the store's own allocations do not recurse
+static int reclaiming;
+// Pages still to free in this reclaim
+static unsigned long reclaim_left;
+
+static unsigned long reclaim_entry(struct mm_walk *walk,
+                                   struct task_struct *task,
+                                   unsigned long addr) {
+  // Blocks are left whole
+  unsigned long *pmd = pmd_lookup(task, addr);
+  if ((*pmd & MM_TYPE_MASK) != MM_TYPE_PAGE_TABLE) {
+    return (addr + SECTION_SIZE) & ~((unsigned long)SECTION_SIZE - 1);
+  }
+  stats.reclaim_scanned++;
+  // Second chance: what was used since the hand last passed stays
+  unsigned long size;
+  if (test_and_clear_young(task, addr, &size) > 0) {
+    return (addr & ~(size - 1)) + size;
+  }
+  if (swap_out_page(task, addr) > 0 && --reclaim_left == 0) {
+    walk->budget = 0;
+  }
+  return addr + PAGE_SIZE;
+}
+
+// Where the last reclaim stopped
+static struct mm_walk hand = {.step = PAGE_SIZE, .entry = reclaim_entry};
+
+// Swap out up to nr pages, looking at no more than SWAP_SCAN_PAGES entries
+// and resuming where the last call stopped. Returns the number freed.
+unsigned long try_to_free_pages(unsigned long nr) {
+  if (swap_map == 0 || reclaiming || pending_held || nr == 0) {
+    return 0;
+  }
+  unsigned long start = time_since_boot();
+  preempt_disable();
+  reclaiming = 1;
+  reclaim_left = nr;
+  hand.budget = SWAP_SCAN_PAGES;
+  // Past the end of every address space, go round once more: from the start
+  // of one turn to the end of the next, every page has had its second chance
+  if (walk_mms(&hand)) {
+    walk_mms(&hand);
+  }
+  unsigned long freed = nr - reclaim_left;
+  reclaiming = 0;
+  stats.reclaim_time_us += time_since_boot() - start;
+  preempt_enable();
+  return freed;
+}
+
+void swap_get_stats(struct swap_stats *out) {
+  preempt_disable();
+  *out = stats;
+  preempt_enable();
+}
+
+void swap_print_stats(void) {
+  struct swap_stats s;
+  swap_get_stats(&s);
+  // Memory the compressed pages would take, over what the store takes
+  unsigned long compressed = s.stored - s.same_filled;
+  unsigned long ratio =
+      s.pool_bytes ? compressed * PAGE_SIZE * 100 / s.pool_bytes : 0;
+  unsigned long swap_in_us = s.swap_ins ? s.swap_in_time_us / s.swap_ins : 0;
+  printf("swap: stored %lu same_filled %lu compressed %lu bytes in %lu "
+         "ratio %lu.%02lu\r\n",
+         s.stored, s.same_filled, s.compr_bytes, s.pool_bytes, ratio / 100,
+         ratio % 100);
+  printf("swap: out %lu in %lu avg %lu us incompressible %lu "
+         "reclaim scanned %lu time %lu us\r\n",
+         s.swap_outs, s.swap_ins, swap_in_us, s.incompressible,
+         s.reclaim_scanned, s.reclaim_time_us);
+}
@@ -1,13 +1,34 @@
 #include "sys.h"
 #include "fork.h"
+#include "mm.h"
+#include "mmap.h"
 #include "printf.h"
 #include "sched.h"
 
-void sys_write(char *buf) { printf("%s", buf); }
+#define WRITE_CHUNK 128
+
+// Printed a piece at a time, as read through strncpy_from_user: the buffer
+// may be swapped out, or have its access flag cleared, under the task
+void sys_write(char *buf) {
+  char chunk[WRITE_CHUNK];
+  unsigned long src = (unsigned long)buf;
+  while (1) {
+    long len = strncpy_from_user(chunk, src, sizeof(chunk) - 1);
+    if (len <= 0) {
+      return;
+    }
+    chunk[len] = 0;
+    printf("%s", chunk);
+    if (len < (long)sizeof(chunk) - 1) {
+      return;
+    }
+    src += len;
+  }
+}
 
 int sys_fork(void) { return copy_process(0, 0, 0, current->priority); }
 
-void sys_exit() { exit_process(); }
+void sys_exit(long code) { do_exit(code); }
 
 long sys_getpid() { return current->pid; }
 
@@ -17,5 +38,25 @@ void sys_priority(long priority) {
   }
 }
 
-void *const sys_call_table[__NR_syscalls] = {sys_write, sys_fork, sys_exit,
-                                             sys_getpid, sys_priority};
+long sys_wait(long *status) {
+  long code;
+  long pid = do_wait(&code);
+  if (pid >= 0 && status &&
+      copy_to_user((unsigned long)status, &code, sizeof(code)) < 0) {
+    return -1;
+  }
+  return pid;
+}
+
+unsigned long sys_mmap(unsigned long addr, unsigned long len,
+                       unsigned long prot, unsigned long flags) {
+  return do_mmap(current, addr, len, prot, flags);
+}
+
+int sys_munmap(unsigned long addr, unsigned long len) {
+  return do_munmap(current, addr, len);
+}
+
+void *const sys_call_table[__NR_syscalls] = {
+    sys_write,    sys_fork, sys_exit, sys_getpid,
+    sys_priority, sys_wait, sys_mmap, sys_munmap};
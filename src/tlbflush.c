@@ -0,0 +1,117 @@
+#include "tlbflush.h"
+#include "asid.h"
+#include "cache.h"
+#include "mm.h"
+#include "utils.h"
+
+// Invalidate [start, end) in mm's ASID, page by page or, past
+// TLB_FLUSH_MAX_PAGES, all of it
+static void tlb_invalidate(struct mm_struct *mm, unsigned long start,
+                           unsigned long end, int tables) {
+  unsigned long asid = asid_of(mm);
+  if (asid == 0 || start >= end) {
+    return;
+  }
+  if ((end - start) >> PAGE_SHIFT > TLB_FLUSH_MAX_PAGES) {
+    flush_tlb_asid(asid);
+    return;
+  }
+  dsb_ishst();
+  for (unsigned long va = start; va < end; va += PAGE_SIZE) {
+    unsigned long arg = (asid << 48) | (va >> PAGE_SHIFT);
+    if (tables) {
+      tlbi_vae1is(arg);
+    } else {
+      tlbi_vale1is(arg);
+    }
+  }
+  tlbi_sync();
+}
+
+void flush_tlb_page_mm(struct mm_struct *mm, unsigned long va) {
+  va &= PAGE_MASK;
+  tlb_invalidate(mm, va, va + PAGE_SIZE, 0);
+}
+
+void flush_tlb_range(struct mm_struct *mm, unsigned long start,
+                     unsigned long end) {
+  tlb_invalidate(mm, start & PAGE_MASK, (end + PAGE_SIZE - 1) & PAGE_MASK,
+                 0);
+}
+
+// Every page the PTE table under va mapped goes, along with the walks
+void flush_tlb_pgtable(struct mm_struct *mm, unsigned long va) {
+  va &= ~((unsigned long)SECTION_SIZE - 1);
+  tlb_invalidate(mm, va, va + SECTION_SIZE, 1);
+}
+
+// VA[55:12] in the low 44 bits of a TLBI argument
+#define TLBI_VA(va) (((va) >> PAGE_SHIFT) & ((1UL << 44) - 1))
+
+void flush_tlb_kernel_range(unsigned long start, unsigned long end) {
+  start &= PAGE_MASK;
+  end = (end + PAGE_SIZE - 1) & PAGE_MASK;
+  if (start >= end) {
+    return;
+  }
+  if ((end - start) >> PAGE_SHIFT > TLB_FLUSH_MAX_PAGES) {
+    flush_tlb_all();
+    return;
+  }
+  dsb_ishst();
+  for (unsigned long va = start; va < end; va += PAGE_SIZE) {
+    tlbi_vaale1is(TLBI_VA(va));
+  }
+  tlbi_sync();
+}
+
+void tlb_gather_init(struct tlb_gather *tlb, struct mm_struct *mm) {
+  tlb->mm = mm;
+  tlb->start = 0;
+  tlb->end = 0;
+  tlb->freed_tables = 0;
+  tlb->nr_pages = 0;
+}
+
+static void tlb_gather_va(struct tlb_gather *tlb, unsigned long va) {
+  va &= PAGE_MASK;
+  if (tlb->start == tlb->end) {
+    tlb->start = va;
+    tlb->end = va + PAGE_SIZE;
+    return;
+  }
+  if (va < tlb->start) {
+    tlb->start = va;
+  }
+  if (va + PAGE_SIZE > tlb->end) {
+    tlb->end = va + PAGE_SIZE;
+  }
+}
+
+// Queue the translation of va for invalidation and, unless it is 0, the
+// page it mapped for put_page after it
+void tlb_gather_page(struct tlb_gather *tlb, unsigned long va,
+                     unsigned long page) {
+  if (page && tlb->nr_pages == TLB_GATHER_PAGES) {
+    tlb_gather_flush(tlb);
+  }
+  tlb_gather_va(tlb, va);
+  if (page) {
+    tlb->pages[tlb->nr_pages++] = page;
+  }
+}
+
+// Queue va, whose table was just unlinked; the caller flushes before the
+// table page is reused
+void tlb_gather_table(struct tlb_gather *tlb, unsigned long va) {
+  tlb_gather_va(tlb, va);
+  tlb->freed_tables = 1;
+}
+
+void tlb_gather_flush(struct tlb_gather *tlb) {
+  tlb_invalidate(tlb->mm, tlb->start, tlb->end, tlb->freed_tables);
+  for (int i = 0; i < tlb->nr_pages; i++) {
+    put_page(tlb->pages[i]);
+  }
+  tlb_gather_init(tlb, tlb->mm);
+}
@@ -18,7 +18,7 @@ void user_process() {
   int pid = call_sys_fork();
   if (pid < 0) {
     call_sys_write("Error during fork\n\r");
-    call_sys_exit();
+    call_sys_exit(1);
     return;
   }
   if (pid == 0) {
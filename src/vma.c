@@ -0,0 +1,122 @@
+#include "vma.h"
+#include "arm/mmu.h"
+#include "mm.h"
+#include "slab.h"
+#include "utils.h"
+
+static struct kmem_cache *vma_cache;
+
+#define node_to_vma(node) container_of(node, struct vm_area_struct, vm_node)
+
+static int vma_cmp(const struct avl_node *a, const struct avl_node *b) {
+  unsigned long start_a = node_to_vma(a)->vm_start;
+  unsigned long start_b = node_to_vma(b)->vm_start;
+  return start_a < start_b ? -1 : start_a > start_b;
+}
+
+void vma_init(void) {
+  vma_cache =
+      kmem_cache_create("vm_area", sizeof(struct vm_area_struct), 0, 0);
+}
+
+struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long addr) {
+  return find_vma_intersection(mm, addr, addr + 1);
+}
+
+// VMAs are disjoint, so at most one path can lead to an overlapping one
+struct vm_area_struct *find_vma_intersection(struct mm_struct *mm,
+                                             unsigned long start,
+                                             unsigned long end) {
+  struct avl_node *node = mm->mmap;
+  while (node) {
+    struct vm_area_struct *vma = node_to_vma(node);
+    if (end <= vma->vm_start) {
+      node = node->left;
+    } else if (start >= vma->vm_end) {
+      node = node->right;
+    } else {
+      return vma;
+    }
+  }
+  return 0;
+}
+
+struct vm_area_struct *vma_first(struct mm_struct *mm) {
+  struct avl_node *node = avl_first(mm->mmap);
+  return node ? node_to_vma(node) : 0;
+}
+
+struct vm_area_struct *vma_next(struct mm_struct *mm,
+                                struct vm_area_struct *vma) {
+  struct avl_node *node = avl_next(mm->mmap, &vma->vm_node, vma_cmp);
+  return node ? node_to_vma(node) : 0;
+}
+
+int insert_vma(struct mm_struct *mm, unsigned long start, unsigned long end,
+               unsigned long flags) {
+  if (start >= end || (start & ~PAGE_MASK) || (end & ~PAGE_MASK)) {
+    return -1;
+  }
+  if (find_vma_intersection(mm, start, end)) {
+    return -1;
+  }
+  struct vm_area_struct *vma = kmem_cache_alloc(vma_cache);
+  if (!vma) {
+    return -1;
+  }
+  vma->vm_start = start;
+  vma->vm_end = end;
+  vma->vm_flags = flags;
+  avl_insert(&mm->mmap, &vma->vm_node, vma_cmp);
+  mm->map_count++;
+  return 0;
+}
+
+void remove_vma(struct mm_struct *mm, struct vm_area_struct *vma) {
+  avl_erase(&mm->mmap, &vma->vm_node, vma_cmp);
+  mm->map_count--;
+  kmem_cache_free(vma_cache, vma);
+}
+
+// Cut vma at addr: it keeps [vm_start, addr) and a new VMA with the same
+// flags covers [addr, vm_end). The tree order is unchanged by shrinking.
+int split_vma(struct mm_struct *mm, struct vm_area_struct *vma,
+              unsigned long addr) {
+  if (addr <= vma->vm_start || addr >= vma->vm_end || (addr & ~PAGE_MASK)) {
+    return -1;
+  }
+  unsigned long end = vma->vm_end;
+  vma->vm_end = addr;
+  if (insert_vma(mm, addr, end, vma->vm_flags) < 0) {
+    vma->vm_end = end;
+    return -1;
+  }
+  return 0;
+}
+
+int copy_vmas(struct mm_struct *dst, struct mm_struct *src) {
+  for (struct vm_area_struct *vma = vma_first(src); vma;
+       vma = vma_next(src, vma)) {
+    if (insert_vma(dst, vma->vm_start, vma->vm_end, vma->vm_flags) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void exit_vmas(struct mm_struct *mm) {
+  while (mm->mmap) {
+    remove_vma(mm, node_to_vma(mm->mmap));
+  }
+}
+
+unsigned long vma_pte_flags(struct vm_area_struct *vma) {
+  unsigned long flags = MMU_PTE_FLAGS;
+  if (!(vma->vm_flags & VM_WRITE)) {
+    flags |= MM_AP_RDONLY;
+  }
+  if (!(vma->vm_flags & VM_EXEC)) {
+    flags |= PTE_UXN;
+  }
+  return flags;
+}
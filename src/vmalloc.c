@@ -0,0 +1,181 @@
+#include "vmalloc.h"
+#include "arm/mmu.h"
+#include "cache.h"
+#include "mm.h"
+#include "sched.h"
+#include "slab.h"
+#include "tlbflush.h"
+
+static struct kmem_cache *vm_struct_cache;
+static struct vm_struct *vmlist;
+
+static const unsigned long table_shift[] = {PGD_SHIFT, PUD_SHIFT, PMD_SHIFT};
+
+void vmalloc_init(void) {
+  vm_struct_cache =
+      kmem_cache_create("vm_struct", sizeof(struct vm_struct), 0, 0);
+}
+
+int is_vmalloc_addr(unsigned long addr) {
+  return addr >= VMALLOC_START && addr < VMALLOC_END;
+}
+
+// Kernel VA of the TTBR1 PTE for addr. Missing tables are allocated when
+// alloc is set; otherwise, or when out of memory, 0 is returned.
+static unsigned long *vmalloc_pte(unsigned long addr, int alloc) {
+  unsigned long *table = &pg_dir;
+  for (int level = 0; level < 3; level++) {
+    unsigned long *entry =
+        table + ((addr >> table_shift[level]) & (PTRS_PER_TABLE - 1));
+    if (*entry == 0) {
+      unsigned long next = alloc ? get_free_page() : 0;
+      if (next == 0) {
+        return 0;
+      }
+      phys_to_page(next)->flags |= PG_PAGETABLE;
+      // The zeroed table must be visible to the walker before it is linked in
+      dsb_ishst();
+      *entry = next | MM_TYPE_PAGE_TABLE;
+    } else if ((*entry & MM_TYPE_MASK) != MM_TYPE_PAGE_TABLE) {
+      return 0;
+    }
+    table = (unsigned long *)((*entry & PTE_ADDR_MASK) + VA_START);
+  }
+  return table + ((addr >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1));
+}
+
+// Reserve size bytes and the guard page after them in the lowest gap of
+// the vmalloc region that fits
+static struct vm_struct *get_vm_area(unsigned long size) {
+  struct vm_struct *area = kmem_cache_alloc(vm_struct_cache);
+  if (area == 0) {
+    return 0;
+  }
+  preempt_disable();
+  unsigned long addr = VMALLOC_START;
+  struct vm_struct **link = &vmlist;
+  while (*link && addr + size + PAGE_SIZE > (*link)->addr) {
+    addr = (*link)->addr + (*link)->size + PAGE_SIZE;
+    link = &(*link)->next;
+  }
+  if (VMALLOC_END - addr < size + PAGE_SIZE) {
+    preempt_enable();
+    kmem_cache_free(vm_struct_cache, area);
+    return 0;
+  }
+  area->addr = addr;
+  area->size = size;
+  area->next = *link;
+  *link = area;
+  preempt_enable();
+  return area;
+}
+
+static void remove_vm_area(struct vm_struct *area) {
+  preempt_disable();
+  struct vm_struct **link = &vmlist;
+  while (*link != area) {
+    link = &(*link)->next;
+  }
+  *link = area->next;
+  preempt_enable();
+  kmem_cache_free(vm_struct_cache, area);
+}
+
+// Unmap the first size bytes of area and free the pages behind them once
+// no TLB holds them. The pages are chained through their struct page in
+// the meantime.
+static void unmap_vm_area(struct vm_struct *area, unsigned long size) {
+  unsigned int freed = PAGE_NONE;
+  unsigned long *pte = 0;
+  for (unsigned long off = 0; off < size; off += PAGE_SIZE) {
+    unsigned long addr = area->addr + off;
+    if (pte == 0 || (addr & (SECTION_SIZE - 1)) == 0) {
+      pte = vmalloc_pte(addr, 0);
+    } else {
+      pte++;
+    }
+    if (pte == 0 || !(*pte & PTE_VALID)) {
+      continue;
+    }
+    unsigned long page = *pte & PTE_ADDR_MASK;
+    *pte = 0;
+    phys_to_page(page)->next = freed;
+    freed = page >> PAGE_SHIFT;
+  }
+  flush_tlb_kernel_range(area->addr, area->addr + size);
+  while (freed != PAGE_NONE) {
+    unsigned long page = (unsigned long)freed << PAGE_SHIFT;
+    freed = mem_map[freed].next;
+    free_page(page);
+  }
+}
+
+void *vmalloc(unsigned long size) {
+  if (size == 0 || size > VMALLOC_END - VMALLOC_START) {
+    return 0;
+  }
+  size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+  struct vm_struct *area = get_vm_area(size);
+  if (area == 0) {
+    return 0;
+  }
+  // One walk per PTE table; the pages need not be contiguous
+  unsigned long *pte = 0;
+  for (unsigned long off = 0; off < size; off += PAGE_SIZE) {
+    unsigned long addr = area->addr + off;
+    if (pte == 0 || (addr & (SECTION_SIZE - 1)) == 0) {
+      pte = vmalloc_pte(addr, 1);
+    } else {
+      pte++;
+    }
+    unsigned long page = pte ? get_free_page_nozero() : 0;
+    if (page == 0) {
+      unmap_vm_area(area, off);
+      remove_vm_area(area);
+      return 0;
+    }
+    phys_to_page(page)->flags |= PG_KERNEL;
+    *pte = page | MMU_KERNEL_PTE_FLAGS;
+  }
+  // The entries were invalid, so there is nothing to invalidate
+  dsb_ishst_isb();
+  return (void *)area->addr;
+}
+
+void *vzalloc(unsigned long size) {
+  void *addr = vmalloc(size);
+  if (addr) {
+    memzero((unsigned long)addr, size);
+  }
+  return addr;
+}
+
+void vfree(void *addr) {
+  if (addr == 0) {
+    return;
+  }
+  preempt_disable();
+  struct vm_struct *area = vmlist;
+  while (area && area->addr != (unsigned long)addr) {
+    area = area->next;
+  }
+  preempt_enable();
+  if (area == 0) {
+    return;
+  }
+  unmap_vm_area(area, area->size);
+  remove_vm_area(area);
+}
+
+unsigned long vmalloc_to_phys(void *addr) {
+  unsigned long va = (unsigned long)addr;
+  if (!is_vmalloc_addr(va)) {
+    return 0;
+  }
+  unsigned long *pte = vmalloc_pte(va, 0);
+  if (pte == 0 || !(*pte & PTE_VALID)) {
+    return 0;
+  }
+  return (*pte & PTE_ADDR_MASK) | (va & ~PAGE_MASK);
+}
@@ -0,0 +1,88 @@
+#include "wss.h"
+#include "mm.h"
+#include "mm_walk.h"
+#include "printf.h"
+#include "sched.h"
+#include "timer.h"
+
+unsigned long wss_enabled;
+unsigned long wss_sleep_us = WSS_SLEEP_US;
+unsigned long wss_pages_to_scan = WSS_PAGES_TO_SCAN;
+
+static struct wss_stats stats;
+
+// When the pass in progress started
+static unsigned long pass_start;
+
+static unsigned long age_entry(struct mm_walk *walk __attribute__((unused)),
+                               struct task_struct *task, unsigned long addr) {
+  unsigned long size;
+  int young = test_and_clear_young(task, addr, &size);
+  if (young >= 0) {
+    stats.pages_scanned += size >> PAGE_SHIFT;
+  }
+  if (young > 0) {
+    stats.young += size >> PAGE_SHIFT;
+    task->mm.wss_young += size >> PAGE_SHIFT;
+  }
+  return (addr & ~(size - 1)) + size;
+}
+
+// The pages task touched between two passes are its working set
+static void age_done(struct mm_walk *walk __attribute__((unused)),
+                     struct task_struct *task) {
+  task->mm.wss = task->mm.wss_young;
+  task->mm.wss_young = 0;
+}
+
+// Where the last scan stopped
+static struct mm_walk hand = {
+    .step = PAGE_SIZE, .entry = age_entry, .mm_done = age_done};
+
+// Age up to pages entries, resuming where the last call stopped. Returns the
+// number of pages found accessed since the last pass.
+unsigned long wss_scan(unsigned long pages) {
+  unsigned long start = time_since_boot();
+  unsigned long young = stats.young;
+  preempt_disable();
+  if (hand.pid == 0 && hand.addr == 0) {
+    pass_start = start;
+  }
+  hand.budget = pages;
+  if (walk_mms(&hand)) {
+    stats.full_scans++;
+    stats.last_pass_us = time_since_boot() - pass_start;
+  }
+  preempt_enable();
+  stats.scan_time_us += time_since_boot() - start;
+  return stats.young - young;
+}
+
+static void wss_tick(void) {
+  if (wss_enabled) {
+    wss_scan(wss_pages_to_scan);
+  }
+}
+
+void wssd(void) { kthread_poll(&wss_sleep_us, wss_tick); }
+
+void wss_get_stats(struct wss_stats *out) {
+  preempt_disable();
+  *out = stats;
+  preempt_enable();
+}
+
+void wss_print_stats(void) {
+  struct wss_stats s;
+  wss_get_stats(&s);
+  printf("wss: full_scans %lu aged %lu young %lu pass %lu us "
+         "time %lu us\r\n",
+         s.full_scans, s.pages_scanned, s.young, s.last_pass_us,
+         s.scan_time_us);
+  preempt_disable();
+  for (struct task_struct *p = next_mm_task(0); p;
+       p = next_mm_task(p->pid + 1)) {
+    printf("wss: pid %ld rss %lu wss %lu\r\n", p->pid, p->mm.rss, p->mm.wss);
+  }
+  preempt_enable();
+}
@@ -0,0 +1,75 @@
+/*
+ * Task fixtures shared by the test suites, see fixtures.h
+ */
+
+#include "fixtures.h"
+#include "fork.h"
+#include "mm.h"
+#include "vma.h"
+
+struct task_struct *test_task(void) {
+  unsigned long page = allocate_kernel_page();
+  if (page == 0) {
+    return 0;
+  }
+  struct task_struct *task = (struct task_struct *)page;
+  memzero((unsigned long)&task->mm, sizeof(task->mm));
+  task->preempt_count = 1;
+  return task;
+}
+
+void test_task_free(struct task_struct *task) {
+  exit_mm(task);
+  free_page((unsigned long)task - VA_START);
+}
+
+struct task_struct *test_anon_task(unsigned long va, unsigned long pages,
+                                   unsigned long populate) {
+  struct task_struct *task = test_task();
+  if (task == 0) {
+    return 0;
+  }
+  if (insert_vma(&task->mm, va, va + pages * PAGE_SIZE,
+                 VM_READ | VM_WRITE | VM_ANON) < 0) {
+    test_task_free(task);
+    return 0;
+  }
+  for (unsigned long i = 0; i < populate; i++) {
+    if (allocate_user_page(task, va + i * PAGE_SIZE) == 0) {
+      test_task_free(task);
+      return 0;
+    }
+  }
+  return task;
+}
+
+int test_task_list(struct task_struct *task) {
+  long pid = alloc_pid();
+  if (pid < 0) {
+    return -1;
+  }
+  task->pid = pid;
+  task->state = TASK_WAITING;
+  task->next_task = 0;
+  preempt_disable();
+  struct task_struct *last = initial_task;
+  while (last->next_task) {
+    last = last->next_task;
+  }
+  last->next_task = task;
+  preempt_enable();
+  return 0;
+}
+
+void test_task_unlist(struct task_struct *task) {
+  preempt_disable();
+  struct task_struct *p = initial_task;
+  while (p->next_task && p->next_task != task) {
+    p = p->next_task;
+  }
+  if (p->next_task == task) {
+    p->next_task = task->next_task;
+  }
+  preempt_enable();
+  free_pid(task->pid);
+}
@@ -0,0 +1,28 @@
+#ifndef _TESTS_FIXTURES_H
+#define _TESTS_FIXTURES_H
+
+/*
+ * Task fixtures shared by the test suites: bare tasks on their own page,
+ * never run by the scheduler.
+ */
+
+#include "sched.h"
+
+/* A bare user task on its own page with an empty address space, like the
+ * ones copy_process builds */
+struct task_struct *test_task(void);
+void test_task_free(struct task_struct *task);
+
+/* A bare user task with an anonymous VMA of pages pages at va, the first
+ * populate of them faulted in. Returns 0, having freed everything, if any
+ * of it fails. */
+struct task_struct *test_anon_task(unsigned long va, unsigned long pages,
+                                   unsigned long populate);
+
+/* Put task on the task list under a new pid, waiting, so the background
+ * scanners see it but the scheduler never picks it. Returns -1 if no pid
+ * is free. */
+int test_task_list(struct task_struct *task);
+void test_task_unlist(struct task_struct *task);
+
+#endif /* _TESTS_FIXTURES_H */
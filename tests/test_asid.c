@@ -0,0 +1,189 @@
+/*
+ * ASID Tests
+ *
+ * Tests for:
+ * - Distinct, stable ASIDs per address space
+ * - Generation rollover keeping the live address space's ASID
+ * - User mappings being non-global
+ * - Context switch cost, full TLB flush vs ASID-tagged TTBR0
+ *
+ * The benchmark ping-pongs TTBR0 between two scratch address spaces that
+ * each map BENCH_PAGES pages, touching every page after each switch, and
+ * reports cycles and L1D TLB refills per switch for both strategies.
+ */
+
+#include "arm/mmu.h"
+#include "asid.h"
+#include "fixtures.h"
+#include "mm.h"
+#include "printf.h"
+#include "sched.h"
+#include "test.h"
+#include "utils.h"
+
+/* Forward declarations for test functions */
+static int test_asid_distinct(void);
+static int test_asid_stable(void);
+static int test_asid_rollover_keeps_active(void);
+static int test_asid_user_pte_not_global(void);
+static int test_asid_bench_context_switch(void);
+
+#define BENCH_VA 0x20000000UL
+#define BENCH_PAGES 32
+#define BENCH_ITERS 256
+#define BENCH_PMU_COUNTER 0
+
+/* Test: Address spaces get different, non-zero ASIDs */
+static int test_asid_distinct(void) {
+  struct mm_struct a = {0};
+  struct mm_struct b = {0};
+
+  unsigned long asid_a = asid_get(&a);
+  unsigned long asid_b = asid_get(&b);
+  TEST_ASSERT_NEQ(0, asid_a);
+  TEST_ASSERT_NEQ(0, asid_b);
+  TEST_ASSERT_NEQ(asid_a, asid_b);
+  TEST_ASSERT(asid_a < (1UL << asid_bits()));
+
+  return TEST_PASS;
+}
+
+/* Test: An address space keeps its ASID within a generation */
+static int test_asid_stable(void) {
+  struct mm_struct a = {0};
+
+  unsigned long asid = asid_get(&a);
+  unsigned long context_id = a.context_id;
+  TEST_ASSERT_EQ(asid, asid_get(&a));
+  TEST_ASSERT_EQ(context_id, a.context_id);
+
+  return TEST_PASS;
+}
+
+/* Test: Running out of ASIDs starts a generation without moving TTBR0 */
+static int test_asid_rollover_keeps_active(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, map_page(task, BENCH_VA, get_free_page()));
+
+  preempt_disable();
+  switch_mm(&task->mm);
+  unsigned long active = asid_get(&task->mm);
+
+  struct mm_struct other = {0};
+  unsigned long rollovers = asid_rollovers();
+  for (unsigned long i = 0; i < (1UL << asid_bits()); i++) {
+    other.context_id = 0;
+    asid_get(&other);
+  }
+  TEST_ASSERT_GT(asid_rollovers(), rollovers);
+
+  /* The live address space is carried into the new generation */
+  rollovers = asid_rollovers();
+  TEST_ASSERT_EQ(active, asid_get(&task->mm));
+  TEST_ASSERT_EQ(rollovers, asid_rollovers());
+  /* and nobody else is handed its ASID */
+  other.context_id = 0;
+  TEST_ASSERT_NEQ(active, asid_get(&other));
+
+  switch_mm(current->active_mm);
+  preempt_enable();
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: User pages are tagged with the ASID, not global */
+static int test_asid_user_pte_not_global(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, map_page(task, BENCH_VA, get_free_page()));
+  TEST_ASSERT_EQ(0, map_guard_page(task, BENCH_VA + PAGE_SIZE));
+
+  unsigned long *pte = pte_lookup(task, BENCH_VA);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_NEQ(0, *pte & MM_NG);
+  pte = pte_lookup(task, BENCH_VA + PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_NEQ(0, *pte & MM_NG);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Touch one word in every benchmark page through the current TTBR0 */
+static void bench_touch(void) {
+  for (unsigned long i = 0; i < BENCH_PAGES; i++) {
+    (*(volatile unsigned long *)(BENCH_VA + i * PAGE_SIZE))++;
+  }
+}
+
+/* Switch between a and b BENCH_ITERS times each way; returns cycles/switch */
+static unsigned long bench_switch(struct task_struct *a, struct task_struct *b,
+                                  int use_asid, unsigned long *refills) {
+  struct task_struct *tasks[2] = {a, b};
+  unsigned long refill_start = pmu_read_event_counter(BENCH_PMU_COUNTER);
+  unsigned long start = get_cycles();
+  for (int i = 0; i < 2 * BENCH_ITERS; i++) {
+    struct task_struct *next = tasks[i & 1];
+    if (use_asid) {
+      switch_mm(&next->mm);
+    } else {
+      set_pgd(next->mm.pgd); /* the old path: flush on every switch */
+    }
+    bench_touch();
+  }
+  unsigned long cycles = get_cycles() - start;
+  *refills = (pmu_read_event_counter(BENCH_PMU_COUNTER) - refill_start) /
+             (2 * BENCH_ITERS);
+  return cycles / (2 * BENCH_ITERS);
+}
+
+/* Benchmark: context switch with a full TLB flush vs with ASIDs */
+static int test_asid_bench_context_switch(void) {
+  struct task_struct *tasks[2];
+  for (int t = 0; t < 2; t++) {
+    tasks[t] = test_task();
+    TEST_ASSERT_NOT_NULL(tasks[t]);
+    for (unsigned long i = 0; i < BENCH_PAGES; i++) {
+      TEST_ASSERT_EQ(
+          0, map_page(tasks[t], BENCH_VA + i * PAGE_SIZE, get_free_page()));
+    }
+  }
+
+  pmu_enable_cycle_counter();
+  pmu_enable_event_counter(BENCH_PMU_COUNTER, PMU_EVENT_L1D_TLB_REFILL);
+  preempt_disable();
+
+  unsigned long flush_refills, asid_refills;
+  unsigned long flush_cycles =
+      bench_switch(tasks[0], tasks[1], 0, &flush_refills);
+  /* set_pgd left TTBR0 untagged; start the ASID run from a clean TLB */
+  flush_tlb_all();
+  unsigned long asid_cycles =
+      bench_switch(tasks[0], tasks[1], 1, &asid_refills);
+
+  switch_mm(current->active_mm);
+  preempt_enable();
+
+  printf("\r\n    switch+touch %d pages: flush %lu cycles %lu TLB refills, "
+         "ASID %lu cycles %lu TLB refills\r\n    ",
+         BENCH_PAGES, flush_cycles, flush_refills, asid_cycles, asid_refills);
+
+  for (int t = 0; t < 2; t++) {
+    test_task_free(tasks[t]);
+  }
+
+  return TEST_PASS;
+}
+
+/* Register all ASID tests */
+void register_asid_tests(void) {
+  TEST_REGISTER(asid, distinct);
+  TEST_REGISTER(asid, stable);
+  TEST_REGISTER(asid, rollover_keeps_active);
+  TEST_REGISTER(asid, user_pte_not_global);
+  TEST_REGISTER(asid, bench_context_switch);
+}
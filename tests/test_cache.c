@@ -0,0 +1,250 @@
+/*
+ * Cache Tests
+ *
+ * Tests for:
+ * - D-cache clean / invalidate by range
+ * - I-cache synchronisation after writing code
+ * - memcpy/memzero and context switch cost, uncached vs write-back
+ *
+ * The benchmarks map the same physical pages a second time through TTBR0
+ * with the Normal non-cacheable attribute, which is how every access was
+ * typed before the caches were turned on, and compare cycle counts against
+ * the write-back linear map.
+ */
+
+#include "arm/mmu.h"
+#include "asid.h"
+#include "cache.h"
+#include "fixtures.h"
+#include "mm.h"
+#include "printf.h"
+#include "sched.h"
+#include "test.h"
+#include "utils.h"
+
+/* Forward declarations for test functions */
+static int test_cache_clean_preserves_data(void);
+static int test_cache_clean_invalidate_preserves_data(void);
+static int test_cache_invalidate_partial_lines(void);
+static int test_cache_flush_icache_range(void);
+static int test_cache_bench_memcpy_memzero(void);
+static int test_cache_bench_context_switch(void);
+
+#define BENCH_VA 0x10000000UL
+#define BENCH_ITERS 64
+#define BENCH_SWITCH_ITERS 256
+
+static unsigned char cache_buffer[256];
+
+/* Test: Clean writes data back without losing it */
+static int test_cache_clean_preserves_data(void) {
+  for (int i = 0; i < 256; i++) {
+    cache_buffer[i] = (unsigned char)i;
+  }
+
+  dcache_clean_range((unsigned long)cache_buffer, sizeof(cache_buffer));
+
+  for (int i = 0; i < 256; i++) {
+    TEST_ASSERT_EQ((unsigned char)i, cache_buffer[i]);
+  }
+
+  return TEST_PASS;
+}
+
+/* Test: Clean + invalidate leaves memory holding the latest data */
+static int test_cache_clean_invalidate_preserves_data(void) {
+  for (int i = 0; i < 256; i++) {
+    cache_buffer[i] = (unsigned char)(255 - i);
+  }
+
+  dcache_clean_invalidate_range((unsigned long)cache_buffer,
+                                sizeof(cache_buffer));
+
+  for (int i = 0; i < 256; i++) {
+    TEST_ASSERT_EQ((unsigned char)(255 - i), cache_buffer[i]);
+  }
+
+  return TEST_PASS;
+}
+
+/* Test: Invalidating an unaligned range keeps bytes sharing its edge lines */
+static int test_cache_invalidate_partial_lines(void) {
+  for (int i = 0; i < 256; i++) {
+    cache_buffer[i] = 0x5A;
+  }
+
+  /* Clean the middle so invalidation cannot lose it, leave the edges dirty */
+  dcache_clean_range((unsigned long)&cache_buffer[64], 128);
+  dcache_invalidate_range((unsigned long)&cache_buffer[65], 126);
+
+  TEST_ASSERT_EQ(0x5A, cache_buffer[0]);
+  TEST_ASSERT_EQ(0x5A, cache_buffer[64]);
+  TEST_ASSERT_EQ(0x5A, cache_buffer[128]);
+  TEST_ASSERT_EQ(0x5A, cache_buffer[191]);
+  TEST_ASSERT_EQ(0x5A, cache_buffer[255]);
+
+  return TEST_PASS;
+}
+
+/* Test: Synchronising the I-cache over an arbitrary range returns */
+static int test_cache_flush_icache_range(void) {
+  flush_icache_range((unsigned long)cache_buffer + 3, 100);
+  flush_icache_range((unsigned long)cache_buffer, 0);
+  icache_invalidate_all();
+
+  return TEST_PASS;
+}
+
+/* Map phys at va in task's TTBR0 tables with the non-cacheable attribute */
+static int map_uncached_alias(struct task_struct *task, unsigned long va,
+                              unsigned long phys) {
+  if (map_page(task, va, phys) < 0) {
+    return -1;
+  }
+  unsigned long *pte = pte_lookup(task, va);
+  if (pte == 0) {
+    return -1;
+  }
+  *pte = (*pte & ~(PTE_ATTRINDX_MASK | MM_SH_INNER)) | (MT_NORMAL_NC << 2);
+  /* Drop write-back lines so the two aliases agree */
+  dcache_clean_invalidate_range(phys + VA_START, PAGE_SIZE);
+  return 0;
+}
+
+static unsigned long bench_memcpy(unsigned long dst, unsigned long src) {
+  unsigned long start = get_cycles();
+  for (int i = 0; i < BENCH_ITERS; i++) {
+    memcpy(dst, src, PAGE_SIZE);
+  }
+  return (get_cycles() - start) / BENCH_ITERS;
+}
+
+static unsigned long bench_memzero(unsigned long dst) {
+  unsigned long start = get_cycles();
+  for (int i = 0; i < BENCH_ITERS; i++) {
+    memzero(dst, PAGE_SIZE);
+  }
+  return (get_cycles() - start) / BENCH_ITERS;
+}
+
+static void bench_report(const char *what, unsigned long uncached,
+                         unsigned long cached) {
+  printf("\r\n    %s: uncached %lu cycles, write-back %lu cycles", what,
+         uncached, cached);
+}
+
+static struct task_struct *bench_prev;
+static struct task_struct *bench_next;
+
+/* Entered through cpu_switch_to; bounces straight back every time */
+static void bench_bounce(void) {
+  while (1) {
+    cpu_switch_to(bench_next, bench_prev);
+  }
+}
+
+/* Cycles per cpu_switch_to with both task structs and stacks at prev/next */
+static unsigned long bench_switch(unsigned long prev, unsigned long next) {
+  bench_prev = (struct task_struct *)prev;
+  bench_next = (struct task_struct *)next;
+  bench_next->cpu_context.pc = (unsigned long)bench_bounce;
+  bench_next->cpu_context.sp = next + THREAD_SIZE;
+
+  /* First switch enters bench_bounce, later ones resume inside it */
+  cpu_switch_to(bench_prev, bench_next);
+
+  unsigned long start = get_cycles();
+  for (int i = 0; i < BENCH_SWITCH_ITERS; i++) {
+    cpu_switch_to(bench_prev, bench_next);
+  }
+  return (get_cycles() - start) / (2 * BENCH_SWITCH_ITERS);
+}
+
+/* Set up a scratch task whose TTBR0 maps pages[] uncached at BENCH_VA */
+static struct task_struct *bench_task(unsigned long *pages, int count) {
+  struct task_struct *task = test_task();
+  if (task == 0) {
+    return 0;
+  }
+  for (int i = 0; i < count; i++) {
+    if (map_uncached_alias(task, BENCH_VA + i * PAGE_SIZE, pages[i]) < 0) {
+      test_task_free(task);
+      return 0;
+    }
+  }
+  return task;
+}
+
+/* Benchmark: page-sized memcpy/memzero through each memory type */
+static int test_cache_bench_memcpy_memzero(void) {
+  unsigned long pages[2];
+  for (int i = 0; i < 2; i++) {
+    pages[i] = get_free_page();
+    TEST_ASSERT_NEQ(0, pages[i]);
+  }
+  struct task_struct *task = bench_task(pages, 2);
+  TEST_ASSERT_NOT_NULL(task);
+
+  pmu_enable_cycle_counter();
+  preempt_disable();
+
+  switch_mm(&task->mm);
+  unsigned long nc_copy = bench_memcpy(BENCH_VA + PAGE_SIZE, BENCH_VA);
+  unsigned long nc_zero = bench_memzero(BENCH_VA + PAGE_SIZE);
+  switch_mm(current->active_mm);
+
+  unsigned long wb_copy =
+      bench_memcpy(pages[1] + VA_START, pages[0] + VA_START);
+  unsigned long wb_zero = bench_memzero(pages[1] + VA_START);
+
+  preempt_enable();
+
+  bench_report("memcpy 4K", nc_copy, wb_copy);
+  bench_report("memzero 4K", nc_zero, wb_zero);
+  printf("\r\n    ");
+
+  /* Drops the tables along with both mapped pages */
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Benchmark: cpu_switch_to with task state uncached vs write-back */
+static int test_cache_bench_context_switch(void) {
+  unsigned long pages[2];
+  for (int i = 0; i < 2; i++) {
+    pages[i] = get_free_page();
+    TEST_ASSERT_NEQ(0, pages[i]);
+  }
+  struct task_struct *task = bench_task(pages, 2);
+  TEST_ASSERT_NOT_NULL(task);
+
+  pmu_enable_cycle_counter();
+  preempt_disable();
+
+  switch_mm(&task->mm);
+  unsigned long nc = bench_switch(BENCH_VA, BENCH_VA + PAGE_SIZE);
+  switch_mm(current->active_mm);
+
+  unsigned long wb = bench_switch(pages[0] + VA_START, pages[1] + VA_START);
+
+  preempt_enable();
+
+  bench_report("cpu_switch_to", nc, wb);
+  printf("\r\n    ");
+
+  /* Drops the tables along with both mapped pages */
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Register all cache tests */
+void register_cache_tests(void) {
+  TEST_REGISTER(cache, clean_preserves_data);
+  TEST_REGISTER(cache, clean_invalidate_preserves_data);
+  TEST_REGISTER(cache, invalidate_partial_lines);
+  TEST_REGISTER(cache, flush_icache_range);
+  TEST_REGISTER(cache, bench_memcpy_memzero);
+  TEST_REGISTER(cache, bench_context_switch);
+}
@@ -0,0 +1,287 @@
+/*
+ * Memory Compaction Tests
+ *
+ * Tests for:
+ * - The fragmentation index
+ * - Allocating a given free page
+ * - Migrating a user page and its mapping
+ * - Compacting on demand and on a failed high-order allocation
+ */
+
+#include "arm/mmu.h"
+#include "compaction.h"
+#include "fixtures.h"
+#include "fork.h"
+#include "mm.h"
+#include "sched.h"
+#include "test.h"
+#include "vma.h"
+
+/* Forward declarations for test functions */
+static int test_compaction_fragmentation_index(void);
+static int test_compaction_alloc_page_at(void);
+static int test_compaction_migrate_page(void);
+static int test_compaction_compact_memory(void);
+static int test_compaction_alloc_compacts(void);
+
+#define COMPACT_VA 0x50000000UL
+#define COMPACT_ORDER 4
+#define COMPACT_BLOCK_PAGES (1UL << COMPACT_ORDER)
+#define COMPACT_MAPPED 4
+#define COMPACT_DESTS 8
+#define HOARD_MAGIC 0x686f617264UL
+
+/* A bare user task with one anonymous page at COMPACT_VA + COMPACT_MAPPED
+ * pages, so the PTE table for COMPACT_VA is there */
+static struct task_struct *compact_task(void) {
+  struct task_struct *task = test_anon_task(COMPACT_VA, COMPACT_MAPPED + 1, 0);
+  unsigned long va = COMPACT_VA + COMPACT_MAPPED * PAGE_SIZE;
+  if (task && allocate_user_page(task, va) == 0) {
+    test_task_free(task);
+    return 0;
+  }
+  return task;
+}
+
+/* What a fragmented machine looks like, built out of every free page */
+struct fragmented {
+  struct task_struct *task;
+  unsigned long block; /* the order COMPACT_ORDER block to empty */
+  unsigned long hoard; /* everything else still taken */
+};
+
+static int hoarded(unsigned long page) {
+  return page_alloc_order(page) == 0 &&
+         ((unsigned long *)(page + VA_START))[1] == (HOARD_MAGIC ^ page);
+}
+
+/* Take every page, then give back all of one aligned block but
+ * COMPACT_MAPPED pages, which task maps, and COMPACT_DESTS single pages
+ * elsewhere to move them to. No free block is left of COMPACT_ORDER. */
+static int fragment(struct fragmented *f) {
+  f->task = compact_task();
+  if (f->task == 0) {
+    return -1;
+  }
+  unsigned long hoard = 0;
+  unsigned long page;
+  while ((page = get_free_page_nozero()) != 0) {
+    ((unsigned long *)(page + VA_START))[0] = hoard;
+    ((unsigned long *)(page + VA_START))[1] = HOARD_MAGIC ^ page;
+    hoard = page;
+  }
+
+  /* The first whole block of hoarded pages */
+  f->block = 0;
+  for (page = hoard; page && f->block == 0;
+       page = *(unsigned long *)(page + VA_START)) {
+    unsigned long block = page & ~((PAGE_SIZE << COMPACT_ORDER) - 1);
+    unsigned long i = 0;
+    while (i < COMPACT_BLOCK_PAGES && hoarded(block + i * PAGE_SIZE)) {
+      i++;
+    }
+    if (i == COMPACT_BLOCK_PAGES) {
+      f->block = block;
+    }
+  }
+
+  /* Sort the hoard into the block, the destinations and the rest */
+  unsigned long dests = 0;
+  f->hoard = 0;
+  while (hoard) {
+    page = hoard;
+    hoard = *(unsigned long *)(page + VA_START);
+    if (page >= f->block &&
+        page < f->block + (PAGE_SIZE << COMPACT_ORDER)) {
+      continue;
+    }
+    /* Far enough apart that each stays a block of its own */
+    if (dests < COMPACT_DESTS &&
+        (page & ((PAGE_SIZE << (COMPACT_ORDER + 2)) - 1)) == 0) {
+      dests++;
+      free_page(page);
+      continue;
+    }
+    *(unsigned long *)(page + VA_START) = f->hoard;
+    f->hoard = page;
+  }
+  if (f->block == 0) {
+    return -1;
+  }
+
+  /* Pages 0, 5, 10 and 15 of the block, each holding its own address */
+  for (unsigned long i = 0; i < COMPACT_BLOCK_PAGES; i++) {
+    page = f->block + i * PAGE_SIZE;
+    if (i % 5 == 0) {
+      ((unsigned long *)(page + VA_START))[1] = page;
+      if (map_page(f->task, COMPACT_VA + i / 5 * PAGE_SIZE, page) < 0) {
+        return -1;
+      }
+    } else {
+      free_page(page);
+    }
+  }
+
+  return test_task_list(f->task);
+}
+
+static void unfragment(struct fragmented *f) {
+  test_task_unlist(f->task);
+  while (f->hoard) {
+    unsigned long page = f->hoard;
+    f->hoard = *(unsigned long *)(page + VA_START);
+    free_page(page);
+  }
+}
+
+/* The block's pages have moved out, keeping what they held */
+static int check_moved(struct fragmented *f) {
+  for (unsigned long i = 0; i < COMPACT_MAPPED; i++) {
+    unsigned long pte = *pte_lookup(f->task, COMPACT_VA + i * PAGE_SIZE);
+    unsigned long page = pte & PTE_ADDR_MASK;
+    TEST_ASSERT(pte & PTE_VALID);
+    TEST_ASSERT(page < f->block ||
+                page >= f->block + (PAGE_SIZE << COMPACT_ORDER));
+    unsigned long was = f->block + i * 5 * PAGE_SIZE;
+    TEST_ASSERT_EQ(was, ((unsigned long *)(page + VA_START))[1]);
+    TEST_ASSERT_EQ(1, phys_to_page(page)->mapcount);
+  }
+  return TEST_PASS;
+}
+
+/* Test: -1000 while a big enough block is free, 0 to 1000 otherwise */
+static int test_compaction_fragmentation_index(void) {
+  TEST_ASSERT_EQ(-1000, fragmentation_index(0));
+  for (int order = 0; order < MAX_ORDER; order++) {
+    int index = fragmentation_index(order);
+    TEST_ASSERT(index == -1000 || (index >= 0 && index <= 1000));
+  }
+  TEST_ASSERT_EQ(0, fragmentation_index(MAX_ORDER));
+  return TEST_PASS;
+}
+
+/* Test: A page is carved out of the middle of a free block */
+static int test_compaction_alloc_page_at(void) {
+  unsigned long block = alloc_pages(2);
+  TEST_ASSERT_NEQ(0, block);
+  TEST_ASSERT_EQ(-1, free_block_order(block));
+  free_pages(block, 2);
+  TEST_ASSERT_GTE(free_block_order(block), 2);
+
+  unsigned long page = block + 2 * PAGE_SIZE;
+  TEST_ASSERT_EQ(page, alloc_page_at(page));
+  TEST_ASSERT_EQ(0, page_alloc_order(page));
+  TEST_ASSERT_EQ(1, phys_to_page(page)->refcount);
+  TEST_ASSERT_EQ(-1, free_block_order(page));
+  TEST_ASSERT_GTE(free_block_order(block), 1);
+  TEST_ASSERT_EQ(0, free_block_order(block + 3 * PAGE_SIZE));
+  TEST_ASSERT_EQ(0, alloc_page_at(page));
+
+  /* Given back, it merges with the rest again */
+  free_page(page);
+  TEST_ASSERT_GTE(free_block_order(block), 2);
+
+  return TEST_PASS;
+}
+
+/* Test: Migration copies the page and moves its mapping over */
+static int test_compaction_migrate_page(void) {
+  struct task_struct *task = compact_task();
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long va = COMPACT_VA + COMPACT_MAPPED * PAGE_SIZE;
+  unsigned long *pte = pte_lookup(task, va);
+  unsigned long old = *pte & PTE_ADDR_MASK;
+  unsigned long flags = *pte & ~PTE_ADDR_MASK;
+  ((unsigned long *)(old + VA_START))[7] = 0x1234;
+
+  unsigned long new = get_free_page_nozero();
+  TEST_ASSERT_NEQ(0, new);
+  TEST_ASSERT_EQ(1, migrate_page(task, va, new));
+  TEST_ASSERT_EQ(new, *pte & PTE_ADDR_MASK);
+  TEST_ASSERT_EQ(flags, *pte & ~PTE_ADDR_MASK);
+  TEST_ASSERT_EQ(0x1234, ((unsigned long *)(new + VA_START))[7]);
+  TEST_ASSERT_EQ(1, phys_to_page(new)->mapcount);
+  TEST_ASSERT(phys_to_page(new)->flags & PG_USER);
+  TEST_ASSERT_EQ(1, task->mm.rss);
+
+  /* A shared page stays where it is */
+  get_page(new);
+  unsigned long other = get_free_page_nozero();
+  TEST_ASSERT_NEQ(0, other);
+  TEST_ASSERT_EQ(0, migrate_page(task, va, other));
+  TEST_ASSERT_EQ(new, *pte & PTE_ADDR_MASK);
+  put_page(new);
+  free_page(other);
+
+  /* Nothing mapped, nothing to move */
+  TEST_ASSERT_EQ(0, migrate_page(task, COMPACT_VA, other));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Compacting on demand empties the block and reports the index */
+static int test_compaction_compact_memory(void) {
+  struct fragmented f;
+  TEST_ASSERT_EQ(0, fragment(&f));
+  struct compact_stats before, after;
+  compact_get_stats(&before);
+
+  int index = fragmentation_index(COMPACT_ORDER);
+  unsigned long freed = compact_memory(COMPACT_ORDER);
+  int block_order = free_block_order(f.block);
+  compact_get_stats(&after);
+  int moved = check_moved(&f);
+
+  unfragment(&f);
+
+  TEST_ASSERT_GT(index, 0);
+  TEST_ASSERT_EQ(1, freed);
+  TEST_ASSERT_GTE(block_order, COMPACT_ORDER);
+  TEST_ASSERT_EQ(TEST_PASS, moved);
+  TEST_ASSERT_EQ(COMPACT_MAPPED, after.migrated - before.migrated);
+  TEST_ASSERT_EQ(before.success + 1, after.success);
+  TEST_ASSERT_EQ(COMPACT_ORDER, after.last_order);
+  TEST_ASSERT_EQ(index, after.last_index_before);
+  TEST_ASSERT_EQ(-1000, after.last_index_after);
+
+  test_task_free(f.task);
+
+  return TEST_PASS;
+}
+
+/* Test: A high-order allocation that finds no block compacts for one */
+static int test_compaction_alloc_compacts(void) {
+  struct fragmented f;
+  TEST_ASSERT_EQ(0, fragment(&f));
+  struct compact_stats before, after;
+  compact_get_stats(&before);
+
+  unsigned long block = alloc_pages(COMPACT_ORDER);
+  compact_get_stats(&after);
+  int moved = check_moved(&f);
+  if (block) {
+    free_pages(block, COMPACT_ORDER);
+  }
+
+  unfragment(&f);
+
+  TEST_ASSERT_EQ(f.block, block);
+  TEST_ASSERT_EQ(TEST_PASS, moved);
+  TEST_ASSERT_EQ(before.stalls + 1, after.stalls);
+  TEST_ASSERT_EQ(COMPACT_MAPPED, after.migrated - before.migrated);
+
+  test_task_free(f.task);
+
+  return TEST_PASS;
+}
+
+/* Register all memory compaction tests */
+void register_compaction_tests(void) {
+  TEST_REGISTER(compaction, fragmentation_index);
+  TEST_REGISTER(compaction, alloc_page_at);
+  TEST_REGISTER(compaction, migrate_page);
+  TEST_REGISTER(compaction, compact_memory);
+  TEST_REGISTER(compaction, alloc_compacts);
+}
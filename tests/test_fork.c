@@ -9,14 +9,19 @@
  * - Task stack setup
  * - Process flags
  * - Child process initialization
+ * - User image text shared read-only, data private per process
  */
 
+#include "arm/mmu.h"
 #include "entry.h"
+#include "fixtures.h"
 #include "fork.h"
 #include "mm.h"
 #include "printf.h"
 #include "sched.h"
 #include "test.h"
+#include "utils.h"
+#include "vma.h"
 
 /* Forward declarations for test functions */
 static int test_fork_copy_process_returns_pid(void);
@@ -34,6 +39,15 @@ static int test_fork_child_counter(void);
 static int test_fork_cpu_context_setup(void);
 static int test_fork_different_pids(void);
 static int test_fork_task_list_grows(void);
+static int test_fork_user_text_shared(void);
+static int test_fork_user_data_private(void);
+static int test_fork_user_text_not_writable(void);
+
+/* A stand-in user image in the kernel image: two text pages, then data */
+#define IMAGE_TEXT_SIZE (2 * PAGE_SIZE)
+#define IMAGE_SIZE (IMAGE_TEXT_SIZE + 100)
+static unsigned char user_image[3 * PAGE_SIZE]
+    __attribute__((aligned(PAGE_SIZE)));
 
 /* Dummy function for kernel thread testing - must call exit_process() */
 static void test_kernel_func(void) {
@@ -313,6 +327,100 @@ static int test_fork_task_list_grows(void) {
   return TEST_PASS;
 }
 
+/* Test: Every process maps the same text pages, read-only and not COW */
+static int test_fork_user_text_shared(void) {
+  user_image[0] = 0xd5;
+  struct task_struct *a = test_task();
+  struct task_struct *b = test_task();
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+  unsigned long start = (unsigned long)user_image;
+  TEST_ASSERT_EQ(0, map_user_image(a, start, IMAGE_TEXT_SIZE, IMAGE_SIZE));
+  TEST_ASSERT_EQ(0, map_user_image(b, start, IMAGE_TEXT_SIZE, IMAGE_SIZE));
+
+  for (unsigned long off = 0; off < IMAGE_TEXT_SIZE; off += PAGE_SIZE) {
+    unsigned long *pte_a = pte_lookup(a, USER_CODE_START + off);
+    unsigned long *pte_b = pte_lookup(b, USER_CODE_START + off);
+    TEST_ASSERT_NOT_NULL(pte_a);
+    TEST_ASSERT_NOT_NULL(pte_b);
+    TEST_ASSERT_EQ((start - VA_START + off) & PTE_ADDR_MASK,
+                   *pte_a & PTE_ADDR_MASK);
+    TEST_ASSERT_EQ(*pte_a & PTE_ADDR_MASK, *pte_b & PTE_ADDR_MASK);
+    TEST_ASSERT_EQ(MM_AP_RDONLY, *pte_a & MM_AP_RDONLY);
+    TEST_ASSERT_EQ(0, *pte_a & (PTE_COW | PTE_UXN));
+    /* Kernel image pages carry no references for the mappings to drop */
+    TEST_ASSERT_EQ(0, page_count(*pte_a & PTE_ADDR_MASK));
+  }
+
+  /* Tearing down one process leaves the other's text in place */
+  test_task_free(a);
+  unsigned long *pte = pte_lookup(b, USER_CODE_START);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_EQ(0xd5, *(unsigned char *)((*pte & PTE_ADDR_MASK) + VA_START));
+  test_task_free(b);
+  TEST_ASSERT_EQ(0xd5, user_image[0]);
+
+  return TEST_PASS;
+}
+
+/* Test: Data gets a private, writable, zero-padded copy per process */
+static int test_fork_user_data_private(void) {
+  for (int i = 0; i < IMAGE_SIZE - IMAGE_TEXT_SIZE; i++) {
+    user_image[IMAGE_TEXT_SIZE + i] = (unsigned char)(i + 1);
+  }
+  struct task_struct *a = test_task();
+  struct task_struct *b = test_task();
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+  unsigned long start = (unsigned long)user_image;
+  TEST_ASSERT_EQ(0, map_user_image(a, start, IMAGE_TEXT_SIZE, IMAGE_SIZE));
+  TEST_ASSERT_EQ(0, map_user_image(b, start, IMAGE_TEXT_SIZE, IMAGE_SIZE));
+
+  unsigned long data_va = USER_CODE_START + IMAGE_TEXT_SIZE;
+  unsigned long *pte_a = pte_lookup(a, data_va);
+  unsigned long *pte_b = pte_lookup(b, data_va);
+  TEST_ASSERT_NOT_NULL(pte_a);
+  TEST_ASSERT_NOT_NULL(pte_b);
+  TEST_ASSERT_NEQ(*pte_a & PTE_ADDR_MASK, *pte_b & PTE_ADDR_MASK);
+  TEST_ASSERT_EQ(0, *pte_a & MM_AP_RDONLY);
+  TEST_ASSERT_EQ(1, page_count(*pte_a & PTE_ADDR_MASK));
+
+  unsigned char *data = (unsigned char *)((*pte_a & PTE_ADDR_MASK) + VA_START);
+  for (int i = 0; i < IMAGE_SIZE - IMAGE_TEXT_SIZE; i++) {
+    TEST_ASSERT_EQ((unsigned char)(i + 1), data[i]);
+  }
+  for (int i = IMAGE_SIZE - IMAGE_TEXT_SIZE; i < PAGE_SIZE; i++) {
+    TEST_ASSERT_EQ(0, data[i]);
+  }
+  TEST_ASSERT_EQ(3, a->mm.rss); /* two shared text pages and one data */
+
+  test_task_free(a);
+  test_task_free(b);
+
+  return TEST_PASS;
+}
+
+/* Test: A write to the shared text is refused instead of copied */
+static int test_fork_user_text_not_writable(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, map_user_image(task, (unsigned long)user_image,
+                                   IMAGE_TEXT_SIZE, IMAGE_SIZE));
+
+  TEST_ASSERT_EQ(-1, handle_mm_fault(task, USER_CODE_START, 1));
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, USER_CODE_START, 0));
+  TEST_ASSERT_EQ(0,
+                 handle_mm_fault(task, USER_CODE_START + IMAGE_TEXT_SIZE, 1));
+
+  /* Unmapped text is not refilled with zero pages */
+  TEST_ASSERT_EQ(0, unmap_range(task, USER_CODE_START, 1));
+  TEST_ASSERT_EQ(-1, handle_mm_fault(task, USER_CODE_START, 0));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
 /* Register all fork tests */
 void register_fork_tests(void) {
   TEST_REGISTER(fork, copy_process_returns_pid);
@@ -330,4 +438,7 @@ void register_fork_tests(void) {
   TEST_REGISTER(fork, cpu_context_setup);
   TEST_REGISTER(fork, different_pids);
   TEST_REGISTER(fork, task_list_grows);
+  TEST_REGISTER(fork, user_text_shared);
+  TEST_REGISTER(fork, user_data_private);
+  TEST_REGISTER(fork, user_text_not_writable);
 }
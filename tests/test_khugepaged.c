@@ -0,0 +1,200 @@
+/*
+ * Huge Page Promotion Tests
+ *
+ * Tests for:
+ * - Collapsing a fully populated PTE table into a 2 MiB block
+ * - Ranges that must not be collapsed
+ * - The background scan and its statistics
+ */
+
+#include "arm/mmu.h"
+#include "asid.h"
+#include "fixtures.h"
+#include "fork.h"
+#include "khugepaged.h"
+#include "mm.h"
+#include "sched.h"
+#include "test.h"
+#include "vma.h"
+
+/* Forward declarations for test functions */
+static int test_khugepaged_collapse_full_table(void);
+static int test_khugepaged_collapse_flushes_tlb(void);
+static int test_khugepaged_skip_partial_table(void);
+static int test_khugepaged_skip_shared_pages(void);
+static int test_khugepaged_scan_promotes(void);
+
+#define COLLAPSE_VA 0xc0000000UL
+#define COLLAPSE_MAGIC 0xC011A95EUL
+#define COLLAPSE_STRIDE 16
+
+/* A task with a populated, 4 KiB-mapped 2 MiB range at COLLAPSE_VA */
+static struct task_struct *collapse_task(unsigned long pages) {
+  return test_anon_task(COLLAPSE_VA, SECTION_SIZE / PAGE_SIZE, pages);
+}
+
+static int is_block(struct task_struct *task) {
+  unsigned long *pmd = pmd_lookup(task, COLLAPSE_VA);
+  return pmd && (*pmd & MM_TYPE_MASK) == MM_TYPE_BLOCK;
+}
+
+/* Test: 512 private pages become one block holding the same data */
+static int test_khugepaged_collapse_full_table(void) {
+  struct task_struct *task = collapse_task(HUGE_PAGE_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long old_page = *pte_lookup(task, COLLAPSE_VA + 7 * PAGE_SIZE) &
+                           PTE_ADDR_MASK;
+  *(unsigned long *)(old_page + VA_START + 8) = COLLAPSE_MAGIC;
+  unsigned long nr_ptes = task->mm.nr_ptes;
+
+  TEST_ASSERT_EQ(1, collapse_huge_pmd(task, COLLAPSE_VA));
+  TEST_ASSERT(is_block(task));
+  TEST_ASSERT_EQ(HUGE_PAGE_PAGES, task->mm.rss);
+  TEST_ASSERT_EQ(nr_ptes - 1, task->mm.nr_ptes);
+  TEST_ASSERT_EQ(0, page_count(old_page));
+
+  unsigned long block = *pmd_lookup(task, COLLAPSE_VA) & PTE_ADDR_MASK;
+  TEST_ASSERT_EQ(HUGE_PAGE_ORDER, page_alloc_order(block));
+  TEST_ASSERT_EQ(COLLAPSE_MAGIC,
+                 *(unsigned long *)(block + VA_START + 7 * PAGE_SIZE + 8));
+  /* A block is not collapsed twice */
+  TEST_ASSERT_EQ(0, collapse_huge_pmd(task, COLLAPSE_VA));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Once collapsed, no access goes through a stale 4 KiB translation,
+ * even after the old pages have been handed out again */
+static int test_khugepaged_collapse_flushes_tlb(void) {
+  struct task_struct *task = collapse_task(HUGE_PAGE_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long old[HUGE_PAGE_PAGES / COLLAPSE_STRIDE];
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES / COLLAPSE_STRIDE; i++) {
+    unsigned long va = COLLAPSE_VA + i * COLLAPSE_STRIDE * PAGE_SIZE;
+    old[i] = *pte_lookup(task, va) & PTE_ADDR_MASK;
+    *(unsigned long *)(old[i] + VA_START) = COLLAPSE_MAGIC ^ i;
+  }
+
+  /* Load a translation for every page of the table */
+  preempt_disable();
+  switch_mm(&task->mm);
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES; i++) {
+    (void)*(volatile unsigned long *)(COLLAPSE_VA + i * PAGE_SIZE);
+  }
+  switch_mm(current->active_mm);
+  preempt_enable();
+
+  int collapsed = collapse_huge_pmd(task, COLLAPSE_VA);
+
+  /* Reuse what old pages can be had back, and overwrite them */
+  zero_pool_drain();
+  unsigned long reused = 0;
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES / COLLAPSE_STRIDE; i++) {
+    if (alloc_page_at(old[i]) == old[i]) {
+      *(unsigned long *)(old[i] + VA_START) = ~0UL;
+      reused++;
+    } else {
+      old[i] = 0;
+    }
+  }
+
+  unsigned long bad = 0;
+  preempt_disable();
+  switch_mm(&task->mm);
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES / COLLAPSE_STRIDE; i++) {
+    unsigned long va = COLLAPSE_VA + i * COLLAPSE_STRIDE * PAGE_SIZE;
+    if (*(volatile unsigned long *)va != (COLLAPSE_MAGIC ^ i)) {
+      bad++;
+    }
+  }
+  switch_mm(current->active_mm);
+  preempt_enable();
+
+  for (unsigned long i = 0; i < HUGE_PAGE_PAGES / COLLAPSE_STRIDE; i++) {
+    if (old[i]) {
+      free_page(old[i]);
+    }
+  }
+
+  TEST_ASSERT_EQ(1, collapsed);
+  TEST_ASSERT_GT(reused, 0);
+  TEST_ASSERT_EQ(0, bad);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A table with a hole or an unaligned address is left alone */
+static int test_khugepaged_skip_partial_table(void) {
+  struct task_struct *task = collapse_task(HUGE_PAGE_PAGES - 1);
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, collapse_huge_pmd(task, COLLAPSE_VA));
+  TEST_ASSERT_EQ(0, collapse_huge_pmd(task, COLLAPSE_VA + PAGE_SIZE));
+  TEST_ASSERT(!is_block(task));
+  TEST_ASSERT_EQ(HUGE_PAGE_PAGES - 1, task->mm.rss);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Pages shared copy-on-write keep their 4 KiB mappings */
+static int test_khugepaged_skip_shared_pages(void) {
+  struct task_struct *task = collapse_task(HUGE_PAGE_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long page = *pte_lookup(task, COLLAPSE_VA) & PTE_ADDR_MASK;
+  get_page(page);
+
+  TEST_ASSERT_EQ(0, collapse_huge_pmd(task, COLLAPSE_VA));
+  TEST_ASSERT(!is_block(task));
+  put_page(page);
+
+  /* Nor one whose mapping a preempted fault has yet to count */
+  phys_to_page(page)->mapcount = 0;
+  TEST_ASSERT_EQ(0, collapse_huge_pmd(task, COLLAPSE_VA));
+  TEST_ASSERT(!is_block(task));
+  phys_to_page(page)->mapcount = 1;
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: The scan finds and promotes tables of tasks on the task list */
+static int test_khugepaged_scan_promotes(void) {
+  struct task_struct *task = collapse_task(HUGE_PAGE_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, test_task_list(task));
+
+  struct khugepaged_stats before, after;
+  khugepaged_get_stats(&before);
+  /* Enough budget to reach the task from wherever the cursor is */
+  for (int i = 0; i < 4 && !is_block(task); i++) {
+    khugepaged_scan(4096);
+  }
+  khugepaged_get_stats(&after);
+
+  test_task_unlist(task);
+
+  TEST_ASSERT(is_block(task));
+  TEST_ASSERT_GT(after.collapsed, before.collapsed);
+  TEST_ASSERT_GT(after.pmds_scanned, before.pmds_scanned);
+  TEST_ASSERT_GT(after.full_scans, before.full_scans);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Register all huge page promotion tests */
+void register_khugepaged_tests(void) {
+  TEST_REGISTER(khugepaged, collapse_full_table);
+  TEST_REGISTER(khugepaged, collapse_flushes_tlb);
+  TEST_REGISTER(khugepaged, skip_partial_table);
+  TEST_REGISTER(khugepaged, skip_shared_pages);
+  TEST_REGISTER(khugepaged, scan_promotes);
+}
@@ -0,0 +1,238 @@
+/*
+ * Same-Page Merging Tests
+ *
+ * Tests for:
+ * - Merging identical pages into one copy-on-write page
+ * - Pages that differ or are not anonymous memory
+ * - The background scan, its trees and its statistics
+ * - The limit on mappings of one merged page
+ */
+
+#include "arm/mmu.h"
+#include "fixtures.h"
+#include "fork.h"
+#include "ksm.h"
+#include "mm.h"
+#include "sched.h"
+#include "test.h"
+#include "vma.h"
+
+/* Forward declarations for test functions */
+static int test_ksm_merge_identical(void);
+static int test_ksm_merge_rejects_different(void);
+static int test_ksm_write_unmerges(void);
+static int test_ksm_scan_merges_tasks(void);
+static int test_ksm_max_sharing(void);
+
+#define KSM_VA 0x60000000UL
+#define KSM_TEST_PAGES 8
+
+static void fill_page(unsigned long *words, unsigned long seed) {
+  for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+    words[i] = seed * 0x9e3779b97f4a7c15UL + i;
+  }
+}
+
+/* A bare user task with that many anonymous pages at KSM_VA, page i filled
+ * from seed + i */
+static struct task_struct *ksm_task(unsigned long pages, unsigned long seed) {
+  struct task_struct *task = test_anon_task(KSM_VA, pages, pages);
+  if (task == 0) {
+    return 0;
+  }
+  for (unsigned long i = 0; i < pages; i++) {
+    unsigned long *pte = pte_lookup(task, KSM_VA + i * PAGE_SIZE);
+    fill_page((unsigned long *)((*pte & PTE_ADDR_MASK) + VA_START), seed + i);
+  }
+  return task;
+}
+
+static unsigned long mapped_page(struct task_struct *task, unsigned long va) {
+  unsigned long *pte = pte_lookup(task, va);
+  return pte && (*pte & PTE_VALID) ? *pte & PTE_ADDR_MASK : 0;
+}
+
+/* Test: Two identical pages become one, mapped read-only by both */
+static int test_ksm_merge_identical(void) {
+  struct task_struct *a = ksm_task(1, 7);
+  struct task_struct *b = ksm_task(1, 7);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+  unsigned long kpage = mapped_page(a, KSM_VA);
+  unsigned long old_page = mapped_page(b, KSM_VA);
+
+  TEST_ASSERT_EQ(1, merge_page(a, KSM_VA, kpage));
+  TEST_ASSERT_EQ(1, merge_page(b, KSM_VA, kpage));
+  TEST_ASSERT_EQ(kpage, mapped_page(b, KSM_VA));
+  TEST_ASSERT_EQ(0, page_count(old_page));
+  TEST_ASSERT_EQ(2, page_count(kpage));
+  TEST_ASSERT_EQ(2, page_mapcount(kpage));
+  TEST_ASSERT(*pte_lookup(a, KSM_VA) & MM_AP_RDONLY);
+  TEST_ASSERT(*pte_lookup(b, KSM_VA) & PTE_COW);
+  /* rss counts what each task maps, shared or not */
+  TEST_ASSERT_EQ(1, b->mm.rss);
+
+  test_task_free(a);
+  TEST_ASSERT_EQ(1, page_mapcount(kpage));
+  test_task_free(b);
+  TEST_ASSERT_EQ(0, page_count(kpage));
+
+  return TEST_PASS;
+}
+
+/* Test: Pages that differ, or the zero page, are not merged */
+static int test_ksm_merge_rejects_different(void) {
+  struct task_struct *a = ksm_task(2, 1);
+  TEST_ASSERT_NOT_NULL(a);
+  unsigned long first = mapped_page(a, KSM_VA);
+  unsigned long second = mapped_page(a, KSM_VA + PAGE_SIZE);
+
+  TEST_ASSERT_EQ(0, merge_page(a, KSM_VA + PAGE_SIZE, first));
+  TEST_ASSERT_EQ(second, mapped_page(a, KSM_VA + PAGE_SIZE));
+  TEST_ASSERT_EQ(1, page_count(second));
+  TEST_ASSERT_EQ(0, merge_page(a, KSM_VA, ZERO_PAGE));
+  /* Nothing mapped there */
+  TEST_ASSERT_EQ(0, merge_page(a, KSM_VA + 2 * PAGE_SIZE, first));
+
+  /* Left write-protected, but the next write keeps the page */
+  TEST_ASSERT_EQ(0, handle_mm_fault(a, KSM_VA + PAGE_SIZE, 1));
+  TEST_ASSERT_EQ(second, mapped_page(a, KSM_VA + PAGE_SIZE));
+  TEST_ASSERT(!(*pte_lookup(a, KSM_VA + PAGE_SIZE) & MM_AP_RDONLY));
+
+  test_task_free(a);
+
+  return TEST_PASS;
+}
+
+/* Test: A write to a merged page takes a private copy of it */
+static int test_ksm_write_unmerges(void) {
+  struct task_struct *a = ksm_task(1, 3);
+  struct task_struct *b = ksm_task(1, 3);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+  unsigned long kpage = mapped_page(a, KSM_VA);
+  TEST_ASSERT_EQ(1, merge_page(a, KSM_VA, kpage));
+  TEST_ASSERT_EQ(1, merge_page(b, KSM_VA, kpage));
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(b, KSM_VA, 1));
+  unsigned long copy = mapped_page(b, KSM_VA);
+  TEST_ASSERT_NEQ(kpage, copy);
+  TEST_ASSERT_EQ(0, memcmp_pages(kpage, copy));
+  TEST_ASSERT_EQ(1, page_mapcount(kpage));
+  *(unsigned long *)(copy + VA_START) = 0;
+  TEST_ASSERT_NEQ(0, memcmp_pages(kpage, copy));
+
+  test_task_free(a);
+  test_task_free(b);
+
+  return TEST_PASS;
+}
+
+/* Test: The scan merges identical pages of tasks on the task list, and gives
+ * merged pages back once nobody maps them */
+static int test_ksm_scan_merges_tasks(void) {
+  struct task_struct *tasks[2];
+  for (int i = 0; i < 2; i++) {
+    tasks[i] = ksm_task(KSM_TEST_PAGES, 100);
+    TEST_ASSERT_NOT_NULL(tasks[i]);
+    TEST_ASSERT_EQ(0, test_task_list(tasks[i]));
+  }
+
+  struct ksm_stats before, merged, after;
+  ksm_get_stats(&before);
+  /* Two passes from wherever the cursor is: one to fill the unstable tree,
+   * one to find the second task's pages in it */
+  for (int i = 0; i < 3; i++) {
+    ksm_scan(4096);
+  }
+  ksm_get_stats(&merged);
+  unsigned long kpage = mapped_page(tasks[0], KSM_VA);
+  unsigned long kpage_flags = phys_to_page(kpage)->flags;
+
+  int same = 1;
+  for (unsigned long i = 0; i < KSM_TEST_PAGES; i++) {
+    unsigned long va = KSM_VA + i * PAGE_SIZE;
+    same &= mapped_page(tasks[0], va) == mapped_page(tasks[1], va);
+  }
+
+  /* Once both have exited, the next pass frees the merged pages */
+  exit_mm(tasks[0]);
+  exit_mm(tasks[1]);
+  for (int i = 0; i < 2; i++) {
+    ksm_scan(4096);
+  }
+  ksm_get_stats(&after);
+
+  for (int i = 0; i < 2; i++) {
+    test_task_unlist(tasks[i]);
+    test_task_free(tasks[i]);
+  }
+
+  TEST_ASSERT(same);
+  TEST_ASSERT(kpage_flags & PG_KSM);
+  TEST_ASSERT_GTE(merged.merged - before.merged, KSM_TEST_PAGES);
+  TEST_ASSERT_GTE(merged.pages_sharing - before.pages_sharing,
+                  KSM_TEST_PAGES);
+  TEST_ASSERT_GT(merged.full_scans, before.full_scans);
+  TEST_ASSERT_EQ(0, page_count(kpage));
+  TEST_ASSERT_EQ(before.pages_shared, after.pages_shared);
+  TEST_ASSERT_EQ(before.pages_sharing, after.pages_sharing);
+
+  return TEST_PASS;
+}
+
+/* Test: A full merged page is not shared further; another one starts */
+static int test_ksm_max_sharing(void) {
+  struct task_struct *task = ksm_task(KSM_TEST_PAGES, 0);
+  TEST_ASSERT_NOT_NULL(task);
+  for (unsigned long i = 0; i < KSM_TEST_PAGES; i++) {
+    fill_page((unsigned long *)(mapped_page(task, KSM_VA + i * PAGE_SIZE) +
+                                VA_START),
+              300);
+  }
+  TEST_ASSERT_EQ(0, test_task_list(task));
+
+  unsigned long saved = ksm_max_sharing;
+  ksm_max_sharing = 3;
+  for (int i = 0; i < 3; i++) {
+    ksm_scan(4096);
+  }
+  ksm_max_sharing = saved;
+
+  int max_mapcount = 0;
+  unsigned long distinct = 0;
+  for (unsigned long i = 0; i < KSM_TEST_PAGES; i++) {
+    unsigned long page = mapped_page(task, KSM_VA + i * PAGE_SIZE);
+    int mapcount = page_mapcount(page);
+    if (mapcount > max_mapcount) {
+      max_mapcount = mapcount;
+    }
+    unsigned long j = 0;
+    while (j < i && mapped_page(task, KSM_VA + j * PAGE_SIZE) != page) {
+      j++;
+    }
+    distinct += j == i;
+  }
+
+  exit_mm(task);
+  /* The next pass gives back the merged pages */
+  for (int i = 0; i < 2; i++) {
+    ksm_scan(4096);
+  }
+  test_task_unlist(task);
+  test_task_free(task);
+
+  TEST_ASSERT_EQ(3, max_mapcount);
+  TEST_ASSERT_EQ((KSM_TEST_PAGES + 2) / 3, distinct);
+
+  return TEST_PASS;
+}
+
+/* Register all same-page merging tests */
+void register_ksm_tests(void) {
+  TEST_REGISTER(ksm, merge_identical);
+  TEST_REGISTER(ksm, merge_rejects_different);
+  TEST_REGISTER(ksm, write_unmerges);
+  TEST_REGISTER(ksm, scan_merges_tasks);
+  TEST_REGISTER(ksm, max_sharing);
+}
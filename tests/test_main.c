@@ -10,6 +10,7 @@
  *   on boot.
  */
 
+#include "mm.h"
 #include "printf.h"
 #include "test.h"
 #include "timer.h"
@@ -25,6 +26,18 @@ extern void register_irq_tests(void);
 extern void register_fork_tests(void);
 extern void register_printf_tests(void);
 extern void register_utils_tests(void);
+extern void register_cache_tests(void);
+extern void register_slab_tests(void);
+extern void register_vma_tests(void);
+extern void register_asid_tests(void);
+extern void register_tlbflush_tests(void);
+extern void register_mmap_tests(void);
+extern void register_khugepaged_tests(void);
+extern void register_vmalloc_tests(void);
+extern void register_swap_tests(void);
+extern void register_ksm_tests(void);
+extern void register_wss_tests(void);
+extern void register_compaction_tests(void);
 
 /*
  * Register all test suites
@@ -38,7 +51,19 @@ static void register_all_tests(void) {
   register_uart_tests();
 
   /* Memory management */
+  register_cache_tests();
   register_mm_tests();
+  register_slab_tests();
+  register_vma_tests();
+  register_asid_tests();
+  register_tlbflush_tests();
+  register_mmap_tests();
+  register_khugepaged_tests();
+  register_vmalloc_tests();
+  register_swap_tests();
+  register_ksm_tests();
+  register_wss_tests();
+  register_compaction_tests();
 
   /* Process and scheduling */
   register_sched_tests();
@@ -81,7 +106,10 @@ void run_all_tests(void) {
   unsigned long elapsed_us = end_time - start_time;
   unsigned long elapsed_ms = elapsed_us / 1000;
 
-  printf("Test execution time: %lu ms\r\n\r\n", elapsed_ms);
+  printf("Test execution time: %lu ms\r\n", elapsed_ms);
+  /* The fault-around window the run used, and any task left behind */
+  fault_print_stats();
+  printf("\r\n");
 
   /* Final status */
   if (test_get_fail_count() == 0) {
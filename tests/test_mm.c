@@ -9,11 +9,28 @@
  * - Guard page mapping
  * - Memory copy operations
  * - Virtual memory copying between processes
+ * - Buddy allocator multi-order allocation and coalescing
+ * - Per-page metadata: layout, flags and mapping counts
+ * - Pre-zeroed page pool
+ * - Copy-on-write sharing of user pages across fork
+ * - Kernel writes into user memory
+ * - Fault-around and minor fault accounting
+ * - Shared zero page for reads of untouched anonymous memory
+ * - 2 MiB block mappings: faults, splitting, fork and a TLB benchmark
+ * - Contiguous-hint runs: folding, faults, copy-on-write and unmapping
+ * - Batched map_range/unmap_range and the per-mm page table cache
  */
 
+#include "arm/mmu.h"
+#include "arm/sysregs.h"
+#include "asid.h"
+#include "fixtures.h"
 #include "mm.h"
+#include "printf.h"
 #include "sched.h"
 #include "test.h"
+#include "utils.h"
+#include "vma.h"
 #include <stddef.h>
 
 /* Forward declarations for test functions */
@@ -31,6 +48,41 @@ static int test_mm_map_guard_page(void);
 static int test_mm_page_table_creation(void);
 static int test_mm_multiple_user_pages(void);
 static int test_mm_exhaustion_recovery(void);
+static int test_mm_alloc_pages_alignment(void);
+static int test_mm_alloc_pages_invalid_order(void);
+static int test_mm_free_pages_coalesces(void);
+static int test_mm_free_page_count(void);
+static int test_mm_zero_pool_refill(void);
+static int test_mm_zero_pool_pages_zeroed(void);
+static int test_mm_zero_pool_when_dry(void);
+static int test_mm_get_free_page_nozero(void);
+static int test_mm_page_struct_layout(void);
+static int test_mm_page_flags_follow_owner(void);
+static int test_mm_free_pages_leave_memory_alone(void);
+static int test_mm_cow_fork_shares_pages(void);
+static int test_mm_cow_write_fault_copies(void);
+static int test_mm_cow_last_sharer_reuses(void);
+static int test_mm_copy_to_user_breaks_cow(void);
+static int test_mm_page_mapcount_follows_mappings(void);
+static int test_mm_fault_around_maps_window(void);
+static int test_mm_fault_around_clipped(void);
+static int test_mm_fault_around_config(void);
+static int test_mm_fault_stats_per_task(void);
+static int test_mm_zero_page_read_fault(void);
+static int test_mm_zero_page_write_after_read(void);
+static int test_mm_huge_fault_maps_block(void);
+static int test_mm_huge_fault_needs_whole_block(void);
+static int test_mm_huge_zap_splits_block(void);
+static int test_mm_huge_cow_fork(void);
+static int test_mm_cont_map_folds_run(void);
+static int test_mm_cont_map_needs_run(void);
+static int test_mm_cont_fault_maps_run(void);
+static int test_mm_cont_cow_unfolds(void);
+static int test_mm_cont_zap_unfolds(void);
+static int test_mm_map_range_spans_tables(void);
+static int test_mm_map_range_replaces(void);
+static int test_mm_unmap_range_caches_tables(void);
+static int test_mm_bench_huge_tlb(void);
 
 /* Helper to check if memory is zeroed */
 static int is_memory_zeroed(unsigned long addr, unsigned long size) {
@@ -217,7 +269,7 @@ static int test_mm_page_zeroed(void) {
 /* Test: Allocate user page updates task structure */
 static int test_mm_allocate_user_page(void) {
   /* Save current state */
-  int initial_user_pages = current->mm.user_pages_count;
+  unsigned long initial_rss = current->mm.rss;
 
   /* Allocate a user page at a specific virtual address */
   unsigned long va = 0x400000; /* 4MB mark */
@@ -226,12 +278,13 @@ static int test_mm_allocate_user_page(void) {
   TEST_ASSERT_NEQ(0, kpage);
   TEST_ASSERT_GTE(kpage, VA_START);
 
-  /* User pages count should have increased */
-  TEST_ASSERT_GT(current->mm.user_pages_count, initial_user_pages);
+  /* Resident set should have grown */
+  TEST_ASSERT_GT(current->mm.rss, initial_rss);
 
-  /* The last user page should have our virtual address */
-  int idx = current->mm.user_pages_count - 1;
-  TEST_ASSERT_EQ(va, current->mm.user_pages[idx].virt_addr);
+  /* The page tables should map our virtual address to the page */
+  unsigned long *pte = pte_lookup(current, va);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_EQ(kpage - VA_START, *pte & PTE_ADDR_MASK);
 
   return TEST_PASS;
 }
@@ -239,7 +292,7 @@ static int test_mm_allocate_user_page(void) {
 /* Test: Map page creates proper page table entry */
 static int test_mm_map_page(void) {
   /* Save current state */
-  int initial_kernel_pages = current->mm.kernel_pages_count;
+  unsigned long initial_ptes = current->mm.nr_ptes;
 
   /* Allocate a physical page */
   unsigned long phys_page = get_free_page();
@@ -247,10 +300,10 @@ static int test_mm_map_page(void) {
 
   /* Map it at a specific virtual address */
   unsigned long va = 0x500000; /* 5MB mark */
-  map_page(current, va, phys_page);
+  TEST_ASSERT_EQ(0, map_page(current, va, phys_page));
 
-  /* Kernel pages count should have increased (for page tables) */
-  TEST_ASSERT_GTE(current->mm.kernel_pages_count, initial_kernel_pages);
+  /* Page table count should have increased (for page tables if new) */
+  TEST_ASSERT_GTE(current->mm.nr_ptes, initial_ptes);
 
   /* Task should have a PGD now */
   TEST_ASSERT_NEQ(0, current->mm.pgd);
@@ -261,14 +314,19 @@ static int test_mm_map_page(void) {
 /* Test: Guard page mapping */
 static int test_mm_map_guard_page(void) {
   /* Save current state */
-  int initial_kernel_pages = current->mm.kernel_pages_count;
+  unsigned long initial_ptes = current->mm.nr_ptes;
 
   /* Map a guard page at address 0 */
   unsigned long va = 0x600000; /* 6MB - use different address to not conflict */
-  map_guard_page(current, va);
+  TEST_ASSERT_EQ(0, map_guard_page(current, va));
 
-  /* Kernel pages should have increased (for page tables if new) */
-  TEST_ASSERT_GTE(current->mm.kernel_pages_count, initial_kernel_pages);
+  /* Page table count should have increased (for page tables if new) */
+  TEST_ASSERT_GTE(current->mm.nr_ptes, initial_ptes);
+
+  /* The entry is valid but gives EL0 no access */
+  unsigned long *pte = pte_lookup(current, va);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_EQ(0, *pte & MM_ACCESS_PERMISSION);
 
   /* Task should have a PGD */
   TEST_ASSERT_NEQ(0, current->mm.pgd);
@@ -285,30 +343,30 @@ static int test_mm_page_table_creation(void) {
   struct task_struct *test_task = (struct task_struct *)task_page;
 
   /* Initialize mm structure */
-  test_task->mm.pgd = 0;
-  test_task->mm.user_pages_count = 0;
-  test_task->mm.kernel_pages_count = 0;
+  memzero((unsigned long)&test_task->mm, sizeof(test_task->mm));
 
   /* Map a page - this should create the full hierarchy */
   unsigned long phys = get_free_page();
   TEST_ASSERT_NEQ(0, phys);
 
-  map_page(test_task, 0x1000, phys);
+  TEST_ASSERT_EQ(0, map_page(test_task, 0x1000, phys));
 
   /* Should have created PGD */
   TEST_ASSERT_NEQ(0, test_task->mm.pgd);
 
   /* Should have created additional page table levels */
-  /* PGD + PUD + PMD + PTE = 4 kernel pages minimum for first mapping */
-  TEST_ASSERT_GTE(test_task->mm.kernel_pages_count, 1);
-
-  /* User page should be tracked */
-  TEST_ASSERT_EQ(1, test_task->mm.user_pages_count);
-  TEST_ASSERT_EQ(0x1000, test_task->mm.user_pages[0].virt_addr);
-  TEST_ASSERT_EQ(phys, test_task->mm.user_pages[0].phys_addr);
-
-  /* Clean up */
-  free_page(phys);
+  /* PGD + PUD + PMD + PTE = 4 table pages for the first mapping */
+  TEST_ASSERT_EQ(4, test_task->mm.nr_ptes);
+
+  /* User page should be resident in the page tables */
+  TEST_ASSERT_EQ(1, test_task->mm.rss);
+  unsigned long *pte = pte_lookup(test_task, 0x1000);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_EQ(phys, *pte & PTE_ADDR_MASK);
+
+  /* Clean up: tables and the mapped page go back to the allocator */
+  exit_mm(test_task);
+  TEST_ASSERT_EQ(0, page_count(phys));
   free_page(task_page - VA_START);
 
   return TEST_PASS;
@@ -321,9 +379,7 @@ static int test_mm_multiple_user_pages(void) {
   TEST_ASSERT_NEQ(0, task_page);
 
   struct task_struct *test_task = (struct task_struct *)task_page;
-  test_task->mm.pgd = 0;
-  test_task->mm.user_pages_count = 0;
-  test_task->mm.kernel_pages_count = 0;
+  memzero((unsigned long)&test_task->mm, sizeof(test_task->mm));
 
   /* Allocate multiple user pages */
   unsigned long vas[] = {0x1000, 0x2000, 0x3000, 0x4000};
@@ -334,15 +390,18 @@ static int test_mm_multiple_user_pages(void) {
     TEST_ASSERT_NEQ(0, pages[i]);
   }
 
-  /* Should have 4 user pages tracked */
-  TEST_ASSERT_EQ(4, test_task->mm.user_pages_count);
+  /* Should have 4 resident user pages */
+  TEST_ASSERT_EQ(4, test_task->mm.rss);
 
   /* Verify each mapping */
   for (int i = 0; i < 4; i++) {
-    TEST_ASSERT_EQ(vas[i], test_task->mm.user_pages[i].virt_addr);
+    unsigned long *pte = pte_lookup(test_task, vas[i]);
+    TEST_ASSERT_NOT_NULL(pte);
+    TEST_ASSERT_EQ(pages[i] - VA_START, *pte & PTE_ADDR_MASK);
   }
 
   /* Clean up */
+  exit_mm(test_task);
   free_page(task_page - VA_START);
 
   return TEST_PASS;
@@ -365,6 +424,1072 @@ static int test_mm_exhaustion_recovery(void) {
   return TEST_PASS;
 }
 
+/* Test: Multi-order blocks are naturally aligned and distinct */
+static int test_mm_alloc_pages_alignment(void) {
+  unsigned long blocks[MAX_ORDER];
+
+  for (int order = 0; order < MAX_ORDER; order++) {
+    blocks[order] = alloc_pages(order);
+    TEST_ASSERT_NEQ(0, blocks[order]);
+    TEST_ASSERT_GTE(blocks[order], LOW_MEMORY);
+    TEST_ASSERT_LTE(blocks[order] + (PAGE_SIZE << order), HIGH_MEMORY);
+    TEST_ASSERT_EQ(0, blocks[order] & ((PAGE_SIZE << order) - 1));
+  }
+
+  /* No two blocks may overlap */
+  for (int i = 0; i < MAX_ORDER; i++) {
+    for (int j = i + 1; j < MAX_ORDER; j++) {
+      unsigned long end_i = blocks[i] + (PAGE_SIZE << i);
+      unsigned long end_j = blocks[j] + (PAGE_SIZE << j);
+      TEST_ASSERT(end_i <= blocks[j] || end_j <= blocks[i]);
+    }
+  }
+
+  for (int order = 0; order < MAX_ORDER; order++) {
+    free_pages(blocks[order], order);
+  }
+
+  return TEST_PASS;
+}
+
+/* Test: Orders outside the supported range are rejected */
+static int test_mm_alloc_pages_invalid_order(void) {
+  TEST_ASSERT_EQ(0, alloc_pages(-1));
+  TEST_ASSERT_EQ(0, alloc_pages(MAX_ORDER));
+
+  return TEST_PASS;
+}
+
+/* Test: Freeing split blocks merges them back into larger ones */
+static int test_mm_free_pages_coalesces(void) {
+  unsigned long free_before = nr_free_pages();
+  unsigned long top_before = free_area_count(MAX_ORDER - 1);
+
+  unsigned long pages[8];
+  for (int i = 0; i < 8; i++) {
+    pages[i] = alloc_pages(i % 3);
+    TEST_ASSERT_NEQ(0, pages[i]);
+  }
+  for (int i = 0; i < 8; i++) {
+    free_pages(pages[i], i % 3);
+  }
+
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+  TEST_ASSERT_EQ(top_before, free_area_count(MAX_ORDER - 1));
+
+  return TEST_PASS;
+}
+
+/* Test: Free page accounting tracks single-page alloc/free */
+static int test_mm_free_page_count(void) {
+  unsigned long free_before = nr_free_pages();
+
+  unsigned long page = get_free_page();
+  TEST_ASSERT_NEQ(0, page);
+  TEST_ASSERT_EQ(free_before - 1, nr_free_pages());
+
+  free_page(page);
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+
+  /* A double free must not inflate the count */
+  free_page(page);
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+
+  return TEST_PASS;
+}
+
+/* Test: Refill fills the pool and drain returns pages to the allocator */
+static int test_mm_zero_pool_refill(void) {
+  zero_pool_drain();
+  unsigned long free_before = nr_free_pages();
+  TEST_ASSERT_EQ(0, zero_pool_pages());
+
+  zero_pool_refill();
+  TEST_ASSERT_GT(zero_pool_pages(), 0);
+  /* Pooled pages still count as free memory */
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+
+  zero_pool_drain();
+  TEST_ASSERT_EQ(0, zero_pool_pages());
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+
+  return TEST_PASS;
+}
+
+/* Test: Pages handed out from the pool are zeroed even if dirtied before */
+static int test_mm_zero_pool_pages_zeroed(void) {
+  /* Dirty a page and give it back so the pool is likely to reuse it */
+  unsigned long dirty = get_free_page_nozero();
+  TEST_ASSERT_NEQ(0, dirty);
+  unsigned char *p = (unsigned char *)(dirty + VA_START);
+  for (int i = 0; i < PAGE_SIZE; i++) {
+    p[i] = 0xCC;
+  }
+  free_page(dirty);
+
+  zero_pool_refill();
+  int pooled = zero_pool_pages();
+  TEST_ASSERT_GT(pooled, 0);
+
+  unsigned long page = get_free_page();
+  TEST_ASSERT_NEQ(0, page);
+  TEST_ASSERT_EQ(pooled - 1, zero_pool_pages());
+  TEST_ASSERT(is_memory_zeroed(page + VA_START, PAGE_SIZE));
+
+  free_page(page);
+  zero_pool_drain();
+
+  return TEST_PASS;
+}
+
+/* Test: A dry allocator takes from the pool only what it needs */
+static int test_mm_zero_pool_when_dry(void) {
+  zero_pool_drain();
+  unsigned long block = alloc_pages(1);
+  TEST_ASSERT_NEQ(0, block);
+  /* Take every page there is, linked through their first words */
+  unsigned long hoard = 0;
+  unsigned long page;
+  while ((page = get_free_page_nozero()) != 0) {
+    *(unsigned long *)(page + VA_START) = hoard;
+    hoard = page;
+  }
+  /* Pool a page that cannot merge, then both halves of the block */
+  unsigned long lone = hoard;
+  hoard = *(unsigned long *)(lone + VA_START);
+  free_page(lone);
+  zero_pool_refill();
+  free_pages(block, 1);
+  zero_pool_refill();
+  int pooled = zero_pool_pages();
+
+  /* Order 0 is served straight from the pool */
+  unsigned long single = get_free_page_nozero();
+  int order0_left = zero_pool_pages();
+  if (single) {
+    free_page(single);
+  }
+  /* Order 1 frees pooled pages until the block merges again, and no more */
+  unsigned long merged = alloc_pages(1);
+  int order1_left = zero_pool_pages();
+  if (merged) {
+    free_pages(merged, 1);
+  }
+
+  zero_pool_drain();
+  while (hoard) {
+    page = hoard;
+    hoard = *(unsigned long *)(page + VA_START);
+    free_page(page);
+  }
+
+  TEST_ASSERT_EQ(3, pooled);
+  TEST_ASSERT_NEQ(0, single);
+  TEST_ASSERT_EQ(2, order0_left);
+  TEST_ASSERT_EQ(block, merged);
+  TEST_ASSERT_EQ(1, order1_left);
+
+  return TEST_PASS;
+}
+
+/* Test: The no-zero variant bypasses the pool */
+static int test_mm_get_free_page_nozero(void) {
+  zero_pool_refill();
+  int pooled = zero_pool_pages();
+
+  unsigned long page = get_free_page_nozero();
+  TEST_ASSERT_NEQ(0, page);
+  TEST_ASSERT_EQ(0, page & (PAGE_SIZE - 1));
+  TEST_ASSERT_EQ(pooled, zero_pool_pages());
+
+  free_page(page);
+  zero_pool_drain();
+
+  return TEST_PASS;
+}
+
+/* Test: struct page is 16 bytes, and low memory and mem_map are pinned */
+static int test_mm_page_struct_layout(void) {
+  TEST_ASSERT_EQ(16, sizeof(struct page));
+
+  unsigned long map = (unsigned long)mem_map - VA_START;
+  TEST_ASSERT_EQ(LOW_MEMORY, map);
+  unsigned long pinned[] = {0, LOW_MEMORY - PAGE_SIZE, map};
+  for (int i = 0; i < 3; i++) {
+    struct page *page = phys_to_page(pinned[i]);
+    TEST_ASSERT_NOT_NULL(page);
+    TEST_ASSERT_EQ(PG_KERNEL | PG_PINNED,
+                   page->flags & (PG_KERNEL | PG_PINNED));
+    /* References to pinned pages are not counted */
+    get_page(pinned[i]);
+    TEST_ASSERT_EQ(0, page_count(pinned[i]));
+  }
+  TEST_ASSERT(phys_to_page(ZERO_PAGE)->flags & PG_ZERO);
+  TEST_ASSERT_NULL(phys_to_page(HIGH_MEMORY));
+
+  return TEST_PASS;
+}
+
+/* Test: Flags record what a page is used for and are cleared on free */
+static int test_mm_page_flags_follow_owner(void) {
+  unsigned long kpage = allocate_kernel_page();
+  TEST_ASSERT_NEQ(0, kpage);
+  struct page *page = phys_to_page(kpage - VA_START);
+  TEST_ASSERT_EQ(PG_KERNEL, page->flags);
+  TEST_ASSERT_EQ(1, page->refcount);
+  TEST_ASSERT_EQ(0, page->mapcount);
+
+  struct task_struct *task = (struct task_struct *)kpage;
+  memzero((unsigned long)&task->mm, sizeof(task->mm));
+  unsigned long user = get_free_page();
+  TEST_ASSERT_NEQ(0, user);
+  TEST_ASSERT_EQ(0, map_page(task, 0x1000, user));
+  TEST_ASSERT_EQ(PG_PAGETABLE, phys_to_page(task->mm.pgd)->flags);
+  TEST_ASSERT_EQ(PG_USER, phys_to_page(user)->flags);
+  TEST_ASSERT_EQ(1, page_mapcount(user));
+
+  exit_mm(task);
+  TEST_ASSERT_EQ(0, phys_to_page(user)->flags);
+  free_page(kpage - VA_START);
+  TEST_ASSERT_EQ(0, page->flags);
+  TEST_ASSERT_EQ(0, page->refcount);
+
+  return TEST_PASS;
+}
+
+/* Test: The buddy lists live in mem_map, not in the free memory */
+static int test_mm_free_pages_leave_memory_alone(void) {
+  unsigned long block = alloc_pages(1);
+  TEST_ASSERT_NEQ(0, block);
+  unsigned long *words = (unsigned long *)(block + VA_START);
+  for (unsigned long i = 0; i < 2 * PAGE_SIZE / 8; i++) {
+    words[i] = ~i;
+  }
+
+  free_pages(block, 1);
+  for (unsigned long i = 0; i < 2 * PAGE_SIZE / 8; i++) {
+    TEST_ASSERT_EQ(~i, words[i]);
+  }
+
+  return TEST_PASS;
+}
+
+#define COW_VA 0x1000UL
+#define COW_MAGIC 0xC0FFEEUL
+/* Level 3 permission fault on a write */
+#define COW_WRITE_ESR (ESR_ELx_WNR | 0x0f)
+
+/* Fork parent into child as sys_fork would, with parent as current */
+static int cow_fork(struct task_struct *parent, struct task_struct *child) {
+  preempt_disable();
+  struct task_struct *self = current;
+  current = parent;
+  int ret = copy_virt_memory(child);
+  current = self;
+  preempt_enable();
+  return ret;
+}
+
+/* Deliver the write fault task would take on va */
+static int cow_write_fault(struct task_struct *task, unsigned long va) {
+  preempt_disable();
+  struct task_struct *self = current;
+  current = task;
+  int ret = do_mem_abort(va, COW_WRITE_ESR);
+  current = self;
+  preempt_enable();
+  return ret;
+}
+
+/* Parent with one user page at COW_VA holding COW_MAGIC, forked into child */
+static int cow_setup(struct task_struct **parent, struct task_struct **child) {
+  *parent = test_task();
+  *child = test_task();
+  if (*parent == 0 || *child == 0) {
+    return -1;
+  }
+  if (insert_vma(&(*parent)->mm, COW_VA, COW_VA + PAGE_SIZE,
+                 VM_READ | VM_WRITE | VM_ANON) < 0) {
+    return -1;
+  }
+  unsigned long page = allocate_user_page(*parent, COW_VA);
+  if (page == 0) {
+    return -1;
+  }
+  *(unsigned long *)page = COW_MAGIC;
+  return cow_fork(*parent, *child);
+}
+
+/* Physical page task has mapped at COW_VA */
+static unsigned long cow_page(struct task_struct *task) {
+  unsigned long *pte = pte_lookup(task, COW_VA);
+  return pte ? *pte & PTE_ADDR_MASK : 0;
+}
+
+static void cow_teardown(struct task_struct *parent,
+                         struct task_struct *child) {
+  test_task_free(parent);
+  test_task_free(child);
+}
+
+/* Test: Fork shares user pages read-only instead of copying them */
+static int test_mm_cow_fork_shares_pages(void) {
+  struct task_struct *parent, *child;
+  TEST_ASSERT_EQ(0, cow_setup(&parent, &child));
+
+  unsigned long page = cow_page(parent);
+  TEST_ASSERT_EQ(1, child->mm.rss);
+  TEST_ASSERT_EQ(1, child->mm.map_count);
+  TEST_ASSERT_EQ(page, cow_page(child));
+  TEST_ASSERT_EQ(2, page_count(page));
+
+  unsigned long *parent_pte = pte_lookup(parent, COW_VA);
+  unsigned long *child_pte = pte_lookup(child, COW_VA);
+  TEST_ASSERT_NOT_NULL(parent_pte);
+  TEST_ASSERT_NOT_NULL(child_pte);
+  TEST_ASSERT_EQ(*parent_pte, *child_pte);
+  TEST_ASSERT_EQ(MM_AP_RDONLY, *parent_pte & MM_AP_RDONLY);
+  TEST_ASSERT(*parent_pte & PTE_COW);
+
+  cow_teardown(parent, child);
+
+  return TEST_PASS;
+}
+
+/* Test: The first write takes a private copy of a shared page */
+static int test_mm_cow_write_fault_copies(void) {
+  struct task_struct *parent, *child;
+  TEST_ASSERT_EQ(0, cow_setup(&parent, &child));
+  unsigned long shared = cow_page(parent);
+
+  TEST_ASSERT_EQ(0, cow_write_fault(child, COW_VA + 8));
+
+  unsigned long copy = cow_page(child);
+  TEST_ASSERT_NEQ(shared, copy);
+  TEST_ASSERT_EQ(COW_MAGIC, *(unsigned long *)(copy + VA_START));
+  TEST_ASSERT_EQ(1, page_count(shared));
+  TEST_ASSERT_EQ(1, page_count(copy));
+
+  unsigned long *child_pte = pte_lookup(child, COW_VA);
+  TEST_ASSERT_EQ(copy, *child_pte & PTE_ADDR_MASK);
+  TEST_ASSERT_EQ(0, *child_pte & (MM_AP_RDONLY | PTE_COW));
+  /* The parent still has to fault before it may write */
+  TEST_ASSERT(*pte_lookup(parent, COW_VA) & PTE_COW);
+
+  cow_teardown(parent, child);
+
+  return TEST_PASS;
+}
+
+/* Test: Once every other sharer has copied, the page is reused in place */
+static int test_mm_cow_last_sharer_reuses(void) {
+  struct task_struct *parent, *child;
+  TEST_ASSERT_EQ(0, cow_setup(&parent, &child));
+  unsigned long shared = cow_page(parent);
+
+  TEST_ASSERT_EQ(0, cow_write_fault(child, COW_VA));
+  unsigned long free_before = nr_free_pages();
+  TEST_ASSERT_EQ(0, cow_write_fault(parent, COW_VA));
+
+  /* No copy: same page, now writable */
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+  TEST_ASSERT_EQ(shared, cow_page(parent));
+  unsigned long *parent_pte = pte_lookup(parent, COW_VA);
+  TEST_ASSERT_EQ(shared, *parent_pte & PTE_ADDR_MASK);
+  TEST_ASSERT_EQ(0, *parent_pte & (MM_AP_RDONLY | PTE_COW));
+
+  cow_teardown(parent, child);
+
+  return TEST_PASS;
+}
+
+/* Test: Kernel stores into a shared user page only reach the writer */
+static int test_mm_copy_to_user_breaks_cow(void) {
+  struct task_struct *parent, *child;
+  TEST_ASSERT_EQ(0, cow_setup(&parent, &child));
+  unsigned long shared = cow_page(parent);
+  unsigned long value = 0x1234;
+
+  preempt_disable();
+  struct task_struct *self = current;
+  current = child;
+  int ret = copy_to_user(COW_VA + 16, &value, sizeof(value));
+  /* Nothing is mapped at the guard address */
+  int bad = copy_to_user(0, &value, sizeof(value));
+  current = self;
+  preempt_enable();
+
+  TEST_ASSERT_EQ(0, ret);
+  TEST_ASSERT_EQ(-1, bad);
+  unsigned long copy = cow_page(child);
+  TEST_ASSERT_NEQ(shared, copy);
+  TEST_ASSERT_EQ(0x1234, *(unsigned long *)(copy + VA_START + 16));
+  TEST_ASSERT_EQ(COW_MAGIC, *(unsigned long *)(copy + VA_START));
+  TEST_ASSERT_EQ(0, *(unsigned long *)(shared + VA_START + 16));
+
+  cow_teardown(parent, child);
+
+  return TEST_PASS;
+}
+
+/* Test: mapcount counts the user page table entries mapping a page */
+static int test_mm_page_mapcount_follows_mappings(void) {
+  struct task_struct *parent, *child;
+  TEST_ASSERT_EQ(0, cow_setup(&parent, &child));
+
+  unsigned long shared = cow_page(parent);
+  TEST_ASSERT_EQ(2, page_mapcount(shared));
+  TEST_ASSERT(phys_to_page(shared)->flags & PG_USER);
+
+  TEST_ASSERT_EQ(0, cow_write_fault(child, COW_VA));
+  unsigned long copy = cow_page(child);
+  TEST_ASSERT_NEQ(shared, copy);
+  TEST_ASSERT_EQ(1, page_mapcount(shared));
+  TEST_ASSERT_EQ(1, page_mapcount(copy));
+
+  TEST_ASSERT_EQ(0, unmap_range(child, COW_VA, 1));
+  TEST_ASSERT_EQ(0, page_mapcount(copy));
+  TEST_ASSERT_EQ(1, page_mapcount(shared));
+
+  cow_teardown(parent, child);
+  TEST_ASSERT_EQ(0, page_mapcount(shared));
+
+  return TEST_PASS;
+}
+
+#define FAULT_VA 0x40000000UL
+
+/* A task with an anonymous VMA of pages pages at FAULT_VA + first pages */
+static struct task_struct *fault_task(unsigned long first,
+                                      unsigned long pages) {
+  return test_anon_task(FAULT_VA + first * PAGE_SIZE, pages, 0);
+}
+
+static int fault_mapped(struct task_struct *task, unsigned long page) {
+  unsigned long *pte = pte_lookup(task, FAULT_VA + page * PAGE_SIZE);
+  return pte && (*pte & PTE_VALID) && (*pte & MM_ACCESS_PERMISSION);
+}
+
+/* Test: One fault maps the whole aligned window around the faulting page */
+static int test_mm_fault_around_maps_window(void) {
+  unsigned long window = get_fault_around_pages();
+  struct task_struct *task = fault_task(0, 4 * window);
+  TEST_ASSERT_NOT_NULL(task);
+
+  unsigned long va = FAULT_VA + (window + 3) * PAGE_SIZE + 8;
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, va, 0));
+  TEST_ASSERT_EQ(1, task->mm.min_flt);
+  TEST_ASSERT_EQ(window, task->mm.rss);
+  for (unsigned long i = window; i < 2 * window; i++) {
+    TEST_ASSERT(fault_mapped(task, i));
+  }
+  TEST_ASSERT(!fault_mapped(task, window - 1));
+  TEST_ASSERT(!fault_mapped(task, 2 * window));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: The window stops at the VMA and leaves present entries alone */
+static int test_mm_fault_around_clipped(void) {
+  struct task_struct *task = fault_task(2, 4);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, map_guard_page(task, FAULT_VA + 4 * PAGE_SIZE));
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA + 2 * PAGE_SIZE, 1));
+  TEST_ASSERT_EQ(3, task->mm.rss);
+  TEST_ASSERT(fault_mapped(task, 2));
+  TEST_ASSERT(fault_mapped(task, 3));
+  TEST_ASSERT(fault_mapped(task, 5));
+  /* Still the guard page */
+  TEST_ASSERT(!fault_mapped(task, 4));
+  TEST_ASSERT_NOT_NULL(pte_lookup(task, FAULT_VA + 4 * PAGE_SIZE));
+  /* Outside the VMA */
+  TEST_ASSERT(!fault_mapped(task, 1));
+  TEST_ASSERT(!fault_mapped(task, 6));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: The window size can be tuned, down to one page per fault */
+static int test_mm_fault_around_config(void) {
+  unsigned long saved = get_fault_around_pages();
+  TEST_ASSERT_EQ(-1, set_fault_around_pages(0));
+  TEST_ASSERT_EQ(-1, set_fault_around_pages(3));
+  TEST_ASSERT_EQ(-1, set_fault_around_pages(2 * PTRS_PER_TABLE));
+  TEST_ASSERT_EQ(saved, get_fault_around_pages());
+  TEST_ASSERT_EQ(0, set_fault_around_pages(1));
+
+  struct task_struct *task = fault_task(0, 8);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA + PAGE_SIZE, 0));
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA + 2 * PAGE_SIZE, 0));
+  TEST_ASSERT_EQ(2, task->mm.rss);
+  TEST_ASSERT_EQ(2, task->mm.min_flt);
+  /* Outside any VMA is not a minor fault */
+  TEST_ASSERT_EQ(-1, handle_mm_fault(task, FAULT_VA + 8 * PAGE_SIZE, 0));
+  TEST_ASSERT_EQ(2, task->mm.min_flt);
+
+  TEST_ASSERT_EQ(0, set_fault_around_pages(saved));
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Minor faults count against the faulting task and no other */
+static int test_mm_fault_stats_per_task(void) {
+  struct task_struct *a = fault_task(0, 8);
+  struct task_struct *b = fault_task(0, 8);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+  TEST_ASSERT_EQ(0, test_task_list(a));
+  TEST_ASSERT_EQ(0, test_task_list(b));
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(a, FAULT_VA, 1));
+  TEST_ASSERT_EQ(1, a->mm.min_flt);
+  TEST_ASSERT_EQ(0, b->mm.min_flt);
+  TEST_ASSERT_EQ(0, handle_mm_fault(b, FAULT_VA + 4 * PAGE_SIZE, 0));
+  TEST_ASSERT_EQ(1, a->mm.min_flt);
+  TEST_ASSERT_EQ(1, b->mm.min_flt);
+  /* Both listed with page tables now, so both show up */
+  fault_print_stats();
+
+  test_task_unlist(a);
+  test_task_unlist(b);
+  test_task_free(a);
+  test_task_free(b);
+
+  return TEST_PASS;
+}
+
+/* Test: Reads of untouched memory map the zero page instead of allocating */
+static int test_mm_zero_page_read_fault(void) {
+  unsigned long window = get_fault_around_pages();
+  struct task_struct *task = fault_task(0, 2 * window);
+  TEST_ASSERT_NOT_NULL(task);
+
+  /* The first window brings in the page tables, the second costs nothing */
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA, 0));
+  unsigned long free_before = nr_free_pages();
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA + window * PAGE_SIZE, 0));
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+  TEST_ASSERT_EQ(2 * window, task->mm.rss);
+  for (unsigned long i = 0; i < 2 * window; i++) {
+    unsigned long *pte = pte_lookup(task, FAULT_VA + i * PAGE_SIZE);
+    TEST_ASSERT_NOT_NULL(pte);
+    TEST_ASSERT_EQ(ZERO_PAGE, *pte & PTE_ADDR_MASK);
+    TEST_ASSERT_EQ(MM_AP_RDONLY, *pte & MM_AP_RDONLY);
+    TEST_ASSERT(*pte & PTE_COW);
+  }
+  TEST_ASSERT(is_memory_zeroed((unsigned long)empty_zero_page, PAGE_SIZE));
+
+  test_task_free(task);
+  TEST_ASSERT(is_memory_zeroed((unsigned long)empty_zero_page, PAGE_SIZE));
+
+  return TEST_PASS;
+}
+
+/* Test: Writing after a read takes a private zeroed page for that page only */
+static int test_mm_zero_page_write_after_read(void) {
+  struct task_struct *task = fault_task(0, get_fault_around_pages());
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA, 0));
+  unsigned long rss = task->mm.rss;
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA + PAGE_SIZE + 16, 1));
+  TEST_ASSERT_EQ(rss, task->mm.rss);
+
+  unsigned long *pte = pte_lookup(task, FAULT_VA + PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(pte);
+  unsigned long page = *pte & PTE_ADDR_MASK;
+  TEST_ASSERT_NEQ(ZERO_PAGE, page);
+  TEST_ASSERT_EQ(0, *pte & (MM_AP_RDONLY | PTE_COW));
+  TEST_ASSERT_EQ(1, page_count(page));
+  TEST_ASSERT(is_memory_zeroed(page + VA_START, PAGE_SIZE));
+  /* Its neighbours still read the zero page */
+  pte = pte_lookup(task, FAULT_VA);
+  TEST_ASSERT_EQ(ZERO_PAGE, *pte & PTE_ADDR_MASK);
+
+  test_task_free(task);
+  TEST_ASSERT(is_memory_zeroed((unsigned long)empty_zero_page, PAGE_SIZE));
+
+  return TEST_PASS;
+}
+
+#define HUGE_VA 0x80000000UL
+
+/* A task with an anonymous VM_HUGEPAGE VMA over [start, end) */
+static struct task_struct *huge_task(unsigned long start, unsigned long end) {
+  struct task_struct *task = test_task();
+  if (task == 0) {
+    return 0;
+  }
+  if (insert_vma(&task->mm, start, end,
+                 VM_READ | VM_WRITE | VM_ANON | VM_HUGEPAGE) < 0) {
+    return 0;
+  }
+  return task;
+}
+
+/* Head page of the block mapped at va, or 0 */
+static unsigned long huge_block(struct task_struct *task, unsigned long va) {
+  unsigned long *pmd = pmd_lookup(task, va);
+  if (pmd == 0 || (*pmd & MM_TYPE_MASK) != MM_TYPE_BLOCK) {
+    return 0;
+  }
+  return *pmd & PTE_ADDR_MASK;
+}
+
+/* Test: One fault maps a whole aligned 2 MiB block */
+static int test_mm_huge_fault_maps_block(void) {
+  struct task_struct *task = huge_task(HUGE_VA, HUGE_VA + 2 * SECTION_SIZE);
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, HUGE_VA + SECTION_SIZE + 0x1234, 1));
+  unsigned long block = huge_block(task, HUGE_VA + SECTION_SIZE);
+  TEST_ASSERT_NEQ(0, block);
+  TEST_ASSERT_EQ(0, block & (SECTION_SIZE - 1));
+  TEST_ASSERT_EQ(HUGE_PAGE_ORDER, page_alloc_order(block));
+  TEST_ASSERT_EQ(HUGE_PAGE_PAGES, task->mm.rss);
+  TEST_ASSERT_EQ(1, task->mm.min_flt);
+  /* No PTE table behind a block */
+  TEST_ASSERT_NULL(pte_lookup(task, HUGE_VA + SECTION_SIZE));
+  TEST_ASSERT(is_memory_zeroed(block + VA_START, SECTION_SIZE));
+
+  /* Touching it again is a stale-TLB fault, not a new mapping */
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, HUGE_VA + 2 * SECTION_SIZE - 8, 0));
+  TEST_ASSERT_EQ(block, huge_block(task, HUGE_VA + SECTION_SIZE));
+  TEST_ASSERT_EQ(HUGE_PAGE_PAGES, task->mm.rss);
+
+  test_task_free(task);
+  TEST_ASSERT_EQ(0, page_count(block));
+
+  return TEST_PASS;
+}
+
+/* Test: A VMA that does not cover the whole block gets 4 KiB pages */
+static int test_mm_huge_fault_needs_whole_block(void) {
+  struct task_struct *task =
+      huge_task(HUGE_VA + PAGE_SIZE, HUGE_VA + SECTION_SIZE);
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, HUGE_VA + PAGE_SIZE, 1));
+  TEST_ASSERT_EQ(0, huge_block(task, HUGE_VA));
+  TEST_ASSERT_NOT_NULL(pte_lookup(task, HUGE_VA + PAGE_SIZE));
+  TEST_ASSERT_EQ(get_fault_around_pages() - 1, task->mm.rss);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Unmapping part of a block splits it into pages */
+static int test_mm_huge_zap_splits_block(void) {
+  struct task_struct *task = huge_task(HUGE_VA, HUGE_VA + SECTION_SIZE);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, HUGE_VA, 1));
+  unsigned long block = huge_block(task, HUGE_VA);
+  TEST_ASSERT_NEQ(0, block);
+  *(unsigned long *)(block + VA_START + 5 * PAGE_SIZE) = COW_MAGIC;
+
+  TEST_ASSERT_EQ(0, unmap_range(task, HUGE_VA + 4 * PAGE_SIZE, 1));
+  TEST_ASSERT_EQ(0, huge_block(task, HUGE_VA));
+  TEST_ASSERT_EQ(HUGE_PAGE_PAGES - 1, task->mm.rss);
+  /* The zapped page went back on its own, its neighbours stay in place */
+  TEST_ASSERT_EQ(0, page_count(block + 4 * PAGE_SIZE));
+  TEST_ASSERT_EQ(1, page_count(block + 5 * PAGE_SIZE));
+  TEST_ASSERT_EQ(0, page_alloc_order(block + 5 * PAGE_SIZE));
+  unsigned long *pte = pte_lookup(task, HUGE_VA + 5 * PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_EQ(block + 5 * PAGE_SIZE, *pte & PTE_ADDR_MASK);
+  TEST_ASSERT_EQ(MM_TYPE_PAGE, *pte & MM_TYPE_MASK);
+  TEST_ASSERT_EQ(COW_MAGIC,
+                 *(unsigned long *)(block + VA_START + 5 * PAGE_SIZE));
+  /* Only the run holding the hole lost the contiguous hint */
+  TEST_ASSERT_EQ(0, *pte & PTE_CONT);
+  TEST_ASSERT(*pte_lookup(task, HUGE_VA + CONT_PTE_SIZE) & PTE_CONT);
+
+  test_task_free(task);
+  TEST_ASSERT_EQ(0, page_count(block + 5 * PAGE_SIZE));
+
+  return TEST_PASS;
+}
+
+/* Test: Fork shares a block copy-on-write; a write takes a private copy */
+static int test_mm_huge_cow_fork(void) {
+  struct task_struct *parent = huge_task(HUGE_VA, HUGE_VA + SECTION_SIZE);
+  struct task_struct *child = test_task();
+  TEST_ASSERT_NOT_NULL(parent);
+  TEST_ASSERT_NOT_NULL(child);
+  TEST_ASSERT_EQ(0, handle_mm_fault(parent, HUGE_VA, 1));
+  unsigned long block = huge_block(parent, HUGE_VA);
+  TEST_ASSERT_NEQ(0, block);
+  *(unsigned long *)(block + VA_START + PAGE_SIZE) = COW_MAGIC;
+
+  TEST_ASSERT_EQ(0, cow_fork(parent, child));
+  TEST_ASSERT_EQ(block, huge_block(child, HUGE_VA));
+  TEST_ASSERT_EQ(2, page_count(block));
+  TEST_ASSERT_EQ(HUGE_PAGE_PAGES, child->mm.rss);
+  TEST_ASSERT(*pmd_lookup(parent, HUGE_VA) & PTE_COW);
+
+  TEST_ASSERT_EQ(0, cow_write_fault(child, HUGE_VA + PAGE_SIZE));
+  TEST_ASSERT_EQ(1, page_count(block));
+  /* Either a new block or, without contiguous memory, a split copy */
+  unsigned long *pte = pte_lookup(child, HUGE_VA + PAGE_SIZE);
+  unsigned long copy = huge_block(child, HUGE_VA);
+  copy = copy ? copy + PAGE_SIZE : *pte & PTE_ADDR_MASK;
+  TEST_ASSERT_NEQ(block + PAGE_SIZE, copy);
+  TEST_ASSERT_EQ(COW_MAGIC, *(unsigned long *)(copy + VA_START));
+  TEST_ASSERT(*pmd_lookup(parent, HUGE_VA) & PTE_COW);
+
+  cow_teardown(parent, child);
+  TEST_ASSERT_EQ(0, page_count(block));
+
+  return TEST_PASS;
+}
+
+#define RANGE_VA 0xa0000000UL
+#define RANGE_ORDER 10
+#define RANGE_PAGES (1UL << RANGE_ORDER)
+
+/* A task with one RANGE_PAGES run of single pages; *run gets its start */
+static struct task_struct *range_task(unsigned long *run) {
+  struct task_struct *task = test_task();
+  if (task == 0) {
+    return 0;
+  }
+  *run = alloc_pages(RANGE_ORDER);
+  if (*run == 0) {
+    return 0;
+  }
+  split_page(*run, RANGE_ORDER);
+  return task;
+}
+
+/* Test: One call maps a run across PTE tables, hinting whole 64 KiB runs */
+static int test_mm_map_range_spans_tables(void) {
+  unsigned long run;
+  struct task_struct *task = range_task(&run);
+  TEST_ASSERT_NOT_NULL(task);
+  /* Straddles a 2 MiB boundary, CONT_PTES pages before it */
+  unsigned long va = RANGE_VA + SECTION_SIZE - CONT_PTE_SIZE;
+
+  TEST_ASSERT_EQ(0, map_range(task, va, run, RANGE_PAGES, MMU_PTE_FLAGS));
+  TEST_ASSERT_EQ(RANGE_PAGES, task->mm.rss);
+  /* PGD, PUD, PMD and three PTE tables */
+  TEST_ASSERT_EQ(6, task->mm.nr_ptes);
+  for (unsigned long i = 0; i < RANGE_PAGES; i++) {
+    unsigned long *pte = pte_lookup(task, va + i * PAGE_SIZE);
+    TEST_ASSERT_NOT_NULL(pte);
+    TEST_ASSERT_EQ(run + i * PAGE_SIZE, *pte & PTE_ADDR_MASK);
+    TEST_ASSERT_EQ(MMU_PTE_FLAGS | PTE_CONT, *pte & ~PTE_ADDR_MASK);
+  }
+  TEST_ASSERT_EQ(0, *pte_lookup(task, va - PAGE_SIZE));
+  TEST_ASSERT_EQ(0, *pte_lookup(task, va + RANGE_PAGES * PAGE_SIZE));
+
+  /* Drops the pages along with the tables */
+  test_task_free(task);
+  TEST_ASSERT_EQ(0, page_count(run));
+
+  return TEST_PASS;
+}
+
+/* Test: Mapping over present entries keeps the resident count right */
+static int test_mm_map_range_replaces(void) {
+  unsigned long run;
+  struct task_struct *task = range_task(&run);
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, map_range(task, RANGE_VA, run, 4, MMU_PTE_FLAGS));
+  TEST_ASSERT_EQ(0, map_guard_page(task, RANGE_VA + PAGE_SIZE));
+  TEST_ASSERT_EQ(3, task->mm.rss);
+  /* Over a guard page, two present pages and an empty slot */
+  TEST_ASSERT_EQ(0, map_range(task, RANGE_VA + PAGE_SIZE,
+                              run + 4 * PAGE_SIZE, 4, MMU_PTE_FLAGS));
+  TEST_ASSERT_EQ(5, task->mm.rss);
+  TEST_ASSERT_EQ(run + 7 * PAGE_SIZE,
+                 *pte_lookup(task, RANGE_VA + 4 * PAGE_SIZE) & PTE_ADDR_MASK);
+  /* The replaced pages are no longer mapped; the caller still owns them */
+  put_page(run + PAGE_SIZE);
+  put_page(run + 2 * PAGE_SIZE);
+  put_page(run + 3 * PAGE_SIZE);
+
+  test_task_free(task);
+  for (unsigned long i = 8; i < RANGE_PAGES; i++) {
+    put_page(run + i * PAGE_SIZE);
+  }
+  TEST_ASSERT_EQ(0, page_count(run + 7 * PAGE_SIZE));
+
+  return TEST_PASS;
+}
+
+/* Test: Emptied PTE tables are unlinked and reused by the next mapping */
+static int test_mm_unmap_range_caches_tables(void) {
+  unsigned long run;
+  struct task_struct *task = range_task(&run);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, map_range(task, RANGE_VA, run, RANGE_PAGES,
+                              MMU_PTE_FLAGS));
+  TEST_ASSERT_EQ(5, task->mm.nr_ptes);
+
+  /* Half of the first table leaves it in place */
+  TEST_ASSERT_EQ(0, unmap_range(task, RANGE_VA, RANGE_PAGES / 4));
+  TEST_ASSERT_EQ(5, task->mm.nr_ptes);
+  TEST_ASSERT_EQ(0, page_count(run));
+  TEST_ASSERT_EQ(3 * RANGE_PAGES / 4, task->mm.rss);
+
+  /* Unmapping the rest frees both PTE tables into the cache */
+  TEST_ASSERT_EQ(0, unmap_range(task, RANGE_VA, RANGE_PAGES));
+  TEST_ASSERT_EQ(0, task->mm.rss);
+  TEST_ASSERT_EQ(3, task->mm.nr_ptes);
+  TEST_ASSERT_EQ(2, task->mm.nr_cached_tables);
+  TEST_ASSERT_NULL(pte_lookup(task, RANGE_VA));
+
+  unsigned long free_before = nr_free_pages();
+  unsigned long page = get_free_page();
+  TEST_ASSERT_NEQ(0, page);
+  TEST_ASSERT_EQ(0, map_page(task, RANGE_VA, page));
+  TEST_ASSERT_EQ(1, task->mm.nr_cached_tables);
+  TEST_ASSERT_EQ(4, task->mm.nr_ptes);
+  /* Only the mapped page came from the allocator */
+  TEST_ASSERT_EQ(free_before - 1, nr_free_pages());
+
+  test_task_free(task);
+  TEST_ASSERT_EQ(0, task->mm.nr_cached_tables);
+
+  return TEST_PASS;
+}
+
+#define HUGE_BENCH_VA 0x100000000UL
+#define HUGE_BENCH_SIZE (16UL << 20)
+#define HUGE_BENCH_PASSES 8
+#define HUGE_BENCH_PMU_COUNTER 0
+
+/* A task with HUGE_BENCH_SIZE faulted in at HUGE_BENCH_VA */
+static struct task_struct *huge_bench_task(unsigned long vm_flags) {
+  struct task_struct *task = test_task();
+  if (task == 0 ||
+      insert_vma(&task->mm, HUGE_BENCH_VA, HUGE_BENCH_VA + HUGE_BENCH_SIZE,
+                 VM_READ | VM_WRITE | VM_ANON | vm_flags) < 0) {
+    return 0;
+  }
+  for (unsigned long off = 0; off < HUGE_BENCH_SIZE; off += PAGE_SIZE) {
+    if (handle_mm_fault(task, HUGE_BENCH_VA + off, 1) < 0) {
+      return 0;
+    }
+  }
+  return task;
+}
+
+/* Cycles per page touched striding through the working set from a cold TLB */
+static unsigned long huge_bench_walk(struct task_struct *task,
+                                     unsigned long *refills) {
+  preempt_disable();
+  switch_mm(&task->mm);
+  flush_tlb_all();
+  unsigned long refill_start = pmu_read_event_counter(HUGE_BENCH_PMU_COUNTER);
+  unsigned long start = get_cycles();
+  for (int pass = 0; pass < HUGE_BENCH_PASSES; pass++) {
+    for (unsigned long off = 0; off < HUGE_BENCH_SIZE; off += PAGE_SIZE) {
+      (*(volatile unsigned long *)(HUGE_BENCH_VA + off))++;
+    }
+  }
+  unsigned long cycles = get_cycles() - start;
+  *refills = pmu_read_event_counter(HUGE_BENCH_PMU_COUNTER) - refill_start;
+  switch_mm(current->active_mm);
+  preempt_enable();
+  return cycles / (HUGE_BENCH_PASSES * (HUGE_BENCH_SIZE / PAGE_SIZE));
+}
+
+/* Benchmark: TLB refills over 16 MiB mapped with 4 KiB pages vs 2 MiB blocks */
+static int test_mm_bench_huge_tlb(void) {
+  struct task_struct *small = huge_bench_task(0);
+  TEST_ASSERT_NOT_NULL(small);
+  struct task_struct *huge = huge_bench_task(VM_HUGEPAGE);
+  TEST_ASSERT_NOT_NULL(huge);
+  unsigned long small_faults = small->mm.min_flt;
+  unsigned long huge_faults = huge->mm.min_flt;
+
+  pmu_enable_cycle_counter();
+  pmu_enable_event_counter(HUGE_BENCH_PMU_COUNTER, PMU_EVENT_L1D_TLB_REFILL);
+  unsigned long small_refills, huge_refills;
+  unsigned long small_cycles = huge_bench_walk(small, &small_refills);
+  unsigned long huge_cycles = huge_bench_walk(huge, &huge_refills);
+
+  printf("\r\n    16 MiB x%d: 4K %lu faults %lu cycles/page %lu TLB refills, "
+         "2M %lu faults %lu cycles/page %lu TLB refills\r\n    ",
+         HUGE_BENCH_PASSES, small_faults, small_cycles, small_refills,
+         huge_faults, huge_cycles, huge_refills);
+
+  test_task_free(small);
+  test_task_free(huge);
+
+  return TEST_PASS;
+}
+
+#define CONT_VA 0x60000000UL
+
+/* Entries of the run at va (CONT_PTE_SIZE aligned) with the hint set */
+static unsigned long cont_entries(struct task_struct *task, unsigned long va) {
+  unsigned long count = 0;
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    unsigned long *pte = pte_lookup(task, va + i * PAGE_SIZE);
+    if (pte && (*pte & PTE_CONT)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/* Test: Mapping the last page of an aligned contiguous run sets the hint */
+static int test_mm_cont_map_folds_run(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long run = alloc_pages(CONT_PTE_ORDER);
+  TEST_ASSERT_NEQ(0, run);
+  split_page(run, CONT_PTE_ORDER);
+
+  for (unsigned long i = 0; i < CONT_PTES - 1; i++) {
+    TEST_ASSERT_EQ(0, map_page(task, CONT_VA + i * PAGE_SIZE,
+                               run + i * PAGE_SIZE));
+  }
+  TEST_ASSERT_EQ(0, cont_entries(task, CONT_VA));
+  unsigned long last = (CONT_PTES - 1) * PAGE_SIZE;
+  TEST_ASSERT_EQ(0, map_page(task, CONT_VA + last, run + last));
+  TEST_ASSERT_EQ(CONT_PTES, cont_entries(task, CONT_VA));
+  TEST_ASSERT_EQ(CONT_PTES, task->mm.rss);
+  unsigned long *pte = pte_lookup(task, CONT_VA + last);
+  TEST_ASSERT_EQ(run + last, *pte & PTE_ADDR_MASK);
+
+  /* Remapping one page breaks the run up again */
+  TEST_ASSERT_EQ(0, map_guard_page(task, CONT_VA + PAGE_SIZE));
+  TEST_ASSERT_EQ(0, cont_entries(task, CONT_VA));
+  TEST_ASSERT_EQ(CONT_PTES - 1, task->mm.rss);
+  TEST_ASSERT_EQ(run, *pte_lookup(task, CONT_VA) & PTE_ADDR_MASK);
+  put_page(run + PAGE_SIZE);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Runs that are misaligned or not physically contiguous get no hint */
+static int test_mm_cont_map_needs_run(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long run = alloc_pages(CONT_PTE_ORDER + 1);
+  TEST_ASSERT_NEQ(0, run);
+  split_page(run, CONT_PTE_ORDER + 1);
+
+  /* Physically aligned, virtually off by one page */
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    TEST_ASSERT_EQ(0, map_page(task, CONT_VA + (i + 1) * PAGE_SIZE,
+                               run + i * PAGE_SIZE));
+  }
+  TEST_ASSERT_EQ(0, cont_entries(task, CONT_VA));
+  TEST_ASSERT_EQ(0, cont_entries(task, CONT_VA + CONT_PTE_SIZE));
+  /* Aligned both ways, but out of order */
+  unsigned long va = CONT_VA + 2 * CONT_PTE_SIZE;
+  unsigned long top = run + (2 * CONT_PTES - 1) * PAGE_SIZE;
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    TEST_ASSERT_EQ(0, map_page(task, va + i * PAGE_SIZE, top - i * PAGE_SIZE));
+  }
+  TEST_ASSERT_EQ(0, cont_entries(task, va));
+
+  /* Drops every page of the block */
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: An anonymous fault backs its window with contiguous runs */
+static int test_mm_cont_fault_maps_run(void) {
+  unsigned long saved = get_fault_around_pages();
+  TEST_ASSERT_EQ(0, set_fault_around_pages(2 * CONT_PTES));
+  struct task_struct *task = fault_task(0, 2 * CONT_PTES);
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA + 3 * PAGE_SIZE, 1));
+  TEST_ASSERT_EQ(2 * CONT_PTES, task->mm.rss);
+  for (unsigned long r = 0; r < 2; r++) {
+    unsigned long va = FAULT_VA + r * CONT_PTE_SIZE;
+    TEST_ASSERT_EQ(CONT_PTES, cont_entries(task, va));
+    unsigned long base = *pte_lookup(task, va) & PTE_ADDR_MASK;
+    TEST_ASSERT_EQ(0, base & (CONT_PTE_SIZE - 1));
+    TEST_ASSERT(is_memory_zeroed(base + VA_START, CONT_PTE_SIZE));
+    /* Each page still holds its own reference */
+    TEST_ASSERT_EQ(1, page_count(base + PAGE_SIZE));
+  }
+
+  TEST_ASSERT_EQ(0, set_fault_around_pages(saved));
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A write to a shared run unfolds it, the last private write refolds */
+static int test_mm_cont_cow_unfolds(void) {
+  struct task_struct *parent = fault_task(0, CONT_PTES);
+  struct task_struct *child = test_task();
+  TEST_ASSERT_NOT_NULL(parent);
+  TEST_ASSERT_NOT_NULL(child);
+  TEST_ASSERT_EQ(0, handle_mm_fault(parent, FAULT_VA, 1));
+  TEST_ASSERT_EQ(CONT_PTES, cont_entries(parent, FAULT_VA));
+
+  TEST_ASSERT_EQ(0, cow_fork(parent, child));
+  TEST_ASSERT_EQ(CONT_PTES, cont_entries(child, FAULT_VA));
+  TEST_ASSERT_EQ(0, cow_write_fault(child, FAULT_VA + 3 * PAGE_SIZE));
+  TEST_ASSERT_EQ(0, cont_entries(child, FAULT_VA));
+  TEST_ASSERT_EQ(CONT_PTES, cont_entries(parent, FAULT_VA));
+
+  /* With the child gone every page is private again */
+  exit_mm(child);
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    TEST_ASSERT_EQ(0, cow_write_fault(parent, FAULT_VA + i * PAGE_SIZE));
+    if (i < CONT_PTES - 1) {
+      TEST_ASSERT_EQ(0, cont_entries(parent, FAULT_VA));
+    }
+  }
+  TEST_ASSERT_EQ(CONT_PTES, cont_entries(parent, FAULT_VA));
+  TEST_ASSERT_EQ(0, *pte_lookup(parent, FAULT_VA) & (MM_AP_RDONLY | PTE_COW));
+
+  cow_teardown(parent, child);
+
+  return TEST_PASS;
+}
+
+/* Test: Unmapping part of a run unfolds it, a whole run goes at once */
+static int test_mm_cont_zap_unfolds(void) {
+  unsigned long saved = get_fault_around_pages();
+  TEST_ASSERT_EQ(0, set_fault_around_pages(2 * CONT_PTES));
+  struct task_struct *task = fault_task(0, 2 * CONT_PTES);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, FAULT_VA, 1));
+  unsigned long base = *pte_lookup(task, FAULT_VA + CONT_PTE_SIZE) &
+                       PTE_ADDR_MASK;
+
+  TEST_ASSERT_EQ(0, unmap_range(task, FAULT_VA + 5 * PAGE_SIZE, 1));
+  TEST_ASSERT_EQ(0, cont_entries(task, FAULT_VA));
+  TEST_ASSERT(!fault_mapped(task, 5));
+  TEST_ASSERT(fault_mapped(task, 4));
+  TEST_ASSERT(fault_mapped(task, 6));
+
+  TEST_ASSERT_EQ(0, unmap_range(task, FAULT_VA + CONT_PTE_SIZE, CONT_PTES));
+  TEST_ASSERT_EQ(CONT_PTES - 1, task->mm.rss);
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    TEST_ASSERT(!fault_mapped(task, CONT_PTES + i));
+    TEST_ASSERT_EQ(0, page_count(base + i * PAGE_SIZE));
+  }
+
+  TEST_ASSERT_EQ(0, set_fault_around_pages(saved));
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
 /* Register all memory management tests */
 void register_mm_tests(void) {
   TEST_REGISTER(mm, get_free_page);
@@ -381,4 +1506,39 @@ void register_mm_tests(void) {
   TEST_REGISTER(mm, page_table_creation);
   TEST_REGISTER(mm, multiple_user_pages);
   TEST_REGISTER(mm, exhaustion_recovery);
+  TEST_REGISTER(mm, alloc_pages_alignment);
+  TEST_REGISTER(mm, alloc_pages_invalid_order);
+  TEST_REGISTER(mm, free_pages_coalesces);
+  TEST_REGISTER(mm, free_page_count);
+  TEST_REGISTER(mm, zero_pool_refill);
+  TEST_REGISTER(mm, zero_pool_pages_zeroed);
+  TEST_REGISTER(mm, zero_pool_when_dry);
+  TEST_REGISTER(mm, get_free_page_nozero);
+  TEST_REGISTER(mm, page_struct_layout);
+  TEST_REGISTER(mm, page_flags_follow_owner);
+  TEST_REGISTER(mm, free_pages_leave_memory_alone);
+  TEST_REGISTER(mm, cow_fork_shares_pages);
+  TEST_REGISTER(mm, cow_write_fault_copies);
+  TEST_REGISTER(mm, cow_last_sharer_reuses);
+  TEST_REGISTER(mm, copy_to_user_breaks_cow);
+  TEST_REGISTER(mm, page_mapcount_follows_mappings);
+  TEST_REGISTER(mm, fault_around_maps_window);
+  TEST_REGISTER(mm, fault_around_clipped);
+  TEST_REGISTER(mm, fault_around_config);
+  TEST_REGISTER(mm, fault_stats_per_task);
+  TEST_REGISTER(mm, zero_page_read_fault);
+  TEST_REGISTER(mm, zero_page_write_after_read);
+  TEST_REGISTER(mm, huge_fault_maps_block);
+  TEST_REGISTER(mm, huge_fault_needs_whole_block);
+  TEST_REGISTER(mm, huge_zap_splits_block);
+  TEST_REGISTER(mm, huge_cow_fork);
+  TEST_REGISTER(mm, cont_map_folds_run);
+  TEST_REGISTER(mm, cont_map_needs_run);
+  TEST_REGISTER(mm, cont_fault_maps_run);
+  TEST_REGISTER(mm, cont_cow_unfolds);
+  TEST_REGISTER(mm, cont_zap_unfolds);
+  TEST_REGISTER(mm, map_range_spans_tables);
+  TEST_REGISTER(mm, map_range_replaces);
+  TEST_REGISTER(mm, unmap_range_caches_tables);
+  TEST_REGISTER(mm, bench_huge_tlb);
 }
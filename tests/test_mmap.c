@@ -0,0 +1,245 @@
+/*
+ * mmap Tests
+ *
+ * Tests for:
+ * - Lazily populated anonymous mappings
+ * - Address hints, first-fit placement and MAP_FIXED
+ * - Argument checking
+ * - Executable mappings being refused
+ * - munmap freeing pages and splitting VMAs
+ * - PROT_NONE reservations
+ * - MAP_HUGETLB placement
+ */
+
+#include "arm/mmu.h"
+#include "fixtures.h"
+#include "mm.h"
+#include "mmap.h"
+#include "sched.h"
+#include "test.h"
+#include "vma.h"
+
+/* Forward declarations for test functions */
+static int test_mmap_anonymous_lazy(void);
+static int test_mmap_hint_and_fixed(void);
+static int test_mmap_rejects_bad_args(void);
+static int test_mmap_rejects_exec(void);
+static int test_mmap_munmap_frees_pages(void);
+static int test_mmap_munmap_splits_vma(void);
+static int test_mmap_prot_none_faults(void);
+static int test_mmap_hugetlb_aligned(void);
+
+#define MMAP_RW (PROT_READ | PROT_WRITE)
+#define MMAP_ANON (MAP_PRIVATE | MAP_ANONYMOUS)
+#define MMAP_HINT (MMAP_BASE + 0x100000UL)
+
+/* Physical page mapped at va, or 0 */
+static unsigned long mmap_page(struct task_struct *task, unsigned long va) {
+  unsigned long *pte = pte_lookup(task, va);
+  if (pte == 0 || !(*pte & PTE_VALID)) {
+    return 0;
+  }
+  return *pte & PTE_ADDR_MASK;
+}
+
+/* Test: mmap only reserves; pages arrive on first touch */
+static int test_mmap_anonymous_lazy(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  unsigned long addr =
+      do_mmap(task, 0, 3 * PAGE_SIZE - 100, MMAP_RW, MMAP_ANON);
+  TEST_ASSERT_NEQ(MAP_FAILED, addr);
+  TEST_ASSERT_GTE(addr, MMAP_BASE);
+  TEST_ASSERT_EQ(0, addr & ~PAGE_MASK);
+  TEST_ASSERT_EQ(0, task->mm.rss);
+
+  struct vm_area_struct *vma = find_vma(&task->mm, addr);
+  TEST_ASSERT_NOT_NULL(vma);
+  TEST_ASSERT_EQ(addr + 3 * PAGE_SIZE, vma->vm_end);
+  TEST_ASSERT_EQ(MMAP_RW | VM_ANON, vma->vm_flags);
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, addr + PAGE_SIZE, 1));
+  TEST_ASSERT_NEQ(0, mmap_page(task, addr + PAGE_SIZE));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Free hints are honoured, taken ones searched past, fixed replaces */
+static int test_mmap_hint_and_fixed(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  unsigned long a = do_mmap(task, MMAP_HINT, PAGE_SIZE, MMAP_RW, MMAP_ANON);
+  TEST_ASSERT_EQ(MMAP_HINT, a);
+  unsigned long b = do_mmap(task, MMAP_HINT, PAGE_SIZE, MMAP_RW, MMAP_ANON);
+  TEST_ASSERT_NEQ(MAP_FAILED, b);
+  TEST_ASSERT_NEQ(a, b);
+  TEST_ASSERT(b >= a + PAGE_SIZE || b + PAGE_SIZE <= a);
+
+  /* MAP_FIXED over a populated page drops the old contents */
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, a, 1));
+  TEST_ASSERT_EQ(1, task->mm.rss);
+  unsigned long c =
+      do_mmap(task, a, PAGE_SIZE, PROT_READ, MMAP_ANON | MAP_FIXED);
+  TEST_ASSERT_EQ(a, c);
+  TEST_ASSERT_EQ(0, task->mm.rss);
+  TEST_ASSERT_EQ(PROT_READ | VM_ANON, find_vma(&task->mm, a)->vm_flags);
+  TEST_ASSERT_EQ(2, task->mm.map_count);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Empty, non-anonymous and misplaced requests fail */
+static int test_mmap_rejects_bad_args(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(MAP_FAILED, do_mmap(task, 0, 0, MMAP_RW, MMAP_ANON));
+  TEST_ASSERT_EQ(MAP_FAILED, do_mmap(task, 0, PAGE_SIZE, MMAP_RW, MAP_PRIVATE));
+  TEST_ASSERT_EQ(MAP_FAILED,
+                 do_mmap(task, 0, PAGE_SIZE, MMAP_RW | 0x80, MMAP_ANON));
+  TEST_ASSERT_EQ(MAP_FAILED, do_mmap(task, MMAP_HINT + 8, PAGE_SIZE, MMAP_RW,
+                                     MMAP_ANON | MAP_FIXED));
+  /* Page 0 stays the guard page */
+  TEST_ASSERT_EQ(MAP_FAILED,
+                 do_mmap(task, 0, PAGE_SIZE, MMAP_RW, MMAP_ANON | MAP_FIXED));
+  TEST_ASSERT_EQ(-1, do_munmap(task, MMAP_HINT + 8, PAGE_SIZE));
+  TEST_ASSERT_EQ(-1, do_munmap(task, MMAP_HINT, 0));
+  TEST_ASSERT_EQ(0, task->mm.map_count);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: PROT_EXEC is refused, as nothing could fault its pages in */
+static int test_mmap_rejects_exec(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(MAP_FAILED,
+                 do_mmap(task, 0, PAGE_SIZE, PROT_READ | PROT_EXEC, MMAP_ANON));
+  TEST_ASSERT_EQ(MAP_FAILED, do_mmap(task, MMAP_HINT, PAGE_SIZE,
+                                     MMAP_RW | PROT_EXEC,
+                                     MMAP_ANON | MAP_FIXED));
+  TEST_ASSERT_EQ(0, task->mm.map_count);
+
+  /* Without it, the mapping is there and never executable */
+  unsigned long addr = do_mmap(task, 0, PAGE_SIZE, MMAP_RW, MMAP_ANON);
+  TEST_ASSERT_NEQ(MAP_FAILED, addr);
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, addr, 1));
+  TEST_ASSERT(*pte_lookup(task, addr) & PTE_UXN);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: munmap hands resident pages back and removes the mapping */
+static int test_mmap_munmap_frees_pages(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  unsigned long addr = do_mmap(task, 0, 4 * PAGE_SIZE, MMAP_RW, MMAP_ANON);
+  TEST_ASSERT_NEQ(MAP_FAILED, addr);
+  unsigned long pages[4];
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_EQ(0, handle_mm_fault(task, addr + i * PAGE_SIZE, 1));
+    pages[i] = mmap_page(task, addr + i * PAGE_SIZE);
+    TEST_ASSERT_EQ(1, page_count(pages[i]));
+  }
+
+  TEST_ASSERT_EQ(0, do_munmap(task, addr, 4 * PAGE_SIZE));
+  TEST_ASSERT_EQ(0, task->mm.rss);
+  TEST_ASSERT_EQ(0, task->mm.map_count);
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_EQ(0, page_count(pages[i]));
+    TEST_ASSERT_EQ(0, mmap_page(task, addr + i * PAGE_SIZE));
+  }
+  /* The hole no longer faults in */
+  TEST_ASSERT_EQ(-1, handle_mm_fault(task, addr, 0));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Unmapping the middle of a mapping leaves both ends */
+static int test_mmap_munmap_splits_vma(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  unsigned long addr = do_mmap(task, 0, 4 * PAGE_SIZE, MMAP_RW, MMAP_ANON);
+  TEST_ASSERT_NEQ(MAP_FAILED, addr);
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, addr, 1));
+  TEST_ASSERT_EQ(4, task->mm.rss);
+
+  TEST_ASSERT_EQ(0, do_munmap(task, addr + PAGE_SIZE, 2 * PAGE_SIZE));
+  TEST_ASSERT_EQ(2, task->mm.map_count);
+  TEST_ASSERT_EQ(2, task->mm.rss);
+
+  struct vm_area_struct *low = find_vma(&task->mm, addr);
+  struct vm_area_struct *high = find_vma(&task->mm, addr + 3 * PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(low);
+  TEST_ASSERT_NOT_NULL(high);
+  TEST_ASSERT_EQ(addr + PAGE_SIZE, low->vm_end);
+  TEST_ASSERT_EQ(addr + 3 * PAGE_SIZE, high->vm_start);
+  TEST_ASSERT_NULL(find_vma(&task->mm, addr + 2 * PAGE_SIZE));
+  TEST_ASSERT_NEQ(0, mmap_page(task, addr));
+  TEST_ASSERT_NEQ(0, mmap_page(task, addr + 3 * PAGE_SIZE));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A PROT_NONE reservation never faults pages in */
+static int test_mmap_prot_none_faults(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  unsigned long addr = do_mmap(task, 0, PAGE_SIZE, PROT_NONE, MMAP_ANON);
+  TEST_ASSERT_NEQ(MAP_FAILED, addr);
+  TEST_ASSERT_EQ(-1, handle_mm_fault(task, addr, 0));
+  TEST_ASSERT_EQ(-1, handle_mm_fault(task, addr, 1));
+  TEST_ASSERT_EQ(0, task->mm.rss);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: MAP_HUGETLB mappings start on a block boundary */
+static int test_mmap_hugetlb_aligned(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  /* Push the first-fit point off the block boundary */
+  TEST_ASSERT_EQ(MMAP_BASE, do_mmap(task, 0, PAGE_SIZE, MMAP_RW, MMAP_ANON));
+  unsigned long addr =
+      do_mmap(task, 0, SECTION_SIZE, MMAP_RW, MMAP_ANON | MAP_HUGETLB);
+  TEST_ASSERT_NEQ(MAP_FAILED, addr);
+  TEST_ASSERT_EQ(0, addr & (SECTION_SIZE - 1));
+  TEST_ASSERT(find_vma(&task->mm, addr)->vm_flags & VM_HUGEPAGE);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Register all mmap tests */
+void register_mmap_tests(void) {
+  TEST_REGISTER(mmap, anonymous_lazy);
+  TEST_REGISTER(mmap, hint_and_fixed);
+  TEST_REGISTER(mmap, rejects_bad_args);
+  TEST_REGISTER(mmap, rejects_exec);
+  TEST_REGISTER(mmap, munmap_frees_pages);
+  TEST_REGISTER(mmap, munmap_splits_vma);
+  TEST_REGISTER(mmap, prot_none_faults);
+  TEST_REGISTER(mmap, hugetlb_aligned);
+}
@@ -10,8 +10,12 @@
  * - Task list management
  * - Priority handling
  * - Counter management
+ * - Exit teardown, wait and zombie reaping
+ * - Kernel threads borrowing the previous address space
  */
 
+#include "asid.h"
+#include "fixtures.h"
 #include "fork.h"
 #include "mm.h"
 #include "printf.h"
@@ -42,6 +46,11 @@ static int test_sched_priority_assignment(void);
 static int test_sched_task_list_traversal(void);
 static int test_sched_cpu_context_offset(void);
 static int test_sched_fpsimd_context_offset(void);
+static int test_sched_exit_frees_user_pages(void);
+static int test_sched_wait_returns_exit_code(void);
+static int test_sched_reap_zombies_unlinks(void);
+static int test_sched_kthread_borrows_mm(void);
+static int test_sched_user_switch_loads_mm(void);
 
 /* Dummy kernel function for testing */
 static void dummy_kernel_func(void) {
@@ -347,6 +356,168 @@ static int test_sched_fpsimd_context_offset(void) {
   return TEST_PASS;
 }
 
+#define EXIT_TEST_PAGES 4
+#define EXIT_TEST_CODE 42
+
+static unsigned long exit_test_pages[EXIT_TEST_PAGES];
+
+/* Kernel thread that builds a small address space and exits with a code */
+static void exit_test_func(void) {
+  for (int i = 0; i < EXIT_TEST_PAGES; i++) {
+    unsigned long page = allocate_user_page(current, (i + 1) * PAGE_SIZE);
+    exit_test_pages[i] = page ? page - VA_START : 0;
+  }
+  do_exit(EXIT_TEST_CODE);
+}
+
+/* Wait until the child with this pid has been collected */
+static long wait_for(long pid, long *code) {
+  long got;
+  while ((got = do_wait(code)) >= 0 && got != pid) {
+  }
+  return got;
+}
+
+static struct task_struct *find_task(long pid) {
+  for (struct task_struct *p = initial_task; p; p = p->next_task) {
+    if (p->pid == pid) {
+      return p;
+    }
+  }
+  return 0;
+}
+
+/* Test: Exit hands every user page back to the allocator */
+static int test_sched_exit_frees_user_pages(void) {
+  for (int i = 0; i < EXIT_TEST_PAGES; i++) {
+    exit_test_pages[i] = 0;
+  }
+  int pid = copy_process(PF_KTHREAD, (unsigned long)&exit_test_func, 0, 5);
+  TEST_ASSERT_GTE(pid, 0);
+
+  long code;
+  TEST_ASSERT_EQ(pid, wait_for(pid, &code));
+
+  for (int i = 0; i < EXIT_TEST_PAGES; i++) {
+    TEST_ASSERT_NEQ(0, exit_test_pages[i]);
+    TEST_ASSERT_EQ(0, page_count(exit_test_pages[i]));
+  }
+
+  return TEST_PASS;
+}
+
+/* Test: The parent collects the code passed to do_exit */
+static int test_sched_wait_returns_exit_code(void) {
+  int pid = copy_process(PF_KTHREAD, (unsigned long)&exit_test_func, 0, 5);
+  TEST_ASSERT_GTE(pid, 0);
+
+  long code = 0;
+  TEST_ASSERT_EQ(pid, wait_for(pid, &code));
+  TEST_ASSERT_EQ(EXIT_TEST_CODE, code);
+
+  /* Waited-for children leave the task list */
+  TEST_ASSERT_NULL(find_task(pid));
+
+  return TEST_PASS;
+}
+
+/* Test: Zombie children of init are unlinked by the reaper */
+static int test_sched_reap_zombies_unlinks(void) {
+  int pid = copy_process(PF_KTHREAD, (unsigned long)&dummy_kernel_func, 0, 5);
+  TEST_ASSERT_GTE(pid, 0);
+
+  struct task_struct *task = find_task(pid);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(initial_task, task->parent);
+  while (task->state != TASK_ZOMBIE) {
+    schedule();
+  }
+
+  reap_zombies();
+  TEST_ASSERT_NULL(find_task(pid));
+
+  return TEST_PASS;
+}
+
+#define LAZY_MM_VA 0x30000000UL
+
+/* A scratch task, with a one-page address space if user is set */
+static struct task_struct *lazy_mm_task(int user) {
+  struct task_struct *task = test_task();
+  if (task == 0) {
+    return 0;
+  }
+  task->active_mm = 0;
+  if (user && allocate_user_page(task, LAZY_MM_VA) == 0) {
+    test_task_free(task);
+    return 0;
+  }
+  return task;
+}
+
+/* Test: user -> kthread -> same user never reloads TTBR0 */
+static int test_sched_kthread_borrows_mm(void) {
+  struct task_struct *user = lazy_mm_task(1);
+  struct task_struct *kthread = lazy_mm_task(0);
+  TEST_ASSERT_NOT_NULL(user);
+  TEST_ASSERT_NOT_NULL(kthread);
+
+  preempt_disable();
+  struct task_struct *self = current;
+  struct mm_struct *self_mm = self->active_mm;
+  switch_active_mm(self, user);
+  TEST_ASSERT_EQ(&user->mm, user->active_mm);
+
+  switch_active_mm(user, kthread);
+  TEST_ASSERT_EQ(&user->mm, kthread->active_mm);
+
+  /* A reload would hand out a fresh ASID to this stale context */
+  user->mm.context_id = 0;
+  switch_active_mm(kthread, user);
+  TEST_ASSERT_EQ(&user->mm, user->active_mm);
+  TEST_ASSERT_EQ(0, user->mm.context_id);
+
+  self->active_mm = self_mm;
+  switch_mm(self_mm);
+  preempt_enable();
+
+  test_task_free(user);
+  test_task_free(kthread);
+
+  return TEST_PASS;
+}
+
+/* Test: Switching to a different user task loads its address space */
+static int test_sched_user_switch_loads_mm(void) {
+  struct task_struct *a = lazy_mm_task(1);
+  struct task_struct *kthread = lazy_mm_task(0);
+  struct task_struct *b = lazy_mm_task(1);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(kthread);
+  TEST_ASSERT_NOT_NULL(b);
+
+  preempt_disable();
+  struct task_struct *self = current;
+  struct mm_struct *self_mm = self->active_mm;
+  switch_active_mm(self, a);
+  switch_active_mm(a, kthread);
+
+  b->mm.context_id = 0;
+  switch_active_mm(kthread, b);
+  TEST_ASSERT_EQ(&b->mm, b->active_mm);
+  TEST_ASSERT_NEQ(0, b->mm.context_id);
+
+  self->active_mm = self_mm;
+  switch_mm(self_mm);
+  preempt_enable();
+
+  test_task_free(a);
+  test_task_free(kthread);
+  test_task_free(b);
+
+  return TEST_PASS;
+}
+
 /* Register all scheduler tests */
 void register_sched_tests(void) {
   TEST_REGISTER(sched, init_task_state);
@@ -367,4 +538,9 @@ void register_sched_tests(void) {
   TEST_REGISTER(sched, task_list_traversal);
   TEST_REGISTER(sched, cpu_context_offset);
   TEST_REGISTER(sched, fpsimd_context_offset);
+  TEST_REGISTER(sched, exit_frees_user_pages);
+  TEST_REGISTER(sched, wait_returns_exit_code);
+  TEST_REGISTER(sched, reap_zombies_unlinks);
+  TEST_REGISTER(sched, kthread_borrows_mm);
+  TEST_REGISTER(sched, user_switch_loads_mm);
 }
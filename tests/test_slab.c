@@ -0,0 +1,242 @@
+/*
+ * Slab Allocator Tests
+ *
+ * Tests for:
+ * - kmem_cache creation, allocation and freeing
+ * - Object constructors
+ * - Per-cache statistics
+ * - Growing a cache into a given page
+ * - kmalloc size classes and large allocations
+ */
+
+#include "mm.h"
+#include "slab.h"
+#include "test.h"
+
+/* Forward declarations for test functions */
+static int test_slab_cache_alloc_free(void);
+static int test_slab_constructor(void);
+static int test_slab_objects_distinct(void);
+static int test_slab_stats(void);
+static int test_slab_grow_into_page(void);
+static int test_slab_kmalloc_size_classes(void);
+static int test_slab_kmalloc_large(void);
+static int test_slab_kzalloc_zeroed(void);
+static int test_slab_kfree_null(void);
+
+struct test_obj {
+  unsigned long magic;
+  unsigned long payload[5];
+};
+
+#define TEST_OBJ_MAGIC 0x51AB51ABUL
+
+static void test_obj_ctor(void *obj) {
+  ((struct test_obj *)obj)->magic = TEST_OBJ_MAGIC;
+}
+
+/* Test: Objects come back from a fresh cache and can be returned */
+static int test_slab_cache_alloc_free(void) {
+  struct kmem_cache *cache =
+      kmem_cache_create("test_obj", sizeof(struct test_obj), 0, 0);
+  TEST_ASSERT_NOT_NULL(cache);
+
+  struct test_obj *obj = kmem_cache_alloc(cache);
+  TEST_ASSERT_NOT_NULL(obj);
+  /* Slab objects never start on a page boundary */
+  TEST_ASSERT_NEQ(0, (unsigned long)obj & ~PAGE_MASK);
+
+  kmem_cache_free(cache, obj);
+  kmem_cache_destroy(cache);
+
+  return TEST_PASS;
+}
+
+/* Test: Constructor runs before objects are first handed out */
+static int test_slab_constructor(void) {
+  struct kmem_cache *cache = kmem_cache_create(
+      "test_obj_ctor", sizeof(struct test_obj), 0, test_obj_ctor);
+  TEST_ASSERT_NOT_NULL(cache);
+
+  struct test_obj *objs[4];
+  for (int i = 0; i < 4; i++) {
+    objs[i] = kmem_cache_alloc(cache);
+    TEST_ASSERT_NOT_NULL(objs[i]);
+    TEST_ASSERT_EQ(TEST_OBJ_MAGIC, objs[i]->magic);
+  }
+
+  for (int i = 0; i < 4; i++) {
+    kmem_cache_free(cache, objs[i]);
+  }
+  kmem_cache_destroy(cache);
+
+  return TEST_PASS;
+}
+
+/* Test: Many objects span several slabs without overlapping */
+static int test_slab_objects_distinct(void) {
+  struct kmem_cache *cache = kmem_cache_create("test_obj_many", 256, 64, 0);
+  TEST_ASSERT_NOT_NULL(cache);
+
+  void *objs[40];
+  for (int i = 0; i < 40; i++) {
+    objs[i] = kmem_cache_alloc(cache);
+    TEST_ASSERT_NOT_NULL(objs[i]);
+    TEST_ASSERT_EQ(0, (unsigned long)objs[i] & 63);
+  }
+  for (int i = 0; i < 40; i++) {
+    for (int j = i + 1; j < 40; j++) {
+      unsigned long a = (unsigned long)objs[i];
+      unsigned long b = (unsigned long)objs[j];
+      TEST_ASSERT(a + 256 <= b || b + 256 <= a);
+    }
+  }
+
+  for (int i = 0; i < 40; i++) {
+    kmem_cache_free(cache, objs[i]);
+  }
+  kmem_cache_destroy(cache);
+
+  return TEST_PASS;
+}
+
+/* Test: Statistics track usage, slab growth and hits */
+static int test_slab_stats(void) {
+  struct kmem_cache *cache = kmem_cache_create("test_obj_stats", 128, 0, 0);
+  TEST_ASSERT_NOT_NULL(cache);
+
+  struct kmem_cache_stats stats;
+  void *a = kmem_cache_alloc(cache);
+  void *b = kmem_cache_alloc(cache);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+
+  kmem_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQ(2, stats.objects_in_use);
+  TEST_ASSERT_EQ(2, stats.allocs);
+  TEST_ASSERT_EQ(1, stats.slabs);
+  /* Only the first allocation had to grow the cache */
+  TEST_ASSERT_EQ(1, stats.hits);
+  TEST_ASSERT_GTE(stats.objects_total, 2);
+
+  kmem_cache_free(cache, a);
+  kmem_cache_free(cache, b);
+  kmem_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQ(0, stats.objects_in_use);
+  TEST_ASSERT_EQ(2, stats.frees);
+
+  kmem_cache_destroy(cache);
+
+  return TEST_PASS;
+}
+
+/* Test: A cache grows into the page it is given, and only when it has no
+ * spare slab */
+static int test_slab_grow_into_page(void) {
+  struct kmem_cache *cache =
+      kmem_cache_create("test_obj_grow", sizeof(struct test_obj), 0, 0);
+  TEST_ASSERT_NOT_NULL(cache);
+  unsigned long page = get_free_page_nozero();
+  TEST_ASSERT_NEQ(0, page);
+
+  TEST_ASSERT_EQ(0, kmem_cache_grow(cache, page));
+  struct kmem_cache_stats stats;
+  kmem_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQ(1, stats.slabs);
+  TEST_ASSERT(phys_to_page(page)->flags & PG_KERNEL);
+
+  /* Served from the page without going to the allocator */
+  struct test_obj *obj = kmem_cache_alloc(cache);
+  TEST_ASSERT_NOT_NULL(obj);
+  TEST_ASSERT_EQ(page + VA_START, (unsigned long)obj & PAGE_MASK);
+  kmem_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQ(1, stats.hits);
+
+  /* With a spare slab already there, the page stays the caller's */
+  kmem_cache_free(cache, obj);
+  unsigned long other = get_free_page_nozero();
+  TEST_ASSERT_NEQ(0, other);
+  TEST_ASSERT_EQ(-1, kmem_cache_grow(cache, other));
+  free_page(other);
+
+  kmem_cache_destroy(cache);
+
+  return TEST_PASS;
+}
+
+/* Test: kmalloc rounds up to the next power-of-two class */
+static int test_slab_kmalloc_size_classes(void) {
+  TEST_ASSERT_EQ(kmalloc_cache(1), kmalloc_cache(16));
+  TEST_ASSERT_EQ(kmalloc_cache(17), kmalloc_cache(32));
+  TEST_ASSERT_EQ(kmalloc_cache(1000), kmalloc_cache(1024));
+  TEST_ASSERT_NEQ(kmalloc_cache(16), kmalloc_cache(32));
+  TEST_ASSERT_NULL(kmalloc_cache(KMALLOC_MAX_SIZE + 1));
+
+  unsigned char *p = kmalloc(100);
+  TEST_ASSERT_NOT_NULL(p);
+  for (int i = 0; i < 100; i++) {
+    p[i] = (unsigned char)i;
+  }
+  for (int i = 0; i < 100; i++) {
+    TEST_ASSERT_EQ((unsigned char)i, p[i]);
+  }
+  kfree(p);
+
+  return TEST_PASS;
+}
+
+/* Test: Requests above the largest class come from the page allocator */
+static int test_slab_kmalloc_large(void) {
+  unsigned long free_before = nr_free_pages();
+
+  void *p = kmalloc(3 * PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(p);
+  TEST_ASSERT_EQ(0, (unsigned long)p & ~PAGE_MASK);
+  /* Rounded up to an order-2 block */
+  TEST_ASSERT_EQ(free_before - 4, nr_free_pages());
+
+  kfree(p);
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+
+  return TEST_PASS;
+}
+
+/* Test: kzalloc returns zeroed memory */
+static int test_slab_kzalloc_zeroed(void) {
+  unsigned char *p = kmalloc(512);
+  TEST_ASSERT_NOT_NULL(p);
+  for (int i = 0; i < 512; i++) {
+    p[i] = 0xAA;
+  }
+  kfree(p);
+
+  p = kzalloc(512);
+  TEST_ASSERT_NOT_NULL(p);
+  for (int i = 0; i < 512; i++) {
+    TEST_ASSERT_EQ(0, p[i]);
+  }
+  kfree(p);
+
+  return TEST_PASS;
+}
+
+/* Test: Freeing NULL is a no-op */
+static int test_slab_kfree_null(void) {
+  kfree(0);
+  TEST_ASSERT_NULL(kmalloc(0));
+
+  return TEST_PASS;
+}
+
+/* Register all slab tests */
+void register_slab_tests(void) {
+  TEST_REGISTER(slab, cache_alloc_free);
+  TEST_REGISTER(slab, constructor);
+  TEST_REGISTER(slab, objects_distinct);
+  TEST_REGISTER(slab, stats);
+  TEST_REGISTER(slab, grow_into_page);
+  TEST_REGISTER(slab, kmalloc_size_classes);
+  TEST_REGISTER(slab, kmalloc_large);
+  TEST_REGISTER(slab, kzalloc_zeroed);
+  TEST_REGISTER(slab, kfree_null);
+}
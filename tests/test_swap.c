@@ -0,0 +1,490 @@
+/*
+ * Compressed Swap Tests
+ *
+ * Tests for:
+ * - LZ4 round trips and malformed input
+ * - Swapping a page out to the store and faulting it back in
+ * - Same-filled, incompressible and shared pages
+ * - Swap entries across fork, munmap and exit
+ * - Reclaim when the page allocator runs dry
+ * - Swapping out with no free page left for the store
+ * - Kernel reads of swapped out user memory
+ */
+
+#include "arm/mmu.h"
+#include "fixtures.h"
+#include "fork.h"
+#include "lz4.h"
+#include "mm.h"
+#include "sched.h"
+#include "swap.h"
+#include "test.h"
+#include "vma.h"
+
+/* Forward declarations for test functions */
+static int test_swap_lz4_round_trip(void);
+static int test_swap_lz4_rejects_malformed(void);
+static int test_swap_out_and_in(void);
+static int test_swap_same_filled_page(void);
+static int test_swap_incompressible_page_stays(void);
+static int test_swap_shared_page_stays(void);
+static int test_swap_fork_shares_entry(void);
+static int test_swap_unmap_and_exit_free_slots(void);
+static int test_swap_reclaim_when_out_of_memory(void);
+static int test_swap_out_with_no_memory_free(void);
+static int test_swap_copy_from_user_swaps_in(void);
+
+#define SWAP_VA 0x50000000UL
+#define SWAP_TEST_PAGES 64
+
+static unsigned char workspace[LZ4_WORKSPACE_SIZE] __attribute__((aligned(8)));
+
+/* Compressible, but not one repeated word */
+static void fill_pattern(unsigned long *words, unsigned long seed) {
+  for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+    words[i] = seed + (i & 15) + ((i >> 6) << 32);
+  }
+}
+
+static int check_pattern(unsigned long *words, unsigned long seed) {
+  for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+    if (words[i] != seed + (i & 15) + ((i >> 6) << 32)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void fill_random(unsigned long *words, unsigned long seed) {
+  for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    words[i] = seed;
+  }
+}
+
+/* A bare user task with that many patterned anonymous pages at SWAP_VA */
+static struct task_struct *swap_task(unsigned long pages) {
+  struct task_struct *task = test_anon_task(SWAP_VA, pages, pages);
+  if (task == 0) {
+    return 0;
+  }
+  for (unsigned long i = 0; i < pages; i++) {
+    unsigned long *pte = pte_lookup(task, SWAP_VA + i * PAGE_SIZE);
+    fill_pattern((unsigned long *)((*pte & PTE_ADDR_MASK) + VA_START), i);
+  }
+  return task;
+}
+
+/* Kernel alias of the page task has resident at va, or 0 */
+static unsigned long *resident(struct task_struct *task, unsigned long va) {
+  unsigned long *pte = pte_lookup(task, va);
+  if (pte == 0 || !(*pte & PTE_VALID)) {
+    return 0;
+  }
+  return (unsigned long *)((*pte & PTE_ADDR_MASK) + VA_START);
+}
+
+static int swapped(struct task_struct *task, unsigned long va) {
+  unsigned long *pte = pte_lookup(task, va);
+  return pte && is_swap_pte(*pte);
+}
+
+/* Test: LZ4 gives back exactly what it was given, smaller in between */
+static int test_swap_lz4_round_trip(void) {
+  unsigned long src = allocate_kernel_page();
+  unsigned long dst = allocate_kernel_page();
+  unsigned long out = allocate_kernel_page();
+  TEST_ASSERT_NEQ(0, src);
+  TEST_ASSERT_NEQ(0, dst);
+  TEST_ASSERT_NEQ(0, out);
+
+  fill_pattern((unsigned long *)src, 0x1234);
+  int size = lz4_compress((unsigned char *)src, PAGE_SIZE,
+                          (unsigned char *)dst, PAGE_SIZE, workspace);
+  TEST_ASSERT_GT(size, 0);
+  TEST_ASSERT_LT(size, PAGE_SIZE / 4);
+  TEST_ASSERT_EQ(PAGE_SIZE, lz4_decompress((unsigned char *)dst, size,
+                                           (unsigned char *)out, PAGE_SIZE));
+  TEST_ASSERT(check_pattern((unsigned long *)out, 0x1234));
+
+  /* Short inputs are all literals */
+  size = lz4_compress((unsigned char *)src, 7, (unsigned char *)dst,
+                      PAGE_SIZE, workspace);
+  TEST_ASSERT_EQ(8, size);
+  TEST_ASSERT_EQ(7, lz4_decompress((unsigned char *)dst, size,
+                                   (unsigned char *)out, PAGE_SIZE));
+  TEST_ASSERT_EQ(0, lz4_compress((unsigned char *)src, 0,
+                                 (unsigned char *)dst, 0, workspace));
+
+  free_page(src - VA_START);
+  free_page(dst - VA_START);
+  free_page(out - VA_START);
+
+  return TEST_PASS;
+}
+
+/* Test: Bad blocks and short buffers fail instead of overrunning */
+static int test_swap_lz4_rejects_malformed(void) {
+  unsigned long src = allocate_kernel_page();
+  unsigned long dst = allocate_kernel_page();
+  unsigned long out = allocate_kernel_page();
+  TEST_ASSERT_NEQ(0, src);
+  TEST_ASSERT_NEQ(0, dst);
+  TEST_ASSERT_NEQ(0, out);
+
+  /* Random data does not fit in less than its own size */
+  fill_random((unsigned long *)src, 42);
+  TEST_ASSERT_EQ(0, lz4_compress((unsigned char *)src, PAGE_SIZE,
+                                 (unsigned char *)dst, PAGE_SIZE, workspace));
+
+  fill_pattern((unsigned long *)src, 7);
+  int size = lz4_compress((unsigned char *)src, PAGE_SIZE,
+                          (unsigned char *)dst, PAGE_SIZE, workspace);
+  TEST_ASSERT_GT(size, 0);
+  /* Truncated, or decompressed into too little room */
+  TEST_ASSERT_NEQ(PAGE_SIZE, lz4_decompress((unsigned char *)dst, size - 1,
+                                            (unsigned char *)out, PAGE_SIZE));
+  TEST_ASSERT_EQ(-1, lz4_decompress((unsigned char *)dst, size,
+                                    (unsigned char *)out, PAGE_SIZE - 1));
+  /* A match reaching back before the start of the output */
+  unsigned char bad[] = {0x10, 'a', 0x05, 0x00};
+  TEST_ASSERT_EQ(-1, lz4_decompress(bad, sizeof(bad), (unsigned char *)out,
+                                    PAGE_SIZE));
+
+  free_page(src - VA_START);
+  free_page(dst - VA_START);
+  free_page(out - VA_START);
+
+  return TEST_PASS;
+}
+
+/* Test: A swapped-out page is freed and comes back intact on a fault */
+static int test_swap_out_and_in(void) {
+  struct task_struct *task = swap_task(2);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long page = *pte_lookup(task, SWAP_VA) & PTE_ADDR_MASK;
+  struct swap_stats before, after;
+  swap_get_stats(&before);
+
+  TEST_ASSERT_EQ(1, swap_out_page(task, SWAP_VA));
+  TEST_ASSERT(swapped(task, SWAP_VA));
+  TEST_ASSERT_EQ(0, page_count(page));
+  TEST_ASSERT_EQ(1, task->mm.rss);
+  TEST_ASSERT_EQ(1, task->mm.nr_swap);
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored + 1, after.stored);
+  TEST_ASSERT_EQ(before.swap_outs + 1, after.swap_outs);
+  TEST_ASSERT_GT(after.compr_bytes, before.compr_bytes);
+  TEST_ASSERT_LT(after.compr_bytes - before.compr_bytes, PAGE_SIZE);
+  /* Nothing there to swap out twice */
+  TEST_ASSERT_EQ(0, swap_out_page(task, SWAP_VA));
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, SWAP_VA, 0));
+  unsigned long *words = resident(task, SWAP_VA);
+  TEST_ASSERT_NOT_NULL(words);
+  TEST_ASSERT(check_pattern(words, 0));
+  TEST_ASSERT_EQ(2, task->mm.rss);
+  TEST_ASSERT_EQ(0, task->mm.nr_swap);
+  /* Private again, so writable straight away */
+  TEST_ASSERT_EQ(0, *pte_lookup(task, SWAP_VA) & MM_AP_RDONLY);
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored, after.stored);
+  TEST_ASSERT_EQ(before.compr_bytes, after.compr_bytes);
+  TEST_ASSERT_EQ(before.swap_ins + 1, after.swap_ins);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A page of one repeated word takes no compressed space */
+static int test_swap_same_filled_page(void) {
+  struct task_struct *task = swap_task(1);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long *words = resident(task, SWAP_VA);
+  for (unsigned long i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+    words[i] = 0x5A5A5A5A5A5A5A5AUL;
+  }
+  struct swap_stats before, after;
+  swap_get_stats(&before);
+
+  TEST_ASSERT_EQ(1, swap_out_page(task, SWAP_VA));
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.same_filled + 1, after.same_filled);
+  TEST_ASSERT_EQ(before.pool_bytes, after.pool_bytes);
+
+  TEST_ASSERT_EQ(0, handle_mm_fault(task, SWAP_VA, 1));
+  words = resident(task, SWAP_VA);
+  TEST_ASSERT_NOT_NULL(words);
+  TEST_ASSERT_EQ(0x5A5A5A5A5A5A5A5AUL, words[0]);
+  TEST_ASSERT_EQ(0x5A5A5A5A5A5A5A5AUL, words[PAGE_SIZE / 8 - 1]);
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.same_filled, after.same_filled);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A page LZ4 cannot shrink stays mapped */
+static int test_swap_incompressible_page_stays(void) {
+  struct task_struct *task = swap_task(1);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long pte = *pte_lookup(task, SWAP_VA);
+  fill_random(resident(task, SWAP_VA), 7);
+  struct swap_stats before, after;
+  swap_get_stats(&before);
+
+  TEST_ASSERT_EQ(0, swap_out_page(task, SWAP_VA));
+  TEST_ASSERT_EQ(pte, *pte_lookup(task, SWAP_VA));
+  TEST_ASSERT_EQ(1, task->mm.rss);
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.incompressible + 1, after.incompressible);
+  TEST_ASSERT_EQ(before.stored, after.stored);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Pages with another reference or mapping are not swapped out */
+static int test_swap_shared_page_stays(void) {
+  struct task_struct *task = swap_task(1);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long page = *pte_lookup(task, SWAP_VA) & PTE_ADDR_MASK;
+
+  get_page(page);
+  TEST_ASSERT_EQ(0, swap_out_page(task, SWAP_VA));
+  TEST_ASSERT_NOT_NULL(resident(task, SWAP_VA));
+  put_page(page);
+  TEST_ASSERT_EQ(1, swap_out_page(task, SWAP_VA));
+
+  /* Nor is anything outside anonymous memory */
+  TEST_ASSERT_EQ(0, insert_vma(&task->mm, SWAP_VA + PAGE_SIZE,
+                               SWAP_VA + 2 * PAGE_SIZE, VM_READ | VM_WRITE));
+  TEST_ASSERT_NEQ(0, allocate_user_page(task, SWAP_VA + PAGE_SIZE));
+  TEST_ASSERT_EQ(0, swap_out_page(task, SWAP_VA + PAGE_SIZE));
+
+  /* Nor executable memory: instruction aborts cannot fault it back */
+  TEST_ASSERT_EQ(0, insert_vma(&task->mm, SWAP_VA + 2 * PAGE_SIZE,
+                               SWAP_VA + 3 * PAGE_SIZE,
+                               VM_READ | VM_EXEC | VM_ANON));
+  TEST_ASSERT_NEQ(0, allocate_user_page(task, SWAP_VA + 2 * PAGE_SIZE));
+  TEST_ASSERT_EQ(0, swap_out_page(task, SWAP_VA + 2 * PAGE_SIZE));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Fork copies the swap entry and both sides get the page back */
+static int test_swap_fork_shares_entry(void) {
+  struct task_struct *parent = swap_task(1);
+  TEST_ASSERT_NOT_NULL(parent);
+  struct task_struct *child = test_task();
+  TEST_ASSERT_NOT_NULL(child);
+  TEST_ASSERT_EQ(1, swap_out_page(parent, SWAP_VA));
+  struct swap_stats before, after;
+  swap_get_stats(&before);
+
+  preempt_disable();
+  struct task_struct *self = current;
+  current = parent;
+  int ret = copy_virt_memory(child);
+  current = self;
+  preempt_enable();
+  TEST_ASSERT_EQ(0, ret);
+  TEST_ASSERT(swapped(child, SWAP_VA));
+  TEST_ASSERT_EQ(1, child->mm.nr_swap);
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored, after.stored);
+
+  /* The slot outlives the first swap-in */
+  TEST_ASSERT_EQ(0, handle_mm_fault(child, SWAP_VA, 1));
+  TEST_ASSERT(check_pattern(resident(child, SWAP_VA), 0));
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored, after.stored);
+  TEST_ASSERT_EQ(0, handle_mm_fault(parent, SWAP_VA, 0));
+  TEST_ASSERT(check_pattern(resident(parent, SWAP_VA), 0));
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored - 1, after.stored);
+  TEST_ASSERT_NEQ(*pte_lookup(parent, SWAP_VA) & PTE_ADDR_MASK,
+                  *pte_lookup(child, SWAP_VA) & PTE_ADDR_MASK);
+
+  test_task_free(parent);
+  test_task_free(child);
+
+  return TEST_PASS;
+}
+
+/* Test: Unmapping or tearing down a swap entry frees its slot */
+static int test_swap_unmap_and_exit_free_slots(void) {
+  struct task_struct *task = swap_task(3);
+  TEST_ASSERT_NOT_NULL(task);
+  struct swap_stats before, after;
+  swap_get_stats(&before);
+  for (unsigned long i = 0; i < 3; i++) {
+    TEST_ASSERT_EQ(1, swap_out_page(task, SWAP_VA + i * PAGE_SIZE));
+  }
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored + 3, after.stored);
+
+  TEST_ASSERT_EQ(0, unmap_range(task, SWAP_VA, 1));
+  TEST_ASSERT_EQ(2, task->mm.nr_swap);
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored + 2, after.stored);
+
+  exit_mm(task);
+  TEST_ASSERT_EQ(0, task->mm.nr_swap);
+  swap_get_stats(&after);
+  TEST_ASSERT_EQ(before.stored, after.stored);
+  TEST_ASSERT_EQ(before.pool_bytes, after.pool_bytes);
+  free_page((unsigned long)task - VA_START);
+
+  return TEST_PASS;
+}
+
+/* Test: Allocating past the end of free memory swaps out user pages */
+static int test_swap_reclaim_when_out_of_memory(void) {
+  struct task_struct *task = swap_task(SWAP_TEST_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, test_task_list(task));
+
+  struct swap_stats before, after;
+  swap_get_stats(&before);
+  /* Take every page there is, linked through their first words */
+  unsigned long hoard = 0;
+  unsigned long page;
+  while ((page = get_free_page_nozero()) != 0) {
+    *(unsigned long *)(page + VA_START) = hoard;
+    hoard = page;
+  }
+  swap_get_stats(&after);
+  unsigned long task_swapped = task->mm.nr_swap;
+  while (hoard) {
+    page = hoard;
+    hoard = *(unsigned long *)(page + VA_START);
+    free_page(page);
+  }
+
+  test_task_unlist(task);
+
+  TEST_ASSERT_EQ(SWAP_TEST_PAGES, task_swapped);
+  TEST_ASSERT_EQ(0, task->mm.rss);
+  TEST_ASSERT_GTE(after.swap_outs - before.swap_outs, SWAP_TEST_PAGES);
+  TEST_ASSERT_GT(after.reclaim_scanned, before.reclaim_scanned);
+
+  for (unsigned long i = 0; i < SWAP_TEST_PAGES; i++) {
+    unsigned long va = SWAP_VA + i * PAGE_SIZE;
+    TEST_ASSERT(swapped(task, va));
+    TEST_ASSERT_EQ(0, handle_mm_fault(task, va, 0));
+    TEST_ASSERT(check_pattern(resident(task, va), i));
+  }
+  TEST_ASSERT_EQ(0, task->mm.nr_swap);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: With nothing free, the store grows into the pages it swaps out */
+static int test_swap_out_with_no_memory_free(void) {
+  /* Unlisted, so only the swap_out_page calls below touch it */
+  struct task_struct *task = swap_task(SWAP_TEST_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+
+  unsigned long hoard = 0;
+  unsigned long page;
+  unsigned long swapped_out = 0;
+  for (unsigned long i = 0; i < SWAP_TEST_PAGES; i++) {
+    /* Including whatever the last swap out gave back */
+    while ((page = get_free_page_nozero()) != 0) {
+      *(unsigned long *)(page + VA_START) = hoard;
+      hoard = page;
+    }
+    if (swap_out_page(task, SWAP_VA + i * PAGE_SIZE) == 1) {
+      swapped_out++;
+    }
+  }
+  while (hoard) {
+    page = hoard;
+    hoard = *(unsigned long *)(page + VA_START);
+    free_page(page);
+  }
+
+  TEST_ASSERT_EQ(SWAP_TEST_PAGES, swapped_out);
+  TEST_ASSERT_EQ(SWAP_TEST_PAGES, task->mm.nr_swap);
+  for (unsigned long i = 0; i < SWAP_TEST_PAGES; i++) {
+    unsigned long va = SWAP_VA + i * PAGE_SIZE;
+    TEST_ASSERT(swapped(task, va));
+    TEST_ASSERT_EQ(0, handle_mm_fault(task, va, 0));
+    TEST_ASSERT(check_pattern(resident(task, va), i));
+  }
+  TEST_ASSERT_EQ(0, task->mm.nr_swap);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: The kernel reads user memory through its own alias, swapping in */
+static int test_swap_copy_from_user_swaps_in(void) {
+  struct task_struct *task = swap_task(2);
+  TEST_ASSERT_NOT_NULL(task);
+  static const char hello[] = "hello from a swapped page";
+  char *text = (char *)resident(task, SWAP_VA);
+  for (unsigned long i = 0; i < sizeof(hello); i++) {
+    text[i] = hello[i];
+  }
+  TEST_ASSERT_EQ(1, swap_out_page(task, SWAP_VA));
+  TEST_ASSERT_EQ(1, swap_out_page(task, SWAP_VA + PAGE_SIZE));
+
+  char buf[32];
+  char part[8];
+  unsigned long words[2];
+  preempt_disable();
+  struct task_struct *self = current;
+  current = task;
+  long len = strncpy_from_user(buf, SWAP_VA, sizeof(buf));
+  long short_len = strncpy_from_user(part, SWAP_VA, 5);
+  /* Across the end of one page into the next */
+  int ret = copy_from_user(words, SWAP_VA + PAGE_SIZE - sizeof(long),
+                           sizeof(words));
+  /* Nothing is mapped past the VMA */
+  int bad = copy_from_user(words, SWAP_VA + 2 * PAGE_SIZE, sizeof(long));
+  current = self;
+  preempt_enable();
+
+  TEST_ASSERT_EQ(sizeof(hello) - 1, len);
+  for (unsigned long i = 0; i < sizeof(hello); i++) {
+    TEST_ASSERT_EQ(hello[i], buf[i]);
+  }
+  TEST_ASSERT_EQ(5, short_len);
+  TEST_ASSERT_EQ('o', part[4]);
+  TEST_ASSERT_EQ(0, ret);
+  TEST_ASSERT_EQ(-1, bad);
+  TEST_ASSERT(!swapped(task, SWAP_VA));
+  TEST_ASSERT(!swapped(task, SWAP_VA + PAGE_SIZE));
+  unsigned long last = PAGE_SIZE / sizeof(unsigned long) - 1;
+  TEST_ASSERT_EQ(resident(task, SWAP_VA)[last], words[0]);
+  TEST_ASSERT_EQ(resident(task, SWAP_VA + PAGE_SIZE)[0], words[1]);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Register all compressed swap tests */
+void register_swap_tests(void) {
+  TEST_REGISTER(swap, lz4_round_trip);
+  TEST_REGISTER(swap, lz4_rejects_malformed);
+  TEST_REGISTER(swap, out_and_in);
+  TEST_REGISTER(swap, same_filled_page);
+  TEST_REGISTER(swap, incompressible_page_stays);
+  TEST_REGISTER(swap, shared_page_stays);
+  TEST_REGISTER(swap, fork_shares_entry);
+  TEST_REGISTER(swap, unmap_and_exit_free_slots);
+  TEST_REGISTER(swap, reclaim_when_out_of_memory);
+  TEST_REGISTER(swap, out_with_no_memory_free);
+  TEST_REGISTER(swap, copy_from_user_swaps_in);
+}
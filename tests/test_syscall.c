@@ -9,6 +9,8 @@
  * - sys_fork functionality
  * - sys_getpid functionality
  * - sys_priority functionality
+ * - sys_wait functionality
+ * - sys_mmap/sys_munmap entries
  */
 
 #include "peripherals/base.h"
@@ -34,6 +36,7 @@ static int test_syscall_getpid_returns_current_pid(void);
 static int test_syscall_priority_changes_priority(void);
 static int test_syscall_priority_ignores_invalid(void);
 static int test_syscall_table_no_null_entries(void);
+static int test_syscall_mmap_munmap_entries(void);
 
 /* Test: Syscall table exists */
 static int test_syscall_table_exists(void) {
@@ -51,14 +54,17 @@ static int test_syscall_numbers_defined(void) {
   TEST_ASSERT_EQ(2, SYS_EXIT_NUMBER);
   TEST_ASSERT_EQ(3, SYS_GETPID_NUMBER);
   TEST_ASSERT_EQ(4, SYS_PRIORITY_NUMBER);
+  TEST_ASSERT_EQ(5, SYS_WAIT_NUMBER);
+  TEST_ASSERT_EQ(6, SYS_MMAP_NUMBER);
+  TEST_ASSERT_EQ(7, SYS_MUNMAP_NUMBER);
 
   return TEST_PASS;
 }
 
 /* Test: __NR_syscalls count is correct */
 static int test_syscall_nr_count(void) {
-  /* Should have 5 syscalls defined */
-  TEST_ASSERT_EQ(5, __NR_syscalls);
+  /* Should have 8 syscalls defined */
+  TEST_ASSERT_EQ(8, __NR_syscalls);
 
   /* Syscall numbers should be less than __NR_syscalls */
   TEST_ASSERT_LT(SYS_WRITE_NUMBER, __NR_syscalls);
@@ -66,6 +72,9 @@ static int test_syscall_nr_count(void) {
   TEST_ASSERT_LT(SYS_EXIT_NUMBER, __NR_syscalls);
   TEST_ASSERT_LT(SYS_GETPID_NUMBER, __NR_syscalls);
   TEST_ASSERT_LT(SYS_PRIORITY_NUMBER, __NR_syscalls);
+  TEST_ASSERT_LT(SYS_WAIT_NUMBER, __NR_syscalls);
+  TEST_ASSERT_LT(SYS_MMAP_NUMBER, __NR_syscalls);
+  TEST_ASSERT_LT(SYS_MUNMAP_NUMBER, __NR_syscalls);
 
   return TEST_PASS;
 }
@@ -193,6 +202,14 @@ static int test_syscall_table_no_null_entries(void) {
   return TEST_PASS;
 }
 
+/* Test: mmap and munmap dispatch to their handlers */
+static int test_syscall_mmap_munmap_entries(void) {
+  TEST_ASSERT_EQ((void *)sys_mmap, sys_call_table[SYS_MMAP_NUMBER]);
+  TEST_ASSERT_EQ((void *)sys_munmap, sys_call_table[SYS_MUNMAP_NUMBER]);
+
+  return TEST_PASS;
+}
+
 /* Register all syscall tests */
 void register_syscall_tests(void) {
   TEST_REGISTER(syscall, table_exists);
@@ -207,4 +224,5 @@ void register_syscall_tests(void) {
   TEST_REGISTER(syscall, priority_changes_priority);
   TEST_REGISTER(syscall, priority_ignores_invalid);
   TEST_REGISTER(syscall, table_no_null_entries);
+  TEST_REGISTER(syscall, mmap_munmap_entries);
 }
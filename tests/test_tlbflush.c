@@ -0,0 +1,231 @@
+/*
+ * TLB Flush Tests
+ *
+ * Tests for:
+ * - Flushes only reaching address spaces with a live ASID
+ * - tlb_gather range tracking and deferred page release
+ * - A remapped page becoming visible after a targeted unmap
+ * - Cost of a one-page change, full TLB flush vs one ASID-tagged VA
+ *
+ * The benchmark remaps one page of a BENCH_PAGES working set and then
+ * touches every page, counting L1D TLB refills: a full flush refills the
+ * whole working set, a targeted one only the page that changed.
+ */
+
+#include "arm/mmu.h"
+#include "asid.h"
+#include "cache.h"
+#include "fixtures.h"
+#include "mm.h"
+#include "printf.h"
+#include "sched.h"
+#include "test.h"
+#include "tlbflush.h"
+#include "utils.h"
+
+/* Forward declarations for test functions */
+static int test_tlbflush_asid_of_live_only(void);
+static int test_tlbflush_gather_range(void);
+static int test_tlbflush_gather_defers_put(void);
+static int test_tlbflush_gather_full_flushes(void);
+static int test_tlbflush_page_remap_visible(void);
+static int test_tlbflush_bench_one_page_change(void);
+
+#define BENCH_VA 0x30000000UL
+#define BENCH_PAGES 32
+#define BENCH_ITERS 256
+#define BENCH_PMU_COUNTER 0
+#define TLB_MAGIC 0x71B0UL
+
+/* Test: An mm never given an ASID this generation has nothing to flush */
+static int test_tlbflush_asid_of_live_only(void) {
+  struct mm_struct mm = {0};
+
+  TEST_ASSERT_EQ(0, asid_of(&mm));
+  unsigned long asid = asid_get(&mm);
+  TEST_ASSERT_NEQ(0, asid);
+  TEST_ASSERT_EQ(asid, asid_of(&mm));
+
+  return TEST_PASS;
+}
+
+/* Test: The gather covers every page queued, however they arrive */
+static int test_tlbflush_gather_range(void) {
+  struct mm_struct mm = {0};
+  struct tlb_gather tlb;
+  tlb_gather_init(&tlb, &mm);
+  TEST_ASSERT_EQ(tlb.start, tlb.end);
+
+  tlb_gather_page(&tlb, BENCH_VA + 10 * PAGE_SIZE + 8, 0);
+  tlb_gather_page(&tlb, BENCH_VA + 3 * PAGE_SIZE, 0);
+  tlb_gather_page(&tlb, BENCH_VA + 5 * PAGE_SIZE, 0);
+  TEST_ASSERT_EQ(BENCH_VA + 3 * PAGE_SIZE, tlb.start);
+  TEST_ASSERT_EQ(BENCH_VA + 11 * PAGE_SIZE, tlb.end);
+  TEST_ASSERT_EQ(0, tlb.freed_tables);
+  TEST_ASSERT_EQ(0, tlb.nr_pages);
+
+  tlb_gather_table(&tlb, BENCH_VA);
+  TEST_ASSERT_EQ(BENCH_VA, tlb.start);
+  TEST_ASSERT_EQ(1, tlb.freed_tables);
+
+  tlb_gather_flush(&tlb);
+  TEST_ASSERT_EQ(tlb.start, tlb.end);
+  TEST_ASSERT_EQ(0, tlb.freed_tables);
+
+  return TEST_PASS;
+}
+
+/* Test: Queued pages are only put once the flush has been issued */
+static int test_tlbflush_gather_defers_put(void) {
+  struct mm_struct mm = {0};
+  struct tlb_gather tlb;
+  tlb_gather_init(&tlb, &mm);
+  unsigned long page = get_free_page();
+  TEST_ASSERT_NEQ(0, page);
+
+  tlb_gather_page(&tlb, BENCH_VA, page);
+  TEST_ASSERT_EQ(1, page_count(page));
+  TEST_ASSERT_EQ(1, tlb.nr_pages);
+  tlb_gather_flush(&tlb);
+  TEST_ASSERT_EQ(0, page_count(page));
+  TEST_ASSERT_EQ(0, tlb.nr_pages);
+
+  return TEST_PASS;
+}
+
+/* Test: A full batch is flushed before the next page is queued */
+static int test_tlbflush_gather_full_flushes(void) {
+  struct mm_struct mm = {0};
+  struct tlb_gather tlb;
+  tlb_gather_init(&tlb, &mm);
+  unsigned long pages[TLB_GATHER_PAGES + 1];
+  for (int i = 0; i <= TLB_GATHER_PAGES; i++) {
+    pages[i] = get_free_page();
+    TEST_ASSERT_NEQ(0, pages[i]);
+  }
+
+  for (int i = 0; i <= TLB_GATHER_PAGES; i++) {
+    tlb_gather_page(&tlb, BENCH_VA + i * PAGE_SIZE, pages[i]);
+  }
+  TEST_ASSERT_EQ(1, tlb.nr_pages);
+  TEST_ASSERT_EQ(BENCH_VA + TLB_GATHER_PAGES * PAGE_SIZE, tlb.start);
+  for (int i = 0; i < TLB_GATHER_PAGES; i++) {
+    TEST_ASSERT_EQ(0, page_count(pages[i]));
+  }
+  TEST_ASSERT_EQ(1, page_count(pages[TLB_GATHER_PAGES]));
+  tlb_gather_flush(&tlb);
+  TEST_ASSERT_EQ(0, page_count(pages[TLB_GATHER_PAGES]));
+
+  return TEST_PASS;
+}
+
+/* Test: After remapping a live VA, one targeted flush exposes the new page */
+static int test_tlbflush_page_remap_visible(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long old_page = get_free_page();
+  unsigned long new_page = get_free_page();
+  TEST_ASSERT_NEQ(0, old_page);
+  TEST_ASSERT_NEQ(0, new_page);
+  *(unsigned long *)(new_page + VA_START) = TLB_MAGIC;
+  TEST_ASSERT_EQ(0, map_page(task, BENCH_VA, old_page));
+
+  preempt_disable();
+  switch_mm(&task->mm);
+  unsigned long before = *(volatile unsigned long *)BENCH_VA;
+  /* Break before make: the old translation goes before the new one */
+  TEST_ASSERT_EQ(0, unmap_range(task, BENCH_VA, 1));
+  TEST_ASSERT_EQ(0, map_page(task, BENCH_VA, new_page));
+  unsigned long after = *(volatile unsigned long *)BENCH_VA;
+  switch_mm(current->active_mm);
+  preempt_enable();
+
+  TEST_ASSERT_EQ(0, before);
+  TEST_ASSERT_EQ(TLB_MAGIC, after);
+
+  /* unmap_range dropped old_page */
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Touch one word in every benchmark page through the current TTBR0 */
+static void bench_touch(void) {
+  for (unsigned long i = 0; i < BENCH_PAGES; i++) {
+    (*(volatile unsigned long *)(BENCH_VA + i * PAGE_SIZE))++;
+  }
+}
+
+/* Remap page 0 and touch the working set BENCH_ITERS times; cycles/iter */
+static unsigned long bench_change(struct task_struct *task,
+                                  unsigned long pages[2], int targeted,
+                                  unsigned long *refills) {
+  unsigned long refill_start = pmu_read_event_counter(BENCH_PMU_COUNTER);
+  unsigned long start = get_cycles();
+  for (int i = 0; i < BENCH_ITERS; i++) {
+    /* Break before make, as any change of output address needs */
+    unsigned long *pte = pte_lookup(task, BENCH_VA);
+    unsigned long attrs = *pte & ~PTE_ADDR_MASK;
+    *pte = 0;
+    if (targeted) {
+      flush_tlb_page_mm(&task->mm, BENCH_VA);
+    } else {
+      flush_tlb_all();
+    }
+    *pte = pages[i & 1] | attrs;
+    dsb_ishst();
+    bench_touch();
+  }
+  unsigned long cycles = get_cycles() - start;
+  *refills =
+      (pmu_read_event_counter(BENCH_PMU_COUNTER) - refill_start) / BENCH_ITERS;
+  return cycles / BENCH_ITERS;
+}
+
+/* Benchmark: changing one mapping with a full flush vs a targeted one */
+static int test_tlbflush_bench_one_page_change(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  for (unsigned long i = 0; i < BENCH_PAGES; i++) {
+    TEST_ASSERT_EQ(
+        0, map_page(task, BENCH_VA + i * PAGE_SIZE, get_free_page()));
+  }
+  /* Page 0 alternates between its own page and a spare */
+  unsigned long pages[2] = {*pte_lookup(task, BENCH_VA) & PTE_ADDR_MASK,
+                            get_free_page()};
+  TEST_ASSERT_NEQ(0, pages[1]);
+
+  pmu_enable_cycle_counter();
+  pmu_enable_event_counter(BENCH_PMU_COUNTER, PMU_EVENT_L1D_TLB_REFILL);
+  preempt_disable();
+  switch_mm(&task->mm);
+
+  unsigned long full_refills, targeted_refills;
+  unsigned long full_cycles = bench_change(task, pages, 0, &full_refills);
+  unsigned long targeted_cycles =
+      bench_change(task, pages, 1, &targeted_refills);
+
+  switch_mm(current->active_mm);
+  preempt_enable();
+
+  printf("\r\n    remap 1 of %d pages: full flush %lu cycles %lu TLB refills, "
+         "by VA+ASID %lu cycles %lu TLB refills\r\n    ",
+         BENCH_PAGES, full_cycles, full_refills, targeted_cycles,
+         targeted_refills);
+
+  /* BENCH_ITERS is even, so page 0 is mapped to its own page again */
+  put_page(pages[1]);
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Register all TLB flush tests */
+void register_tlbflush_tests(void) {
+  TEST_REGISTER(tlbflush, asid_of_live_only);
+  TEST_REGISTER(tlbflush, gather_range);
+  TEST_REGISTER(tlbflush, gather_defers_put);
+  TEST_REGISTER(tlbflush, gather_full_flushes);
+  TEST_REGISTER(tlbflush, page_remap_visible);
+  TEST_REGISTER(tlbflush, bench_one_page_change);
+}
@@ -6,6 +6,8 @@
  * - put32/get32 memory operations
  * - memzero functionality
  * - memcpy functionality
+ * - memcpy/memzero alignment, tails and page fast paths
+ * - memcpy/memzero throughput per size class
  * - get_el (exception level)
  * - set_pgd/get_pgd (page directory)
  */
@@ -27,6 +29,10 @@ static int test_utils_memzero_boundary(void);
 static int test_utils_get_pgd_returns_value(void);
 static int test_utils_const_div_ceil_macro(void);
 static int test_utils_va_start_constant(void);
+static int test_utils_memcpy_unaligned_sizes(void);
+static int test_utils_memzero_unaligned_sizes(void);
+static int test_utils_page_fast_paths(void);
+static int test_utils_bench_memcpy_memzero_sizes(void);
 
 /* Test buffer for memory operations */
 static unsigned char test_buffer[256];
@@ -201,6 +207,185 @@ static int test_utils_va_start_constant(void) {
   return TEST_PASS;
 }
 
+/* Sizes that hit every path: byte tail, 8-byte tail, alignment, bulk */
+static const unsigned long copy_sizes[] = {1,  7,  8,   15,  16,  63,
+                                           64, 65, 127, 200, 300, 1029};
+#define COPY_SIZES (sizeof(copy_sizes) / sizeof(copy_sizes[0]))
+#define GUARD_BYTE 0xEE
+
+/* Test: memcpy is exact for unaligned pointers and odd sizes */
+static int test_utils_memcpy_unaligned_sizes(void) {
+  unsigned long src = allocate_kernel_page();
+  unsigned long dst = allocate_kernel_page();
+  TEST_ASSERT_NEQ(0, src);
+  TEST_ASSERT_NEQ(0, dst);
+  unsigned char *s = (unsigned char *)src;
+  unsigned char *d = (unsigned char *)dst;
+  for (int i = 0; i < PAGE_SIZE; i++) {
+    s[i] = (unsigned char)(i * 7 + 3);
+  }
+
+  for (unsigned long n = 0; n < COPY_SIZES; n++) {
+    for (int soff = 0; soff < 4; soff++) {
+      for (int doff = 0; doff < 4; doff++) {
+        unsigned long len = copy_sizes[n];
+        for (unsigned long i = 0; i < len + 16; i++) {
+          d[i] = GUARD_BYTE;
+        }
+        memcpy(dst + 8 + doff, src + soff, len);
+        for (int i = 0; i < 8 + doff; i++) {
+          TEST_ASSERT_EQ(GUARD_BYTE, d[i]);
+        }
+        for (unsigned long i = 0; i < len; i++) {
+          TEST_ASSERT_EQ(s[soff + i], d[8 + doff + i]);
+        }
+        TEST_ASSERT_EQ(GUARD_BYTE, d[8 + doff + len]);
+      }
+    }
+  }
+
+  free_page(src - VA_START);
+  free_page(dst - VA_START);
+
+  return TEST_PASS;
+}
+
+/* Test: memzero is exact for unaligned pointers and odd sizes */
+static int test_utils_memzero_unaligned_sizes(void) {
+  unsigned long buf = allocate_kernel_page();
+  TEST_ASSERT_NEQ(0, buf);
+  unsigned char *b = (unsigned char *)buf;
+
+  for (unsigned long n = 0; n < COPY_SIZES; n++) {
+    for (int off = 0; off < 16; off += 3) {
+      unsigned long len = copy_sizes[n];
+      for (unsigned long i = 0; i < len + 32; i++) {
+        b[i] = GUARD_BYTE;
+      }
+      memzero(buf + off, len);
+      for (int i = 0; i < off; i++) {
+        TEST_ASSERT_EQ(GUARD_BYTE, b[i]);
+      }
+      for (unsigned long i = 0; i < len; i++) {
+        TEST_ASSERT_EQ(0, b[off + i]);
+      }
+      TEST_ASSERT_EQ(GUARD_BYTE, b[off + len]);
+    }
+  }
+
+  /* Large enough for DC ZVA, starting and ending mid-block */
+  for (int i = 0; i < PAGE_SIZE; i++) {
+    b[i] = GUARD_BYTE;
+  }
+  memzero(buf + 40, PAGE_SIZE - 100);
+  TEST_ASSERT_EQ(GUARD_BYTE, b[39]);
+  for (int i = 40; i < PAGE_SIZE - 60; i++) {
+    TEST_ASSERT_EQ(0, b[i]);
+  }
+  TEST_ASSERT_EQ(GUARD_BYTE, b[PAGE_SIZE - 60]);
+
+  free_page(buf - VA_START);
+
+  return TEST_PASS;
+}
+
+/* Test: Page-aligned whole-page copy and clear */
+static int test_utils_page_fast_paths(void) {
+  unsigned long src = allocate_kernel_page();
+  unsigned long dst = allocate_kernel_page();
+  TEST_ASSERT_NEQ(0, src);
+  TEST_ASSERT_NEQ(0, dst);
+  unsigned long *s = (unsigned long *)src;
+  unsigned long *d = (unsigned long *)dst;
+  for (int i = 0; i < PAGE_SIZE / 8; i++) {
+    s[i] = 0x0123456789abcdefUL ^ i;
+  }
+
+  memcpy(dst, src, PAGE_SIZE);
+  for (int i = 0; i < PAGE_SIZE / 8; i++) {
+    TEST_ASSERT_EQ(s[i], d[i]);
+  }
+
+  memzero(dst, PAGE_SIZE);
+  for (int i = 0; i < PAGE_SIZE / 8; i++) {
+    TEST_ASSERT_EQ(0, d[i]);
+  }
+  /* The source page is untouched */
+  TEST_ASSERT_EQ(0x0123456789abcdefUL, s[0]);
+
+  free_page(src - VA_START);
+  free_page(dst - VA_START);
+
+  return TEST_PASS;
+}
+
+#define BENCH_BUF_ORDER 3 /* 32 KiB per buffer */
+#define BENCH_ROUNDS 16
+
+/* Print bytes per cycle with two decimals */
+static void print_bytes_per_cycle(const char *what, unsigned long size,
+                                  unsigned long cycles) {
+  if (cycles == 0) {
+    cycles = 1;
+  }
+  unsigned long scaled = size * 100 / cycles;
+  printf("\r\n    %s %lu: %lu.%02lu bytes/cycle", what, size, scaled / 100,
+         scaled % 100);
+}
+
+/* Benchmark: memcpy/memzero bytes per cycle for each size class */
+static int test_utils_bench_memcpy_memzero_sizes(void) {
+  static const unsigned long sizes[] = {16, 64, 256, 1024, PAGE_SIZE, 16384};
+  unsigned long src = alloc_pages(BENCH_BUF_ORDER);
+  unsigned long dst = alloc_pages(BENCH_BUF_ORDER);
+  TEST_ASSERT_NEQ(0, src);
+  TEST_ASSERT_NEQ(0, dst);
+  src += VA_START;
+  dst += VA_START;
+
+  pmu_enable_cycle_counter();
+  preempt_disable();
+  for (unsigned long i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    unsigned long size = sizes[i];
+    unsigned long start = get_cycles();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+      memcpy(dst, src, size);
+    }
+    unsigned long copy = (get_cycles() - start) / BENCH_ROUNDS;
+
+    start = get_cycles();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+      memzero(dst, size);
+    }
+    unsigned long zero = (get_cycles() - start) / BENCH_ROUNDS;
+
+    print_bytes_per_cycle("memcpy", size, copy);
+    print_bytes_per_cycle("memzero", size, zero);
+  }
+
+  /* Same page size but off the fast path */
+  unsigned long start = get_cycles();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    memcpy(dst + 8, src + 4, PAGE_SIZE);
+  }
+  unsigned long copy = (get_cycles() - start) / BENCH_ROUNDS;
+  start = get_cycles();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    memzero(dst + 8, PAGE_SIZE);
+  }
+  unsigned long zero = (get_cycles() - start) / BENCH_ROUNDS;
+  preempt_enable();
+
+  print_bytes_per_cycle("memcpy unaligned", PAGE_SIZE, copy);
+  print_bytes_per_cycle("memzero unaligned", PAGE_SIZE, zero);
+  printf("\r\n    ");
+
+  free_pages(src - VA_START, BENCH_BUF_ORDER);
+  free_pages(dst - VA_START, BENCH_BUF_ORDER);
+
+  return TEST_PASS;
+}
+
 /* Register all utility tests */
 void register_utils_tests(void) {
   TEST_REGISTER(utils, delay_returns);
@@ -213,4 +398,8 @@ void register_utils_tests(void) {
   TEST_REGISTER(utils, get_pgd_returns_value);
   TEST_REGISTER(utils, const_div_ceil_macro);
   TEST_REGISTER(utils, va_start_constant);
+  TEST_REGISTER(utils, memcpy_unaligned_sizes);
+  TEST_REGISTER(utils, memzero_unaligned_sizes);
+  TEST_REGISTER(utils, page_fast_paths);
+  TEST_REGISTER(utils, bench_memcpy_memzero_sizes);
 }
@@ -0,0 +1,289 @@
+/*
+ * Virtual Memory Area Tests
+ *
+ * Tests for:
+ * - VMA insertion, lookup and overlap rejection
+ * - Ordered iteration over a balanced VMA tree
+ * - Demand faults resolved against VMA permissions
+ * - Address spaces larger than the old 16 page limit
+ * - Fork copying the VMA tree
+ */
+
+#include "arm/mmu.h"
+#include "arm/sysregs.h"
+#include "avl.h"
+#include "fixtures.h"
+#include "mm.h"
+#include "sched.h"
+#include "test.h"
+#include "vma.h"
+
+/* Forward declarations for test functions */
+static int test_vma_insert_find(void);
+static int test_vma_overlap_rejected(void);
+static int test_vma_ordered_iteration(void);
+static int test_vma_tree_balanced(void);
+static int test_vma_fault_outside_vma(void);
+static int test_vma_fault_respects_permissions(void);
+static int test_vma_large_address_space(void);
+static int test_vma_fork_copies_vmas(void);
+
+#define VMA_BASE 0x10000000UL
+#define VMA_COUNT 64
+#define VMA_LARGE_PAGES 256 /* 1 MiB */
+/* Level 3 translation faults */
+#define READ_FAULT_ESR 0x07
+#define WRITE_FAULT_ESR (ESR_ELx_WNR | 0x07)
+
+/* Deliver a data abort to task as if it were running */
+static int vma_fault(struct task_struct *task, unsigned long va,
+                     unsigned long esr) {
+  preempt_disable();
+  struct task_struct *self = current;
+  current = task;
+  int ret = do_mem_abort(va, esr);
+  current = self;
+  preempt_enable();
+  return ret;
+}
+
+static int avl_depth(struct avl_node *node) {
+  if (!node) {
+    return 0;
+  }
+  int left = avl_depth(node->left);
+  int right = avl_depth(node->right);
+  return 1 + (left > right ? left : right);
+}
+
+/* Test: A VMA covers [start, end) and nothing else */
+static int test_vma_insert_find(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, insert_vma(&task->mm, VMA_BASE, VMA_BASE + 4 * PAGE_SIZE,
+                               VM_READ | VM_WRITE | VM_ANON));
+  TEST_ASSERT_EQ(1, task->mm.map_count);
+
+  struct vm_area_struct *vma = find_vma(&task->mm, VMA_BASE);
+  TEST_ASSERT_NOT_NULL(vma);
+  TEST_ASSERT_EQ(VMA_BASE, vma->vm_start);
+  TEST_ASSERT_EQ(VMA_BASE + 4 * PAGE_SIZE, vma->vm_end);
+  TEST_ASSERT_EQ(vma, find_vma(&task->mm, VMA_BASE + 4 * PAGE_SIZE - 1));
+  TEST_ASSERT_NULL(find_vma(&task->mm, VMA_BASE - 1));
+  TEST_ASSERT_NULL(find_vma(&task->mm, VMA_BASE + 4 * PAGE_SIZE));
+
+  /* Unaligned and empty ranges are refused */
+  TEST_ASSERT_EQ(-1, insert_vma(&task->mm, 0x100, PAGE_SIZE, VM_READ));
+  TEST_ASSERT_EQ(-1, insert_vma(&task->mm, PAGE_SIZE, PAGE_SIZE, VM_READ));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Overlapping VMAs cannot be inserted */
+static int test_vma_overlap_rejected(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, insert_vma(&task->mm, VMA_BASE, VMA_BASE + 4 * PAGE_SIZE,
+                               VM_READ));
+  TEST_ASSERT_EQ(-1, insert_vma(&task->mm, VMA_BASE + PAGE_SIZE,
+                                VMA_BASE + 2 * PAGE_SIZE, VM_READ));
+  TEST_ASSERT_EQ(-1, insert_vma(&task->mm, VMA_BASE - PAGE_SIZE,
+                                VMA_BASE + PAGE_SIZE, VM_READ));
+  /* Touching but not overlapping is fine */
+  TEST_ASSERT_EQ(0, insert_vma(&task->mm, VMA_BASE + 4 * PAGE_SIZE,
+                               VMA_BASE + 5 * PAGE_SIZE, VM_READ));
+  TEST_ASSERT_EQ(2, task->mm.map_count);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Iteration visits VMAs in address order whatever the insert order */
+static int test_vma_ordered_iteration(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  /* Stride through the slots so inserts arrive out of order */
+  for (int i = 0; i < VMA_COUNT; i++) {
+    unsigned long slot = (i * 37) % VMA_COUNT;
+    unsigned long start = VMA_BASE + slot * 2 * PAGE_SIZE;
+    TEST_ASSERT_EQ(0, insert_vma(&task->mm, start, start + PAGE_SIZE, VM_READ));
+  }
+
+  int count = 0;
+  unsigned long last = 0;
+  for (struct vm_area_struct *vma = vma_first(&task->mm); vma;
+       vma = vma_next(&task->mm, vma)) {
+    TEST_ASSERT_GT(vma->vm_start, last);
+    last = vma->vm_start;
+    count++;
+  }
+  TEST_ASSERT_EQ(VMA_COUNT, count);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Ascending inserts still give a logarithmic depth */
+static int test_vma_tree_balanced(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  for (int i = 0; i < VMA_COUNT; i++) {
+    unsigned long start = VMA_BASE + i * PAGE_SIZE;
+    TEST_ASSERT_EQ(0, insert_vma(&task->mm, start, start + PAGE_SIZE, VM_READ));
+  }
+  /* An AVL tree of 64 nodes is at most 1.44 * log2(65) ~ 8 deep */
+  TEST_ASSERT_LTE(avl_depth(task->mm.mmap), 8);
+
+  /* Removing every other VMA keeps the rest reachable */
+  for (int i = 0; i < VMA_COUNT; i += 2) {
+    struct vm_area_struct *vma =
+        find_vma(&task->mm, VMA_BASE + i * PAGE_SIZE);
+    TEST_ASSERT_NOT_NULL(vma);
+    remove_vma(&task->mm, vma);
+  }
+  TEST_ASSERT_EQ(VMA_COUNT / 2, task->mm.map_count);
+  for (int i = 0; i < VMA_COUNT; i++) {
+    struct vm_area_struct *vma =
+        find_vma(&task->mm, VMA_BASE + i * PAGE_SIZE);
+    if (i % 2) {
+      TEST_ASSERT_NOT_NULL(vma);
+    } else {
+      TEST_ASSERT_NULL(vma);
+    }
+  }
+  TEST_ASSERT_LTE(avl_depth(task->mm.mmap), 7);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Touching memory outside every VMA is an error */
+static int test_vma_fault_outside_vma(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(-1, vma_fault(task, VMA_BASE, WRITE_FAULT_ESR));
+  TEST_ASSERT_EQ(0, task->mm.rss);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Faults honour the VMA's permissions and fill zeroed pages */
+static int test_vma_fault_respects_permissions(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+
+  TEST_ASSERT_EQ(0, insert_vma(&task->mm, VMA_BASE, VMA_BASE + PAGE_SIZE,
+                               VM_READ | VM_ANON));
+  TEST_ASSERT_EQ(-1, vma_fault(task, VMA_BASE, WRITE_FAULT_ESR));
+  TEST_ASSERT_EQ(0, vma_fault(task, VMA_BASE + 8, READ_FAULT_ESR));
+  TEST_ASSERT_EQ(1, task->mm.rss);
+
+  unsigned long *pte = pte_lookup(task, VMA_BASE);
+  TEST_ASSERT_NOT_NULL(pte);
+  TEST_ASSERT_EQ(MM_AP_RDONLY, *pte & MM_AP_RDONLY);
+  TEST_ASSERT(*pte & PTE_UXN);
+  unsigned long *data = (unsigned long *)((*pte & PTE_ADDR_MASK) + VA_START);
+  for (int i = 0; i < PAGE_SIZE / 8; i++) {
+    TEST_ASSERT_EQ(0, data[i]);
+  }
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A task can fault in far more than 16 pages */
+static int test_vma_large_address_space(void) {
+  struct task_struct *task = test_task();
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long free_before = nr_free_pages();
+
+  TEST_ASSERT_EQ(0, insert_vma(&task->mm, VMA_BASE,
+                               VMA_BASE + VMA_LARGE_PAGES * PAGE_SIZE,
+                               VM_READ | VM_WRITE | VM_ANON));
+  for (int i = 0; i < VMA_LARGE_PAGES; i++) {
+    TEST_ASSERT_EQ(0, vma_fault(task, VMA_BASE + i * PAGE_SIZE + 16,
+                                WRITE_FAULT_ESR));
+  }
+  TEST_ASSERT_EQ(VMA_LARGE_PAGES, task->mm.rss);
+  /* PGD, PUD, PMD and one PTE table cover the whole megabyte */
+  TEST_ASSERT_EQ(4, task->mm.nr_ptes);
+
+  exit_mm(task);
+  TEST_ASSERT_EQ(0, task->mm.rss);
+  TEST_ASSERT_EQ(0, task->mm.map_count);
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+
+  free_page((unsigned long)task - VA_START);
+
+  return TEST_PASS;
+}
+
+/* Test: The child of a fork gets the same VMAs and shared pages */
+static int test_vma_fork_copies_vmas(void) {
+  struct task_struct *parent = test_task();
+  struct task_struct *child = test_task();
+  TEST_ASSERT_NOT_NULL(parent);
+  TEST_ASSERT_NOT_NULL(child);
+
+  for (int i = 0; i < 4; i++) {
+    unsigned long start = VMA_BASE + i * 16 * PAGE_SIZE;
+    TEST_ASSERT_EQ(0, insert_vma(&parent->mm, start, start + 8 * PAGE_SIZE,
+                                 VM_READ | VM_WRITE | VM_ANON));
+    TEST_ASSERT_EQ(0, vma_fault(parent, start, WRITE_FAULT_ESR));
+  }
+
+  preempt_disable();
+  struct task_struct *self = current;
+  current = parent;
+  int ret = copy_virt_memory(child);
+  current = self;
+  preempt_enable();
+  TEST_ASSERT_EQ(0, ret);
+
+  TEST_ASSERT_EQ(parent->mm.map_count, child->mm.map_count);
+  TEST_ASSERT_EQ(parent->mm.rss, child->mm.rss);
+  struct vm_area_struct *a = vma_first(&parent->mm);
+  struct vm_area_struct *b = vma_first(&child->mm);
+  while (a && b) {
+    TEST_ASSERT_NEQ(a, b);
+    TEST_ASSERT_EQ(a->vm_start, b->vm_start);
+    TEST_ASSERT_EQ(a->vm_end, b->vm_end);
+    TEST_ASSERT_EQ(a->vm_flags, b->vm_flags);
+    TEST_ASSERT_EQ(*pte_lookup(parent, a->vm_start),
+                   *pte_lookup(child, b->vm_start));
+    a = vma_next(&parent->mm, a);
+    b = vma_next(&child->mm, b);
+  }
+  TEST_ASSERT_NULL(a);
+  TEST_ASSERT_NULL(b);
+
+  test_task_free(parent);
+  test_task_free(child);
+
+  return TEST_PASS;
+}
+
+/* Register all VMA tests */
+void register_vma_tests(void) {
+  TEST_REGISTER(vma, insert_find);
+  TEST_REGISTER(vma, overlap_rejected);
+  TEST_REGISTER(vma, ordered_iteration);
+  TEST_REGISTER(vma, tree_balanced);
+  TEST_REGISTER(vma, fault_outside_vma);
+  TEST_REGISTER(vma, fault_respects_permissions);
+  TEST_REGISTER(vma, large_address_space);
+  TEST_REGISTER(vma, fork_copies_vmas);
+}
@@ -0,0 +1,154 @@
+/*
+ * vmalloc Tests
+ *
+ * Tests for:
+ * - Page-by-page backing of a virtually contiguous kernel buffer
+ * - Guard pages between allocations
+ * - vfree returning the pages and the address range
+ * - Multi-megabyte buffers out of fragmented physical memory
+ * - Access through the vmalloc mapping
+ */
+
+#include "mm.h"
+#include "slab.h"
+#include "test.h"
+#include "vmalloc.h"
+
+/* Forward declarations for test functions */
+static int test_vmalloc_maps_pages(void);
+static int test_vmalloc_guard_gap(void);
+static int test_vmalloc_vfree_reuses(void);
+static int test_vmalloc_fragmented_memory(void);
+static int test_vmalloc_access(void);
+
+#define FRAGMENT_PAGES 2048
+#define FRAGMENT_VMALLOC_PAGES 512
+
+/* Test: Every page of a buffer is mapped, zeroed by vzalloc, kernel owned */
+static int test_vmalloc_maps_pages(void) {
+  unsigned long size = 3 * PAGE_SIZE + 1;
+  unsigned char *buf = vzalloc(size);
+  TEST_ASSERT_NOT_NULL(buf);
+  unsigned long addr = (unsigned long)buf;
+  TEST_ASSERT(is_vmalloc_addr(addr));
+  TEST_ASSERT_EQ(0, addr & (PAGE_SIZE - 1));
+
+  for (unsigned long off = 0; off < 4 * PAGE_SIZE; off += PAGE_SIZE) {
+    unsigned long phys = vmalloc_to_phys(buf + off);
+    TEST_ASSERT_NEQ(0, phys);
+    TEST_ASSERT_EQ(PG_KERNEL, phys_to_page(phys)->flags);
+    unsigned char *alias = (unsigned char *)(phys + VA_START);
+    for (int i = 0; i < PAGE_SIZE; i++) {
+      TEST_ASSERT_EQ(0, alias[i]);
+    }
+  }
+  TEST_ASSERT_EQ(vmalloc_to_phys(buf) + 0x123, vmalloc_to_phys(buf + 0x123));
+
+  vfree(buf);
+  TEST_ASSERT_EQ(0, vmalloc_to_phys(buf));
+
+  return TEST_PASS;
+}
+
+/* Test: An unmapped guard page separates neighbouring buffers */
+static int test_vmalloc_guard_gap(void) {
+  void *a = vmalloc(2 * PAGE_SIZE);
+  void *b = vmalloc(PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+
+  unsigned long end_a = (unsigned long)a + 2 * PAGE_SIZE;
+  TEST_ASSERT((unsigned long)b >= end_a + PAGE_SIZE);
+  TEST_ASSERT_EQ(0, vmalloc_to_phys((void *)end_a));
+
+  vfree(a);
+  vfree(b);
+
+  return TEST_PASS;
+}
+
+/* Test: vfree gives back every page, and the range is handed out again */
+static int test_vmalloc_vfree_reuses(void) {
+  /* The first buffer pays for the page tables, which are kept */
+  void *warm = vmalloc(8 * PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(warm);
+  vfree(warm);
+
+  unsigned long free_before = nr_free_pages();
+  void *buf = vmalloc(8 * PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(buf);
+  TEST_ASSERT_EQ(warm, buf);
+  TEST_ASSERT_EQ(free_before - 8, nr_free_pages());
+
+  vfree(buf);
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+  /* Freeing something vmalloc did not hand out is ignored */
+  vfree(buf);
+  vfree((void *)(VMALLOC_START + PAGE_SIZE));
+  TEST_ASSERT_EQ(free_before, nr_free_pages());
+
+  TEST_ASSERT_NULL(vmalloc(0));
+  TEST_ASSERT_NULL(vmalloc(VMALLOC_END - VMALLOC_START));
+
+  return TEST_PASS;
+}
+
+/* Test: A multi-megabyte buffer comes together from scattered pages */
+static int test_vmalloc_fragmented_memory(void) {
+  unsigned long *pages = kmalloc(FRAGMENT_PAGES * sizeof(unsigned long));
+  TEST_ASSERT_NOT_NULL(pages);
+  for (int i = 0; i < FRAGMENT_PAGES; i++) {
+    pages[i] = get_free_page_nozero();
+    TEST_ASSERT_NEQ(0, pages[i]);
+  }
+  /* Free every other page, leaving holes no bigger than one page */
+  for (int i = 0; i < FRAGMENT_PAGES; i += 2) {
+    free_page(pages[i]);
+  }
+
+  unsigned char *buf = vmalloc(FRAGMENT_VMALLOC_PAGES * PAGE_SIZE);
+  TEST_ASSERT_NOT_NULL(buf);
+  for (int i = 1; i < FRAGMENT_VMALLOC_PAGES; i++) {
+    unsigned long prev = vmalloc_to_phys(buf + (i - 1) * PAGE_SIZE);
+    unsigned long phys = vmalloc_to_phys(buf + i * PAGE_SIZE);
+    TEST_ASSERT_NEQ(0, phys);
+    TEST_ASSERT_NEQ(prev + PAGE_SIZE, phys);
+  }
+
+  vfree(buf);
+  for (int i = 1; i < FRAGMENT_PAGES; i += 2) {
+    free_page(pages[i]);
+  }
+  kfree(pages);
+
+  return TEST_PASS;
+}
+
+/* Test: Stores through the mapping land in the backing pages */
+static int test_vmalloc_access(void) {
+  unsigned long size = 2 * SECTION_SIZE + 5 * PAGE_SIZE;
+  unsigned long *buf = vmalloc(size);
+  TEST_ASSERT_NOT_NULL(buf);
+
+  for (unsigned long i = 0; i < size / 8; i += PAGE_SIZE / 8) {
+    buf[i] = i;
+  }
+  for (unsigned long i = 0; i < size / 8; i += PAGE_SIZE / 8) {
+    unsigned long phys = vmalloc_to_phys(&buf[i]);
+    TEST_ASSERT_EQ(i, *(unsigned long *)(phys + VA_START));
+    TEST_ASSERT_EQ(i, buf[i]);
+  }
+
+  vfree(buf);
+
+  return TEST_PASS;
+}
+
+/* Register all vmalloc tests */
+void register_vmalloc_tests(void) {
+  TEST_REGISTER(vmalloc, maps_pages);
+  TEST_REGISTER(vmalloc, guard_gap);
+  TEST_REGISTER(vmalloc, vfree_reuses);
+  TEST_REGISTER(vmalloc, fragmented_memory);
+  TEST_REGISTER(vmalloc, access);
+}
@@ -0,0 +1,196 @@
+/*
+ * Working Set Estimation Tests
+ *
+ * Tests for:
+ * - Clearing the access flag and taking the access flag fault
+ * - Contiguous runs aged as one
+ * - The aging scan and per-process working set sizes
+ * - Reclaim giving accessed pages a second chance
+ */
+
+#include "arm/mmu.h"
+#include "fixtures.h"
+#include "fork.h"
+#include "mm.h"
+#include "sched.h"
+#include "swap.h"
+#include "test.h"
+#include "vma.h"
+#include "wss.h"
+
+/* Forward declarations for test functions */
+static int test_wss_access_fault_marks_young(void);
+static int test_wss_cont_run_ages_together(void);
+static int test_wss_scan_estimates_wss(void);
+static int test_wss_reclaim_spares_young(void);
+
+#define WSS_VA 0x70000000UL
+#define WSS_TEST_PAGES 32
+
+/* A bare user task with that many anonymous pages at WSS_VA, or a
+ * contiguous run of CONT_PTES pages if pages is 0 */
+static struct task_struct *wss_task(unsigned long pages) {
+  struct task_struct *task =
+      test_anon_task(WSS_VA, pages ? pages : CONT_PTES, pages);
+  if (task == 0) {
+    return 0;
+  }
+  if (pages == 0) {
+    unsigned long run = alloc_pages(CONT_PTE_ORDER);
+    if (run == 0) {
+      test_task_free(task);
+      return 0;
+    }
+    split_page(run, CONT_PTE_ORDER);
+    if (map_range(task, WSS_VA, run, CONT_PTES, MMU_PTE_FLAGS) < 0) {
+      for (unsigned long i = 0; i < CONT_PTES; i++) {
+        free_page(run + i * PAGE_SIZE);
+      }
+      test_task_free(task);
+      return 0;
+    }
+    return task;
+  }
+  /* Not one repeated word, so reclaim has to compress it */
+  for (unsigned long i = 0; i < pages; i++) {
+    unsigned long *pte = pte_lookup(task, WSS_VA + i * PAGE_SIZE);
+    ((unsigned long *)((*pte & PTE_ADDR_MASK) + VA_START))[1] = i + 1;
+  }
+  return task;
+}
+
+/* Age until the hand is back at the start of a pass */
+static void wss_finish_pass(void) {
+  struct wss_stats before, now;
+  wss_get_stats(&before);
+  do {
+    wss_scan(4096);
+    wss_get_stats(&now);
+  } while (now.full_scans == before.full_scans);
+}
+
+/* Test: Aging clears the flag; the fault sets it back and marks the page */
+static int test_wss_access_fault_marks_young(void) {
+  struct task_struct *task = wss_task(1);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long *pte = pte_lookup(task, WSS_VA);
+  unsigned long page = *pte & PTE_ADDR_MASK;
+  unsigned long size;
+
+  /* Mapped with the flag set, as the page was just touched */
+  TEST_ASSERT_EQ(1, test_and_clear_young(task, WSS_VA, &size));
+  TEST_ASSERT_EQ(PAGE_SIZE, size);
+  TEST_ASSERT_EQ(0, *pte & MM_ACCESS);
+  TEST_ASSERT(*pte & PTE_VALID);
+  TEST_ASSERT_EQ(0, test_and_clear_young(task, WSS_VA, &size));
+
+  TEST_ASSERT_EQ(0, handle_access_fault(task, WSS_VA + 8));
+  TEST_ASSERT(*pte & MM_ACCESS);
+  TEST_ASSERT(phys_to_page(page)->flags & PG_YOUNG);
+  TEST_ASSERT_EQ(1, test_and_clear_young(task, WSS_VA, &size));
+  TEST_ASSERT_EQ(0, phys_to_page(page)->flags & PG_YOUNG);
+
+  /* Nothing mapped, nothing to age */
+  TEST_ASSERT_EQ(-1, test_and_clear_young(task, WSS_VA + PAGE_SIZE, &size));
+  TEST_ASSERT_EQ(-1, handle_access_fault(task, WSS_VA + PAGE_SIZE));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A contiguous run is cleared and set a whole group at a time */
+static int test_wss_cont_run_ages_together(void) {
+  struct task_struct *task = wss_task(0);
+  TEST_ASSERT_NOT_NULL(task);
+  unsigned long size;
+
+  TEST_ASSERT_EQ(1, test_and_clear_young(task, WSS_VA, &size));
+  TEST_ASSERT_EQ(CONT_PTE_SIZE, size);
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    unsigned long pte = *pte_lookup(task, WSS_VA + i * PAGE_SIZE);
+    TEST_ASSERT(pte & PTE_CONT);
+    TEST_ASSERT_EQ(0, pte & MM_ACCESS);
+  }
+
+  TEST_ASSERT_EQ(0, handle_access_fault(task, WSS_VA + 5 * PAGE_SIZE));
+  for (unsigned long i = 0; i < CONT_PTES; i++) {
+    TEST_ASSERT(*pte_lookup(task, WSS_VA + i * PAGE_SIZE) & MM_ACCESS);
+  }
+  TEST_ASSERT_EQ(1, test_and_clear_young(task, WSS_VA, &size));
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: A pass counts the pages accessed since the one before */
+static int test_wss_scan_estimates_wss(void) {
+  struct task_struct *task = wss_task(WSS_TEST_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, test_task_list(task));
+
+  /* From wherever the hand is to the start of a pass */
+  wss_finish_pass();
+  for (unsigned long i = 0; i < WSS_TEST_PAGES; i++) {
+    handle_access_fault(task, WSS_VA + i * PAGE_SIZE);
+  }
+  wss_finish_pass();
+  unsigned long first = task->mm.wss;
+  for (unsigned long i = 0; i < WSS_TEST_PAGES; i += 4) {
+    handle_access_fault(task, WSS_VA + i * PAGE_SIZE);
+  }
+  wss_finish_pass();
+  unsigned long second = task->mm.wss;
+  wss_finish_pass();
+  unsigned long idle = task->mm.wss;
+  struct wss_stats stats;
+  wss_get_stats(&stats);
+
+  test_task_unlist(task);
+
+  TEST_ASSERT_EQ(WSS_TEST_PAGES, first);
+  TEST_ASSERT_EQ(WSS_TEST_PAGES / 4, second);
+  TEST_ASSERT_EQ(0, idle);
+  TEST_ASSERT_GT(stats.last_pass_us, 0);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Test: Reclaim passes over pages accessed since its last turn */
+static int test_wss_reclaim_spares_young(void) {
+  struct task_struct *task = wss_task(WSS_TEST_PAGES);
+  TEST_ASSERT_NOT_NULL(task);
+  TEST_ASSERT_EQ(0, test_task_list(task));
+
+  /* Age everything, then touch page 0 */
+  wss_finish_pass();
+  wss_finish_pass();
+  handle_access_fault(task, WSS_VA);
+  unsigned long page = *pte_lookup(task, WSS_VA) & PTE_ADDR_MASK;
+
+  /* All the old pages; the hand stops before coming round again */
+  try_to_free_pages(WSS_TEST_PAGES - 1);
+  unsigned long kept = *pte_lookup(task, WSS_VA);
+  unsigned long swapped = task->mm.nr_swap;
+
+  test_task_unlist(task);
+
+  TEST_ASSERT(kept & PTE_VALID);
+  TEST_ASSERT_EQ(page, kept & PTE_ADDR_MASK);
+  TEST_ASSERT_EQ(WSS_TEST_PAGES - 1, swapped);
+
+  test_task_free(task);
+
+  return TEST_PASS;
+}
+
+/* Register all working set estimation tests */
+void register_wss_tests(void) {
+  TEST_REGISTER(wss, access_fault_marks_young);
+  TEST_REGISTER(wss, cont_run_ages_together);
+  TEST_REGISTER(wss, scan_estimates_wss);
+  TEST_REGISTER(wss, reclaim_spares_young);
+}